@@ -0,0 +1,20 @@
+
+core.log("info", "Initializing asynchronous environment (game)")
+
+local commonpath = core.get_builtin_path() .. "common" .. DIR_DELIM
+local gamepath = core.get_builtin_path() .. "game" .. DIR_DELIM
+
+dofile(commonpath .. "vector.lua")
+dofile(gamepath .. "voxelarea.lua")
+
+local function pack2(...)
+	return {n = select("#", ...), ...}
+end
+
+function core.job_processor(func, serialized_param)
+	local param = core.deserialize(serialized_param)
+
+	local retval = pack2(func(unpack(param, 1, param.n)))
+
+	return core.serialize(retval)
+end
@@ -0,0 +1,33 @@
+
+core.log("info", "Initializing mapgen environment")
+
+local scriptpath = core.get_builtin_path()
+local commonpath = scriptpath .. "common" .. DIR_DELIM
+local gamepath = scriptpath .. "game" .. DIR_DELIM
+
+dofile(commonpath .. "vector.lua")
+dofile(gamepath .. "voxelarea.lua")
+
+core.callback_origins = {}
+
+core.registered_on_generateds = {}
+
+function core.register_on_generated(func)
+	local t = core.registered_on_generateds
+	t[#t + 1] = func
+	core.callback_origins[func] = {
+		mod = core.get_current_modname() or "??",
+		name = "register_on_generated"
+	}
+end
+
+-- The engine only runs on_generated callbacks here, all of them
+function core.run_callbacks(callbacks, mode, ...)
+	for _, func in ipairs(callbacks) do
+		local origin = core.callback_origins[func]
+		if origin then
+			core.set_last_run_mod(origin.mod)
+		end
+		func(...)
+	end
+end
@@ -0,0 +1,25 @@
+
+core.async_jobs = {}
+
+function core.async_event_handler(jobid, serialized_retval)
+	local callback = core.async_jobs[jobid]
+	assert(type(callback) == "function")
+	core.async_jobs[jobid] = nil
+
+	local retval = core.deserialize(serialized_retval)
+	if type(retval) ~= "table" then
+		error("Asynchronous job " .. jobid .. " failed, see the error above")
+	end
+	callback(unpack(retval, 1, retval.n))
+end
+
+function core.handle_async(func, callback, ...)
+	assert(type(func) == "function" and type(callback) == "function",
+		"Invalid minetest.handle_async invocation")
+
+	local args = {n = select("#", ...), ...}
+	local jobid = core.do_async_callback(func, core.serialize(args))
+	core.async_jobs[jobid] = callback
+
+	return true
+end
@@ -29,6 +29,7 @@ local gamepath = scriptdir .. "game" .. DIR_DELIM
 local clientpath = scriptdir .. "client" .. DIR_DELIM
 local commonpath = scriptdir .. "common" .. DIR_DELIM
 local asyncpath = scriptdir .. "async" .. DIR_DELIM
+local emergepath = scriptdir .. "emerge" .. DIR_DELIM
 
 dofile(commonpath .. "strict.lua")
 dofile(commonpath .. "serialize.lua")
@@ -46,6 +47,10 @@ elseif INIT == "mainmenu" then
 	end
 elseif INIT == "async" then
 	dofile(asyncpath .. "init.lua")
+elseif INIT == "async_game" then
+	dofile(asyncpath .. "game.lua")
+elseif INIT == "emerge" then
+	dofile(emergepath .. "init.lua")
 elseif INIT == "client" then
 	dofile(clientpath .. "init.lua")
 else
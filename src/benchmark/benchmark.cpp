@@ -0,0 +1,46 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark.h"
+
+#include <iomanip>
+#include "log.h"
+#include "porting.h"
+
+void BenchmarkBase::report(const char *what, u64 count, u64 time_us)
+{
+	rawstream << "    " << std::left << std::setw(40) << what << std::right
+		<< std::setw(10) << time_us / 1000 << "ms "
+		<< std::fixed << std::setprecision(1) << std::setw(10)
+		<< (time_us ? (double)count / time_us : 0.0) << " M/s" << std::endl;
+}
+
+int run_benchmarks()
+{
+	u64 t1 = porting::getTimeMs();
+
+	for (BenchmarkBase *benchmark : BenchmarkManager::getBenchmarks()) {
+		rawstream << "======== Benchmark " << benchmark->getName() << std::endl;
+		benchmark->run();
+	}
+
+	rawstream << "Benchmarks took " << porting::getTimeMs() - t1
+		<< "ms total." << std::endl;
+	return 0;
+}
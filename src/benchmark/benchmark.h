@@ -0,0 +1,57 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+
+/*
+	Benchmarks are registered like the unit test modules and run with
+	--run-benchmarks. They print their results and don't check anything.
+*/
+
+class BenchmarkBase {
+public:
+	virtual ~BenchmarkBase() = default;
+
+	virtual const char *getName() = 0;
+	virtual void run() = 0;
+
+protected:
+	// Prints the throughput of count operations that took time_us
+	void report(const char *what, u64 count, u64 time_us);
+};
+
+class BenchmarkManager {
+public:
+	static std::vector<BenchmarkBase *> &getBenchmarks()
+	{
+		static std::vector<BenchmarkBase *> benchmarks;
+		return benchmarks;
+	}
+
+	static void registerBenchmark(BenchmarkBase *benchmark)
+	{
+		getBenchmarks().push_back(benchmark);
+	}
+};
+
+// Runs all benchmarks, returns the exit code
+int run_benchmarks();
@@ -0,0 +1,167 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark.h"
+
+#include <map>
+#include "log.h"
+#include "mapblock.h"
+#include "mapblockindex.h"
+#include "mapsector.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+
+class BenchmarkMapBlockIndex : public BenchmarkBase {
+public:
+	BenchmarkMapBlockIndex() { BenchmarkManager::registerBenchmark(this); }
+	const char *getName() { return "MapBlockIndex"; }
+
+	void run();
+};
+
+static BenchmarkMapBlockIndex g_benchmark_instance;
+
+// The lookup Map::getBlockNoCreateNoEx() did before MapBlockIndex: the
+// sector map with a cache of the last sector, then the blocks of the sector
+class SectorLookup {
+public:
+	~SectorLookup()
+	{
+		for (auto &sector : m_sectors)
+			delete sector.second;
+	}
+
+	void insert(MapBlock *block)
+	{
+		v2s16 p2d(block->getPos().X, block->getPos().Z);
+		MapSector *&sector = m_sectors[p2d];
+		if (!sector)
+			sector = new MapSector(nullptr, p2d, nullptr);
+		sector->insertBlock(block);
+	}
+
+	MapBlock *get(v3s16 p)
+	{
+		v2s16 p2d(p.X, p.Z);
+		MapSector *sector;
+		if (m_sector_cache && p2d == m_sector_cache_p) {
+			sector = m_sector_cache;
+		} else {
+			auto it = m_sectors.find(p2d);
+			if (it == m_sectors.end())
+				return nullptr;
+			sector = it->second;
+			m_sector_cache_p = p2d;
+			m_sector_cache = sector;
+		}
+		return sector->getBlockNoCreateNoEx(p.Y);
+	}
+
+private:
+	std::map<v2s16, MapSector *> m_sectors;
+	MapSector *m_sector_cache = nullptr;
+	v2s16 m_sector_cache_p;
+};
+
+// Read and written around the timed part, so that the compiler can neither
+// move the lookups out of it nor leave them out
+static volatile s16 g_offset = 0;
+static volatile u32 g_found = 0;
+
+// Time of the fastest of a few runs, each looking up all positions
+// repeat times. found is set to the number of blocks found in one pass.
+template <typename Lookup>
+static u64 time_lookups(Lookup &lookup, const std::vector<v3s16> &positions,
+		int repeat, u32 *found)
+{
+	u64 best = (u64)-1;
+	for (int i = 0; i < 5; i++) {
+		u64 t1 = porting::getTimeUs();
+		for (int j = 0; j < repeat; j++) {
+			v3s16 offset(g_offset, g_offset, g_offset);
+			u32 count = 0;
+			for (v3s16 p : positions)
+				count += lookup.get(p + offset) != nullptr;
+			g_found = count;
+		}
+		best = MYMIN(best, porting::getTimeUs() - t1);
+	}
+	*found = g_found;
+	return best;
+}
+
+void BenchmarkMapBlockIndex::run()
+{
+	// The blocks loaded around a player with a large view range
+	const v3s16 size(41, 17, 41);
+	const v3s16 min_edge = -size / 2;
+
+	SectorLookup sectors;
+	MapBlockIndex index;
+	v3s16 p;
+	for (p.Z = min_edge.Z; p.Z < min_edge.Z + size.Z; p.Z++)
+	for (p.Y = min_edge.Y; p.Y < min_edge.Y + size.Y; p.Y++)
+	for (p.X = min_edge.X; p.X < min_edge.X + size.X; p.X++) {
+		// Dummy blocks, the lookup doesn't need their data
+		MapBlock *block = new MapBlock(nullptr, p, nullptr, true);
+		sectors.insert(block);
+		index.insert(block);
+	}
+	rawstream << "    " << index.size() << " blocks" << std::endl;
+
+	// Random positions, some of them outside of the loaded area
+	std::vector<v3s16> random;
+	PcgRandom pr(42);
+	for (int i = 0; i < 4000000; i++)
+		random.emplace_back(
+			pr.range(min_edge.X - 4, min_edge.X + size.X + 3),
+			pr.range(min_edge.Y - 4, min_edge.Y + size.Y + 3),
+			pr.range(min_edge.Z - 4, min_edge.Z + size.Z + 3));
+
+	// Every block and its six neighbors, like lighting and liquids do
+	std::vector<v3s16> walk;
+	for (p.Z = min_edge.Z; p.Z < min_edge.Z + size.Z; p.Z++)
+	for (p.Y = min_edge.Y; p.Y < min_edge.Y + size.Y; p.Y++)
+	for (p.X = min_edge.X; p.X < min_edge.X + size.X; p.X++) {
+		walk.push_back(p);
+		walk.emplace_back(p.X + 1, p.Y, p.Z);
+		walk.emplace_back(p.X - 1, p.Y, p.Z);
+		walk.emplace_back(p.X, p.Y + 1, p.Z);
+		walk.emplace_back(p.X, p.Y - 1, p.Z);
+		walk.emplace_back(p.X, p.Y, p.Z + 1);
+		walk.emplace_back(p.X, p.Y, p.Z - 1);
+	}
+
+	u32 found_sectors, found_index;
+	u64 t = time_lookups(sectors, random, 1, &found_sectors);
+	report("random, sectors", random.size(), t);
+	t = time_lookups(index, random, 1, &found_index);
+	report("random, MapBlockIndex", random.size(), t);
+	if (found_sectors != found_index)
+		rawstream << "    Lookups disagree!" << std::endl;
+
+	const int walk_repeat = 20;
+	t = time_lookups(sectors, walk, walk_repeat, &found_sectors);
+	report("neighbor walk, sectors", walk.size() * walk_repeat, t);
+	t = time_lookups(index, walk, walk_repeat, &found_index);
+	report("neighbor walk, MapBlockIndex", walk.size() * walk_repeat, t);
+	if (found_sectors != found_index)
+		rawstream << "    Lookups disagree!" << std::endl;
+}
@@ -106,7 +106,7 @@ Client::Client(
 	m_nodedef(nodedef),
 	m_sound(sound),
 	m_event(event),
-	m_mesh_update_thread(this),
+	m_mesh_update_manager(this),
 	m_env(
 		new ClientMap(this, control, 666),
 		tsrc, this
@@ -279,7 +279,7 @@ void Client::Stop()
 	if (m_mods_loaded)
 		m_script->on_shutdown();
 	//request all client managed threads to stop
-	m_mesh_update_thread.stop();
+	m_mesh_update_manager.stop();
 	// Save local server map
 	if (m_localdb) {
 		infostream << "Local map saving ended." << std::endl;
@@ -292,7 +292,7 @@ void Client::Stop()
 
 bool Client::isShutdown()
 {
-	return m_shutdown || !m_mesh_update_thread.isRunning();
+	return m_shutdown || !m_mesh_update_manager.isRunning();
 }
 
 Client::~Client()
@@ -302,12 +302,11 @@ Client::~Client()
 
 	deleteAuthData();
 
-	m_mesh_update_thread.stop();
-	m_mesh_update_thread.wait();
-	while (!m_mesh_update_thread.m_queue_out.empty()) {
-		MeshUpdateResult r = m_mesh_update_thread.m_queue_out.pop_frontNoEx();
+	m_mesh_update_manager.stop();
+	m_mesh_update_manager.wait();
+	MeshUpdateResult r;
+	while (m_mesh_update_manager.getNextResult(r))
 		delete r.mesh;
-	}
 
 
 	delete m_inventory_from_server;
@@ -514,21 +513,24 @@ void Client::step(float dtime)
 	{
 		int num_processed_meshes = 0;
 		std::vector<v3s16> blocks_to_ack;
-		while (!m_mesh_update_thread.m_queue_out.empty())
+		MeshUpdateResult r;
+		while (m_mesh_update_manager.getNextResult(r))
 		{
 			num_processed_meshes++;
 
 			MinimapMapblock *minimap_mapblock = NULL;
 			bool do_mapper_update = true;
 
-			MeshUpdateResult r = m_mesh_update_thread.m_queue_out.pop_frontNoEx();
 			MapBlock *block = m_env.getMap().getBlockNoCreateNoEx(r.p);
 			if (block) {
 				// Delete the old mesh
 				delete block->mesh;
 				block->mesh = nullptr;
+				m_env.getClientMap().invalidateMeshBatch(r.p);
 
 				if (r.mesh) {
+					block->face_connectivity = r.mesh->getFaceConnectivity();
+
 					minimap_mapblock = r.mesh->moveMinimapMapblock();
 					if (minimap_mapblock == NULL)
 						do_mapper_update = false;
@@ -1593,7 +1595,18 @@ void Client::addUpdateMeshTask(v3s16 p, bool ack_to_server, bool urgent)
 	if (b == NULL)
 		return;
 
-	m_mesh_update_thread.updateBlock(&m_env.getMap(), p, ack_to_server, urgent);
+	u8 lod = m_env.getClientMap().getMeshLod(p, b->mesh_lod);
+	bool lod_changed = lod != b->mesh_lod;
+	b->mesh_lod = lod;
+	m_mesh_update_manager.updateBlock(&m_env.getMap(), p, ack_to_server, urgent);
+
+	// The faces between two blocks are made by the block with the lower
+	// coordinate, which has to know the new level of detail
+	if (lod_changed) {
+		addUpdateMeshTask(p + v3s16(-1, 0, 0), false, urgent);
+		addUpdateMeshTask(p + v3s16(0, -1, 0), false, urgent);
+		addUpdateMeshTask(p + v3s16(0, 0, -1), false, urgent);
+	}
 }
 
 void Client::addUpdateMeshTaskWithEdge(v3s16 blockpos, bool ack_to_server, bool urgent)
@@ -1764,9 +1777,9 @@ void Client::afterContentReceived()
 	m_nodedef->updateTextures(this, texture_update_progress, &tu_args);
 	delete[] tu_args.text_base;
 
-	// Start mesh update thread after setting up content definitions
-	infostream<<"- Starting mesh update thread"<<std::endl;
-	m_mesh_update_thread.start();
+	// Start mesh update threads after setting up content definitions
+	infostream<<"- Starting mesh update threads"<<std::endl;
+	m_mesh_update_manager.start();
 
 	m_state = LC_Ready;
 	sendReady();
@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/basic_macros.h"
 #include <algorithm>
 #include "client/renderingengine.h"
+#include "util/directiontables.h"
 
 ClientMap::ClientMap(
 		Client *client,
@@ -57,7 +58,15 @@ ClientMap::ClientMap(
 	m_cache_trilinear_filter  = g_settings->getBool("trilinear_filter");
 	m_cache_bilinear_filter   = g_settings->getBool("bilinear_filter");
 	m_cache_anistropic_filter = g_settings->getBool("anisotropic_filter");
+	m_cache_mesh_lod_distance = g_settings->getS16("mesh_lod_distance");
+	m_cache_mesh_batching = g_settings->getBool("enable_mesh_batching");
+}
 
+ClientMap::~ClientMap()
+{
+	video::IVideoDriver *driver = RenderingEngine::get_video_driver();
+	for (auto &batch : m_mesh_batches)
+		clearMeshBatch(driver, batch.second);
 }
 
 MapSector * ClientMap::emergeSector(v2s16 p2d)
@@ -112,6 +121,83 @@ void ClientMap::getBlocksInViewRange(v3s16 cam_pos_nodes,
 			p_nodes_max.Z / MAP_BLOCKSIZE + 1);
 }
 
+u8 ClientMap::getMeshLod(v3s16 blockpos, u8 current_lod) const
+{
+	if (m_cache_mesh_lod_distance <= 0)
+		return 1;
+
+	v3s16 center = blockpos * MAP_BLOCKSIZE +
+			v3s16(1, 1, 1) * (MAP_BLOCKSIZE / 2);
+	f32 d = intToFloat(center, BS).getDistanceFrom(m_camera_position) / BS;
+
+	// Every time the distance doubles the detail halves, down to
+	// cubes of 4x4x4 nodes. Each limit is moved a tenth away from the
+	// current level, so that blocks near it don't switch back and forth.
+	u8 lod = 1;
+	for (f32 limit = m_cache_mesh_lod_distance; lod < 4; limit *= 2) {
+		if (d <= limit * (lod < current_lod ? 0.9f : 1.1f))
+			break;
+		lod *= 2;
+	}
+	return lod;
+}
+
+/*
+	Finds the mapblocks that can be seen from the camera's mapblock, by
+	walking through the faces the mapblocks connect and only ever moving
+	away from the camera. Mapblocks that haven't been meshed yet are
+	see-through.
+
+	entered: for every mapblock of the area, the faces it was entered
+	through. 0 if it can't be seen.
+*/
+void ClientMap::findVisibleBlocks(v3s16 cam_block, const VoxelArea &area,
+		std::vector<u8> &entered)
+{
+	struct Step {
+		v3s16 pos;
+		// Face the block was entered through, 6 for the camera's block
+		u8 entry;
+		// Directions walked from the camera's block
+		u8 dirs;
+	};
+
+	entered.assign(area.getVolume(), 0);
+	if (!area.contains(cam_block))
+		return;
+
+	std::vector<Step> steps;
+	steps.push_back({cam_block, 6, 0});
+	entered[area.index(cam_block)] = 0x3F;
+
+	for (size_t i = 0; i < steps.size(); i++) {
+		Step step = steps[i];
+		MapBlockFaceConnectivity connectivity = FACE_CONNECTIVITY_ALL;
+		MapBlock *block = getBlockNoCreateNoEx(step.pos);
+		if (block && step.entry != 6)
+			connectivity = block->face_connectivity;
+
+		for (u8 d = 0; d < 6; d++) {
+			u8 opposite = (d + 3) % 6;
+			if (step.dirs & (1 << opposite))
+				continue;
+			if (step.entry != 6 &&
+					!faces_connected(connectivity, step.entry, d))
+				continue;
+
+			v3s16 next = step.pos + g_6dirs[d];
+			if (!area.contains(next))
+				continue;
+			u8 &faces = entered[area.index(next)];
+			if (faces & (1 << opposite))
+				continue;
+			faces |= 1 << opposite;
+			steps.push_back({next, opposite, (u8)(step.dirs | (1 << d))});
+		}
+	}
+	g_profiler->avg("CM::findVisibleBlocks(): steps [#]", steps.size());
+}
+
 void ClientMap::updateDrawList()
 {
 	ScopeProfiler sp(g_profiler, "CM::updateDrawList()", SPT_AVG);
@@ -153,6 +239,13 @@ void ClientMap::updateDrawList()
 	//if (occlusion_culling_enabled && m_control.show_wireframe)
 	//    occlusion_culling_enabled = porting::getTimeS() & 1;
 
+	// Mapblocks that can be seen through the others
+	VoxelArea blocks_area(p_blocks_min, p_blocks_max);
+	std::vector<u8> blocks_entered;
+	if (occlusion_culling_enabled)
+		findVisibleBlocks(getNodeBlockPos(cam_pos_nodes), blocks_area,
+				blocks_entered);
+
 	for (const auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 		v2s16 sp = sector->getPos();
@@ -200,8 +293,12 @@ void ClientMap::updateDrawList()
 			/*
 				Occlusion culling
 			*/
+			v3s16 pos = block->getPos();
+			bool occluded = occlusion_culling_enabled &&
+					blocks_area.contains(pos) &&
+					blocks_entered[blocks_area.index(pos)] == 0;
 			if ((!m_control.range_all && d > m_control.wanted_range * BS) ||
-					(occlusion_culling_enabled && isBlockOccluded(block, cam_pos_nodes))) {
+					occluded) {
 				blocks_occlusion_culled++;
 				continue;
 			}
@@ -209,6 +306,10 @@ void ClientMap::updateDrawList()
 			// This block is in range. Reset usage timer.
 			block->resetUsageTimer();
 
+			// Remake the mesh if the camera moved to another level of detail
+			if (block->mesh_lod != getMeshLod(block->getPos(), block->mesh_lod))
+				m_client->addUpdateMeshTask(block->getPos());
+
 			// Add to set
 			block->refGrab();
 			m_drawlist[block->getPos()] = block;
@@ -270,6 +371,91 @@ struct MeshBufListList
 	}
 };
 
+// Side length of a region of batched mapblocks, in mapblocks
+static const s16 MESH_BATCH_REGION_SIZE = 4;
+
+void ClientMap::invalidateMeshBatch(v3s16 blockpos)
+{
+	auto it = m_mesh_batches.find(
+			getContainerPos(blockpos, MESH_BATCH_REGION_SIZE));
+	if (it != m_mesh_batches.end())
+		it->second.dirty = true;
+}
+
+void ClientMap::clearMeshBatch(video::IVideoDriver *driver,
+		MapBlockMeshBatch &batch)
+{
+	for (auto &buffer : batch.buffers) {
+		driver->removeHardwareBuffer(buffer.second);
+		buffer.second->drop();
+	}
+	batch.buffers.clear();
+	batch.blocks.clear();
+}
+
+void ClientMap::updateMeshBatch(video::IVideoDriver *driver,
+		MapBlockMeshBatch &batch, const std::vector<MapBlock *> &blocks)
+{
+	std::vector<v3s16> positions;
+	positions.reserve(blocks.size());
+	for (MapBlock *block : blocks)
+		positions.push_back(block->getPos());
+
+	if (!batch.dirty && batch.camera_offset == m_camera_offset &&
+			batch.blocks == positions)
+		return;
+
+	ScopeProfiler sp(g_profiler, "CM::updateMeshBatch()", SPT_AVG);
+	clearMeshBatch(driver, batch);
+	batch.blocks = std::move(positions);
+	batch.camera_offset = m_camera_offset;
+	batch.dirty = false;
+
+	bool enable_vbo = g_settings->getBool("enable_vbo");
+	for (MapBlock *block : blocks) {
+		// The draw list might not have been updated since the camera moved
+		block->mesh->updateCameraOffset(m_camera_offset);
+		for (int layer = 0; layer < MAX_TILE_LAYERS; layer++) {
+			scene::IMesh *mesh = block->mesh->getMesh(layer);
+			u32 c = mesh->getMeshBufferCount();
+			for (u32 i = 0; i < c; i++) {
+				scene::IMeshBuffer *buf = mesh->getMeshBuffer(i);
+				const video::SMaterial &material = buf->getMaterial();
+				video::IMaterialRenderer *rnd =
+					driver->getMaterialRenderer(material.MaterialType);
+				// Transparent buffers are drawn per block, they
+				// aren't drawn in the solid pass
+				if ((rnd && rnd->isTransparent()) ||
+						buf->getVertexType() != video::EVT_STANDARD ||
+						buf->getIndexType() != video::EIT_16BIT)
+					continue;
+
+				u32 vertex_count = buf->getVertexCount();
+				scene::SMeshBuffer *dest = nullptr;
+				for (auto &buffer : batch.buffers) {
+					if (buffer.first == layer &&
+							buffer.second->getMaterial() == material &&
+							buffer.second->getVertexCount() + vertex_count
+								<= U16_MAX) {
+						dest = buffer.second;
+						break;
+					}
+				}
+				if (!dest) {
+					dest = new scene::SMeshBuffer();
+					dest->Material = material;
+					if (enable_vbo)
+						dest->setHardwareMappingHint(scene::EHM_STATIC);
+					batch.buffers.emplace_back(layer, dest);
+				}
+				dest->append(buf->getVertices(), vertex_count,
+						buf->getIndices(), buf->getIndexCount());
+			}
+		}
+	}
+	g_profiler->avg("CM::updateMeshBatch(): buffers [#]", batch.buffers.size());
+}
+
 void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 {
 	bool is_transparent_pass = pass == scene::ESNRP_TRANSPARENT;
@@ -302,6 +488,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	*/
 
 	u32 vertex_count = 0;
+	u32 draw_calls = 0;
 
 	// For limiting number of mesh animations per frame
 	u32 mesh_animate_count = 0;
@@ -313,6 +500,13 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	MeshBufListList drawbufs;
 
+	// Static meshes of the solid pass are drawn by region, see
+	// enable_mesh_batching. The regions are made of the blocks of the
+	// draw list so they don't change when the camera turns.
+	bool batching = m_cache_mesh_batching && pass == scene::ESNRP_SOLID;
+	std::map<v3s16, std::vector<MapBlock *>> batch_blocks;
+	std::set<v3s16> batch_regions_in_sight;
+
 	for (auto &i : m_drawlist) {
 		MapBlock *block = i.second;
 
@@ -321,8 +515,19 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 			continue;
 
 		float d = 0.0;
-		if (!isBlockInSight(block->getPos(), camera_position,
-				camera_direction, camera_fov, 100000 * BS, &d))
+		bool in_sight = isBlockInSight(block->getPos(), camera_position,
+				camera_direction, camera_fov, 100000 * BS, &d);
+
+		if (batching && !block->mesh->hasAnimation()) {
+			v3s16 region = getContainerPos(block->getPos(),
+					MESH_BATCH_REGION_SIZE);
+			batch_blocks[region].push_back(block);
+			if (in_sight)
+				batch_regions_in_sight.insert(region);
+			continue;
+		}
+
+		if (!in_sight)
 			continue;
 
 		// Mesh animation
@@ -386,6 +591,41 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		}
 	}
 
+	if (batching) {
+		for (const auto &region : batch_blocks) {
+			MapBlockMeshBatch &batch = m_mesh_batches[region.first];
+			updateMeshBatch(driver, batch, region.second);
+			batch.used = true;
+			if (batch_regions_in_sight.count(region.first) == 0)
+				continue;
+
+			for (auto &buffer : batch.buffers) {
+				video::SMaterial &material = buffer.second->getMaterial();
+				material.setFlag(video::EMF_TRILINEAR_FILTER,
+					m_cache_trilinear_filter);
+				material.setFlag(video::EMF_BILINEAR_FILTER,
+					m_cache_bilinear_filter);
+				material.setFlag(video::EMF_ANISOTROPIC_FILTER,
+					m_cache_anistropic_filter);
+				material.setFlag(video::EMF_WIREFRAME,
+					m_control.show_wireframe);
+				drawbufs.add(buffer.second, buffer.first);
+			}
+		}
+	}
+	if (pass == scene::ESNRP_SOLID) {
+		// Forget the regions that are out of range
+		for (auto it = m_mesh_batches.begin(); it != m_mesh_batches.end(); ) {
+			if (it->second.used) {
+				it->second.used = false;
+				++it;
+			} else {
+				clearMeshBatch(driver, it->second);
+				it = m_mesh_batches.erase(it);
+			}
+		}
+	}
+
 	TimeTaker draw("Drawing mesh buffers");
 
 	// Render all layers in order
@@ -402,10 +642,12 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 			for (scene::IMeshBuffer *buf : list.bufs) {
 				driver->drawMeshBuffer(buf);
 				vertex_count += buf->getVertexCount();
+				draw_calls++;
 			}
 		}
 	}
 	g_profiler->avg(prefix + "draw meshes [ms]", draw.stop(true));
+	g_profiler->avg(prefix + "draw calls [#]", draw_calls);
 
 	// Log only on solid pass because values are the same
 	if (pass == scene::ESNRP_SOLID) {
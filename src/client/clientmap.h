@@ -38,6 +38,25 @@ struct MapDrawControl
 class Client;
 class ITextureSource;
 
+/*
+	Mesh buffers of the static meshes of a region of mapblocks, merged
+	by material, see enable_mesh_batching
+*/
+struct MapBlockMeshBatch
+{
+	// Positions of the mapblocks the buffers were made from
+	std::vector<v3s16> blocks;
+	// Camera offset the meshes had
+	v3s16 camera_offset;
+	// A mesh of the region was replaced
+	bool dirty = false;
+	// Drawn in the current frame
+	bool used = false;
+
+	// The merged buffers with their layers
+	std::vector<std::pair<u8, scene::SMeshBuffer *>> buffers;
+};
+
 /*
 	ClientMap
 
@@ -53,7 +72,7 @@ class ClientMap : public Map, public scene::ISceneNode
 			s32 id
 	);
 
-	virtual ~ClientMap() = default;
+	virtual ~ClientMap();
 
 	s32 mapType() const
 	{
@@ -111,9 +130,22 @@ class ClientMap : public Map, public scene::ISceneNode
 	// For debug printing
 	virtual void PrintInfo(std::ostream &out);
 
+	// Must be called when the mesh of the block changes
+	void invalidateMeshBatch(v3s16 blockpos);
+
+	// Level of detail the mesh of the block should have, 1 is full
+	// detail. See mesh_lod_distance.
+	u8 getMeshLod(v3s16 blockpos, u8 current_lod) const;
+
 	const MapDrawControl & getControl() const { return m_control; }
 	f32 getCameraFov() const { return m_camera_fov; }
 private:
+	void findVisibleBlocks(v3s16 cam_block, const VoxelArea &area,
+			std::vector<u8> &entered);
+	void updateMeshBatch(video::IVideoDriver *driver, MapBlockMeshBatch &batch,
+			const std::vector<MapBlock *> &blocks);
+	void clearMeshBatch(video::IVideoDriver *driver, MapBlockMeshBatch &batch);
+
 	Client *m_client;
 
 	aabb3f m_box = aabb3f(-BS * 1000000, -BS * 1000000, -BS * 1000000,
@@ -130,7 +162,12 @@ class ClientMap : public Map, public scene::ISceneNode
 
 	std::set<v2s16> m_last_drawn_sectors;
 
+	// Indexed by region position
+	std::map<v3s16, MapBlockMeshBatch> m_mesh_batches;
+
 	bool m_cache_trilinear_filter;
 	bool m_cache_bilinear_filter;
 	bool m_cache_anistropic_filter;
+	s16 m_cache_mesh_lod_distance;
+	bool m_cache_mesh_batching;
 };
@@ -38,7 +38,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 MeshMakeData::MeshMakeData(Client *client, bool use_shaders):
 	m_client(client),
 	m_use_shaders(use_shaders)
-{}
+{
+	memset(m_lods, 1, sizeof(m_lods));
+}
 
 void MeshMakeData::fillBlockDataBegin(const v3s16 &blockpos)
 {
@@ -90,6 +92,101 @@ void MeshMakeData::setSmoothLighting(bool smooth_lighting)
 	m_smooth_lighting = smooth_lighting;
 }
 
+void MeshMakeData::setLods(const u8 *lods)
+{
+	memcpy(m_lods, lods, sizeof(m_lods));
+}
+
+// The cube is replaced by its most common face making node, or by air
+// with the brightest light of the cube. A cube becomes solid if any of its
+// nodes is, so that no holes open towards blocks with more detail.
+static void downsample_cube(VoxelManipulator &vmanip,
+		const NodeDefManager *ndef, v3s16 cube, u8 lod)
+{
+	const VoxelArea &area = vmanip.m_area;
+	MapNode *vdata = vmanip.m_data;
+
+	std::pair<content_t, u16> counts[4 * 4 * 4];
+	u16 num_counts = 0;
+	MapNode solid;
+	u16 solid_count = 0;
+	u8 day_light = 0;
+	u8 night_light = 0;
+
+	v3s16 p;
+	for (p.Z = cube.Z; p.Z < cube.Z + lod; p.Z++)
+	for (p.Y = cube.Y; p.Y < cube.Y + lod; p.Y++)
+	for (p.X = cube.X; p.X < cube.X + lod; p.X++) {
+		const MapNode &n = vdata[area.index(p)];
+		content_t c = n.getContent();
+		// Missing data doesn't make faces, keep it like that
+		if (c == CONTENT_IGNORE)
+			return;
+		const ContentFeatures &f = ndef->get(c);
+		if (f.solidness == 0) {
+			day_light = MYMAX(day_light, n.getLightRaw(LIGHTBANK_DAY, f));
+			night_light = MYMAX(night_light, n.getLightRaw(LIGHTBANK_NIGHT, f));
+			continue;
+		}
+		// Pick the most common of the face making nodes
+		u16 i = 0;
+		while (i < num_counts && counts[i].first != c)
+			i++;
+		if (i == num_counts)
+			counts[num_counts++] = std::make_pair(c, 0);
+		if (++counts[i].second > solid_count) {
+			solid_count = counts[i].second;
+			solid = n;
+		}
+	}
+
+	MapNode n(CONTENT_AIR);
+	if (solid_count != 0)
+		n = solid;
+	else
+		n.param1 = day_light | (night_light << 4);
+
+	for (p.Z = cube.Z; p.Z < cube.Z + lod; p.Z++)
+	for (p.Y = cube.Y; p.Y < cube.Y + lod; p.Y++)
+	for (p.X = cube.X; p.X < cube.X + lod; p.X++)
+		vdata[area.index(p)] = n;
+}
+
+void MeshMakeData::downsample()
+{
+	const NodeDefManager *ndef = m_client->ndef();
+	v3s16 blockpos_nodes = m_blockpos * MAP_BLOCKSIZE;
+
+	// Every node is downsampled with the level of detail of the block it
+	// is in, so that both sides of a face between two blocks look like
+	// the blocks themselves, whichever of them makes the face.
+	// The cubes are aligned to the world grid and never cross a block.
+	v3s16 dp;
+	for (dp.Z = -1; dp.Z <= 1; dp.Z++)
+	for (dp.Y = -1; dp.Y <= 1; dp.Y++)
+	for (dp.X = -1; dp.X <= 1; dp.X++) {
+		u8 lod = m_lods[(dp.Z + 1) * 9 + (dp.Y + 1) * 3 + (dp.X + 1)];
+		if (lod <= 1)
+			continue;
+
+		// The part of the neighbor next to the block, as whole cubes
+		v3s16 min_edge = blockpos_nodes + dp * MAP_BLOCKSIZE;
+		v3s16 max_edge = min_edge + (MAP_BLOCKSIZE - 1);
+		if (dp.X < 0) min_edge.X = max_edge.X - lod + 1;
+		if (dp.Y < 0) min_edge.Y = max_edge.Y - lod + 1;
+		if (dp.Z < 0) min_edge.Z = max_edge.Z - lod + 1;
+		if (dp.X > 0) max_edge.X = min_edge.X + lod - 1;
+		if (dp.Y > 0) max_edge.Y = min_edge.Y + lod - 1;
+		if (dp.Z > 0) max_edge.Z = min_edge.Z + lod - 1;
+
+		v3s16 cube;
+		for (cube.Z = min_edge.Z; cube.Z <= max_edge.Z; cube.Z += lod)
+		for (cube.Y = min_edge.Y; cube.Y <= max_edge.Y; cube.Y += lod)
+		for (cube.X = min_edge.X; cube.X <= max_edge.X; cube.X += lod)
+			downsample_cube(m_vmanip, ndef, cube, lod);
+	}
+}
+
 /*
 	Light and vertex color functions
 */
@@ -582,10 +679,9 @@ static void makeFastFace(const TileSpec &tile, u16 li0, u16 li1, u16 li2, u16 li
 		vpos += pos;
 	}
 
-	f32 abs_scale = 1.0f;
-	if      (scale.X < 0.999f || scale.X > 1.001f) abs_scale = scale.X;
-	else if (scale.Y < 0.999f || scale.Y > 1.001f) abs_scale = scale.Y;
-	else if (scale.Z < 0.999f || scale.Z > 1.001f) abs_scale = scale.Z;
+	// Texture repetitions along the u and v axes of the face
+	f32 abs_scale = dir.X != 0 ? scale.Z : scale.X;
+	f32 abs_scale_v = dir.Y != 0 ? scale.Z : scale.Y;
 
 	v3f normal(dir.X, dir.Y, dir.Z);
 
@@ -602,8 +698,8 @@ static void makeFastFace(const TileSpec &tile, u16 li0, u16 li1, u16 li2, u16 li
 			< abs(day[1] - day[3]) + abs(night[1] - night[3]);
 
 	v2f32 f[4] = {
-		core::vector2d<f32>(x0 + w * abs_scale, y0 + h),
-		core::vector2d<f32>(x0, y0 + h),
+		core::vector2d<f32>(x0 + w * abs_scale, y0 + h * abs_scale_v),
+		core::vector2d<f32>(x0, y0 + h * abs_scale_v),
 		core::vector2d<f32>(x0, y0),
 		core::vector2d<f32>(x0 + w * abs_scale, y0) };
 
@@ -843,6 +939,27 @@ static void getTileInfo(
 	}
 }
 
+/*
+	A row of faces merged along the row, see updateFastFaceRow().
+	Becomes a FastFace once it can't be merged with the next row.
+*/
+struct FastFaceRun
+{
+	TileSpec tile;
+	u16 lights[4];
+	//! Position and direction of the last face of the last row
+	v3s16 p_corrected;
+	v3s16 face_dir_corrected;
+	//! Index of the last face in the row
+	u16 end;
+	//! Number of faces along the row
+	u16 length;
+	//! Number of merged rows
+	u16 width = 1;
+	//! Whether the next row may be merged into this one
+	bool mergeable;
+};
+
 /*
 	startpos:
 	translate_dir: unit vector with only one of x, y or z
@@ -852,9 +969,8 @@ static void updateFastFaceRow(
 		MeshMakeData *data,
 		const v3s16 &&startpos,
 		v3s16 translate_dir,
-		const v3f &&translate_dir_f,
 		const v3s16 &&face_dir,
-		std::vector<FastFace> &dest)
+		std::vector<FastFaceRun> &dest)
 {
 	static thread_local const bool waving_liquids =
 		g_settings->getBool("enable_shaders") &&
@@ -887,6 +1003,9 @@ static void updateFastFaceRow(
 		v3s16 next_face_dir_corrected;
 		u16 next_lights[4] = {0, 0, 0, 0};
 
+		// Don't apply fast faces to waving water.
+		bool tileable = waving != 3 || !waving_liquids;
+
 		// If at last position, there is nothing to compare to and
 		// the face must be drawn anyway
 		if (j != MAP_BLOCKSIZE - 1) {
@@ -902,8 +1021,7 @@ static void updateFastFaceRow(
 					&& next_p_corrected == p_corrected + translate_dir
 					&& next_face_dir_corrected == face_dir_corrected
 					&& memcmp(next_lights, lights, sizeof(lights)) == 0
-					// Don't apply fast faces to waving water.
-					&& (waving != 3 || !waving_liquids)
+					&& tileable
 					&& next_tile.isTileable(tile)) {
 				next_is_different = false;
 				continuous_tiles_count++;
@@ -911,26 +1029,20 @@ static void updateFastFaceRow(
 		}
 		if (next_is_different) {
 			/*
-				Create a face if there should be one
+				Queue a face if there should be one
 			*/
 			if (makes_face) {
-				// Floating point conversion of the position vector
-				v3f pf(p_corrected.X, p_corrected.Y, p_corrected.Z);
-				// Center point of face (kind of)
-				v3f sp = pf - ((f32)continuous_tiles_count * 0.5f - 0.5f)
-					* translate_dir_f;
-				v3f scale(1, 1, 1);
-
-				if (translate_dir.X != 0)
-					scale.X = continuous_tiles_count;
-				if (translate_dir.Y != 0)
-					scale.Y = continuous_tiles_count;
-				if (translate_dir.Z != 0)
-					scale.Z = continuous_tiles_count;
-
-				makeFastFace(tile, lights[0], lights[1], lights[2], lights[3],
-						pf, sp, face_dir_corrected, scale, dest);
-				g_profiler->avg("Meshgen: Tiles per face [#]", continuous_tiles_count);
+				dest.emplace_back();
+				FastFaceRun &run = dest.back();
+				run.tile = std::move(tile);
+				memcpy(run.lights, lights, sizeof(lights));
+				run.p_corrected = p_corrected;
+				run.face_dir_corrected = face_dir_corrected;
+				run.end = j;
+				run.length = continuous_tiles_count;
+				// World aligned textures are only offset for the row
+				run.mergeable = tileable && !run.tile.world_aligned
+						&& run.tile.isTileable(run.tile);
 			}
 
 			continuous_tiles_count = 1;
@@ -945,42 +1057,123 @@ static void updateFastFaceRow(
 	}
 }
 
+static void makeRunFace(const FastFaceRun &run, const v3s16 &translate_dir,
+		const v3s16 &merge_dir, std::vector<FastFace> &dest)
+{
+	// Floating point conversion of the position vector
+	v3f pf(run.p_corrected.X, run.p_corrected.Y, run.p_corrected.Z);
+	v3f translate_dir_f(translate_dir.X, translate_dir.Y, translate_dir.Z);
+	v3f merge_dir_f(merge_dir.X, merge_dir.Y, merge_dir.Z);
+	// Center point of face (kind of)
+	v3f sp = pf - ((f32)run.length * 0.5f - 0.5f) * translate_dir_f
+			- ((f32)run.width * 0.5f - 0.5f) * merge_dir_f;
+	v3f scale = v3f(1, 1, 1) + translate_dir_f * (run.length - 1)
+			+ merge_dir_f * (run.width - 1);
+
+	makeFastFace(run.tile, run.lights[0], run.lights[1], run.lights[2],
+			run.lights[3], pf, sp, run.face_dir_corrected, scale, dest);
+	g_profiler->avg("Meshgen: Tiles per face [#]", run.length * run.width);
+}
+
+/*
+	Makes the faces of a layer of rows, merging every row with the next one
+	where they have the same start, length, tile and lighting.
+
+	startpos: start of the first row
+	merge_dir: unit vector from a row to the next one
+*/
+static void updateFastFaceLayer(
+		MeshMakeData *data,
+		const v3s16 &startpos,
+		const v3s16 &translate_dir,
+		const v3s16 &merge_dir,
+		const v3s16 &face_dir,
+		std::vector<FastFace> &dest)
+{
+	// Runs of the previous row that can still grow
+	std::vector<FastFaceRun> open;
+	std::vector<FastFaceRun> row;
+	std::vector<FastFaceRun> next_open;
+
+	for (s16 i = 0; i < MAP_BLOCKSIZE; i++) {
+		row.clear();
+		updateFastFaceRow(data, startpos + merge_dir * i, translate_dir,
+				v3s16(face_dir), row);
+
+		// Both rows are ordered along translate_dir
+		next_open.clear();
+		size_t k = 0;
+		for (FastFaceRun &run : row) {
+			bool merged = false;
+			for (; k < open.size(); k++) {
+				FastFaceRun &prev = open[k];
+				// Runs of the previous row ending before this one
+				if (prev.end < run.end) {
+					makeRunFace(prev, translate_dir, merge_dir, dest);
+					continue;
+				}
+				if (prev.end == run.end && prev.mergeable
+						&& run.mergeable && prev.length == run.length
+						&& prev.face_dir_corrected == run.face_dir_corrected
+						&& memcmp(prev.lights, run.lights,
+							sizeof(run.lights)) == 0
+						&& prev.tile.isTileable(run.tile)) {
+					prev.p_corrected = run.p_corrected;
+					prev.width++;
+					next_open.push_back(std::move(prev));
+					k++;
+					merged = true;
+				}
+				break;
+			}
+			if (!merged)
+				next_open.push_back(std::move(run));
+		}
+		for (; k < open.size(); k++)
+			makeRunFace(open[k], translate_dir, merge_dir, dest);
+		open.swap(next_open);
+	}
+
+	for (const FastFaceRun &run : open)
+		makeRunFace(run, translate_dir, merge_dir, dest);
+}
+
 static void updateAllFastFaceRows(MeshMakeData *data,
 		std::vector<FastFace> &dest)
 {
 	/*
-		Go through every y,z and get top(y+) faces in rows of x+
+		Go through every y and get top(y+) faces in rows of x+,
+		merging the rows along z+
 	*/
 	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
-	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
-		updateFastFaceRow(data,
-				v3s16(0, y, z),
+		updateFastFaceLayer(data,
+				v3s16(0, y, 0),
 				v3s16(1, 0, 0), //dir
-				v3f  (1, 0, 0),
+				v3s16(0, 0, 1), //merge dir
 				v3s16(0, 1, 0), //face dir
 				dest);
 
 	/*
-		Go through every x,y and get right(x+) faces in rows of z+
+		Go through every x and get right(x+) faces in rows of z+,
+		merging the rows along y+
 	*/
 	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
-	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
-		updateFastFaceRow(data,
-				v3s16(x, y, 0),
+		updateFastFaceLayer(data,
+				v3s16(x, 0, 0),
 				v3s16(0, 0, 1), //dir
-				v3f  (0, 0, 1),
+				v3s16(0, 1, 0), //merge dir
 				v3s16(1, 0, 0), //face dir
 				dest);
 
 	/*
-		Go through every y,z and get back(z+) faces in rows of x+
+		Go through every z and get back(z+) faces in rows of x+,
+		merging the rows along y+
 	*/
 	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
-	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
-		updateFastFaceRow(data,
-				v3s16(0, y, z),
+		updateFastFaceLayer(data,
+				v3s16(0, 0, z),
 				v3s16(1, 0, 0), //dir
-				v3f  (1, 0, 0),
+				v3s16(0, 1, 0), //merge dir
 				v3s16(0, 0, 1), //face dir
 				dest);
 }
@@ -999,6 +1192,71 @@ static void applyTileColor(PreMeshBuffer &pmb)
 	}
 }
 
+/*
+	Flood fills the block through all but solid cube nodes and connects
+	the faces each filled area touches.
+*/
+static MapBlockFaceConnectivity getFaceConnectivity(MeshMakeData *data)
+{
+	const NodeDefManager *ndef = data->m_client->ndef();
+	VoxelManipulator &vmanip = data->m_vmanip;
+	v3s16 blockpos_nodes = data->m_blockpos * MAP_BLOCKSIZE;
+	const u16 volume = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+
+	// Solid cube nodes count as visited. Other nodes can be seen through
+	// or past even when they don't let light through, like slabs or glass.
+	std::vector<bool> visited(volume);
+	v3s16 p;
+	u16 i = 0;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++, i++) {
+		const MapNode &n = vmanip.getNodeRefUnsafe(blockpos_nodes + p);
+		visited[i] = ndef->get(n).solidness == 2;
+	}
+
+	MapBlockFaceConnectivity connectivity = 0;
+	std::vector<v3s16> stack;
+	i = 0;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++, i++) {
+		if (visited[i])
+			continue;
+		visited[i] = true;
+		stack.push_back(p);
+
+		// Faces touched by this area, indexed like g_6dirs
+		u8 faces = 0;
+		while (!stack.empty()) {
+			v3s16 q = stack.back();
+			stack.pop_back();
+			faces |= (q.Z == MAP_BLOCKSIZE - 1) << 0 |
+					(q.Y == MAP_BLOCKSIZE - 1) << 1 |
+					(q.X == MAP_BLOCKSIZE - 1) << 2 |
+					(q.Z == 0) << 3 | (q.Y == 0) << 4 | (q.X == 0) << 5;
+			for (const v3s16 &dir : g_6dirs) {
+				v3s16 r = q + dir;
+				if (r.X < 0 || r.Y < 0 || r.Z < 0 || r.X >= MAP_BLOCKSIZE ||
+						r.Y >= MAP_BLOCKSIZE || r.Z >= MAP_BLOCKSIZE)
+					continue;
+				u16 j = (r.Z * MAP_BLOCKSIZE + r.Y) * MAP_BLOCKSIZE + r.X;
+				if (visited[j])
+					continue;
+				visited[j] = true;
+				stack.push_back(r);
+			}
+		}
+
+		for (u8 a = 0; a < 6; a++)
+		for (u8 b = 0; b < 6; b++) {
+			if ((faces & (1 << a)) && (faces & (1 << b)))
+				connectivity |= (MapBlockFaceConnectivity)1 << (a * 6 + b);
+		}
+	}
+	return connectivity;
+}
+
 /*
 	MapBlockMesh
 */
@@ -1022,6 +1280,11 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 			&data->m_vmanip, data->m_blockpos * MAP_BLOCKSIZE);
 	}
 
+	m_face_connectivity = getFaceConnectivity(data);
+
+	// Only after the minimap and occlusion data, which keep full detail
+	data->downsample();
+
 	// 4-21ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
 	// 24-155ms for MAP_BLOCKSIZE=32  (NOTE: probably outdated)
 	//TimeTaker timer1("MapBlockMesh()");
@@ -42,6 +42,9 @@ struct MeshMakeData
 	v3s16 m_blockpos = v3s16(-1337,-1337,-1337);
 	v3s16 m_crack_pos_relative = v3s16(-1337,-1337,-1337);
 	bool m_smooth_lighting = false;
+	// Level of detail of the block and its neighbors, indexed by
+	// (z + 1) * 9 + (y + 1) * 3 + (x + 1) of the neighbor offset
+	u8 m_lods[3 * 3 * 3];
 
 	Client *m_client;
 	bool m_use_shaders;
@@ -69,8 +72,35 @@ struct MeshMakeData
 		Enable or disable smooth lighting
 	*/
 	void setSmoothLighting(bool smooth_lighting);
+
+	/*
+		Set the levels of detail the block and its neighbors are meshed
+		with, the mesh will be made of cubes of lod*lod*lod nodes
+	*/
+	void setLods(const u8 *lods);
+
+	/*
+		Replace every cube of lod*lod*lod nodes by a single node type, in
+		the block and in the one node thick shell of neighbor nodes around it
+	*/
+	void downsample();
 };
 
+/*
+	Which faces of a mapblock can see each other through the nodes of
+	the mapblock. The faces are indexed like g_6dirs, bit a * 6 + b is set
+	if faces a and b are connected.
+*/
+typedef u64 MapBlockFaceConnectivity;
+
+static const MapBlockFaceConnectivity FACE_CONNECTIVITY_ALL =
+		((MapBlockFaceConnectivity)1 << 36) - 1;
+
+inline bool faces_connected(MapBlockFaceConnectivity connectivity, u8 a, u8 b)
+{
+	return (connectivity >> (a * 6 + b)) & 1;
+}
+
 /*
 	Holds a mesh for a mapblock.
 
@@ -114,6 +144,17 @@ class MapBlockMesh
 		return p;
 	}
 
+	MapBlockFaceConnectivity getFaceConnectivity() const
+	{
+		return m_face_connectivity;
+	}
+
+	// Whether animate() may change the mesh
+	bool hasAnimation() const
+	{
+		return m_has_animation;
+	}
+
 	bool isAnimationForced() const
 	{
 		return m_animation_force_timer == 0;
@@ -163,6 +204,9 @@ class MapBlockMesh
 
 	// Camera offset info -> do we have to translate the mesh?
 	v3s16 m_camera_offset;
+
+	// For occlusion culling, see ClientMap::updateDrawList()
+	MapBlockFaceConnectivity m_face_connectivity;
 };
 
 /*!
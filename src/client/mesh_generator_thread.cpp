@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mesh_generator_thread.h"
 #include "settings.h"
+#include "log.h"
 #include "profiler.h"
 #include "client.h"
 #include "mapblock.h"
@@ -81,6 +82,7 @@ void MeshUpdateQueue::addBlock(Map *map, v3s16 p, bool ack_block_to_server, bool
 	*/
 	std::vector<CachedMapBlockData*> cached_blocks;
 	size_t cache_hit_counter = 0;
+	u8 lods[3 * 3 * 3];
 	cached_blocks.reserve(3*3*3);
 	v3s16 dp;
 	for (dp.X = -1; dp.X <= 1; dp.X++)
@@ -94,6 +96,10 @@ void MeshUpdateQueue::addBlock(Map *map, v3s16 p, bool ack_block_to_server, bool
 			cached_block = cacheBlock(map, p1, SKIP_UPDATE_IF_ALREADY_CACHED,
 					&cache_hit_counter);
 		cached_blocks.push_back(cached_block);
+
+		MapBlock *b = map->getBlockNoCreateNoEx(p1);
+		lods[(dp.Z + 1) * 9 + (dp.Y + 1) * 3 + (dp.X + 1)] =
+				b ? b->mesh_lod : 1;
 	}
 	g_profiler->avg("MeshUpdateQueue: MapBlocks from cache [%]",
 			100.0f * cache_hit_counter / cached_blocks.size());
@@ -114,6 +120,7 @@ void MeshUpdateQueue::addBlock(Map *map, v3s16 p, bool ack_block_to_server, bool
 			//       refcount_from_queue stays the same.
 			if(ack_block_to_server)
 				q->ack_block_to_server = true;
+			memcpy(q->lods, lods, sizeof(lods));
 			q->crack_level = m_client->getCrackLevel();
 			q->crack_pos = m_client->getCrackPos();
 			return;
@@ -126,6 +133,7 @@ void MeshUpdateQueue::addBlock(Map *map, v3s16 p, bool ack_block_to_server, bool
 	QueuedMeshUpdate *q = new QueuedMeshUpdate;
 	q->p = p;
 	q->ack_block_to_server = ack_block_to_server;
+	memcpy(q->lods, lods, sizeof(lods));
 	q->crack_level = m_client->getCrackLevel();
 	q->crack_pos = m_client->getCrackPos();
 	m_queue.push_back(q);
@@ -142,20 +150,32 @@ QueuedMeshUpdate *MeshUpdateQueue::pop()
 {
 	MutexAutoLock lock(m_mutex);
 
-	bool must_be_urgent = !m_urgents.empty();
-	for (std::vector<QueuedMeshUpdate*>::iterator i = m_queue.begin();
-			i != m_queue.end(); ++i) {
-		QueuedMeshUpdate *q = *i;
-		if(must_be_urgent && m_urgents.count(q->p) == 0)
-			continue;
-		m_queue.erase(i);
-		m_urgents.erase(q->p);
-		fillDataFromMapBlockCache(q);
-		return q;
+	// Urgent blocks first, unless all of them are being meshed already
+	for (int pass = m_urgents.empty() ? 1 : 0; pass < 2; pass++) {
+		for (std::vector<QueuedMeshUpdate*>::iterator i = m_queue.begin();
+				i != m_queue.end(); ++i) {
+			QueuedMeshUpdate *q = *i;
+			if (pass == 0 && m_urgents.count(q->p) == 0)
+				continue;
+			// Another thread is meshing this block
+			if (m_inflight_blocks.count(q->p) != 0)
+				continue;
+			m_queue.erase(i);
+			m_urgents.erase(q->p);
+			m_inflight_blocks.insert(q->p);
+			fillDataFromMapBlockCache(q);
+			return q;
+		}
 	}
 	return NULL;
 }
 
+void MeshUpdateQueue::done(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	m_inflight_blocks.erase(pos);
+}
+
 CachedMapBlockData* MeshUpdateQueue::cacheBlock(Map *map, v3s16 p, UpdateMode mode,
 			size_t *cache_hit_counter)
 {
@@ -228,6 +248,7 @@ void MeshUpdateQueue::fillDataFromMapBlockCache(QueuedMeshUpdate *q)
 
 	data->setCrack(q->crack_level, q->crack_pos);
 	data->setSmoothLighting(m_cache_smooth_lighting);
+	data->setLods(q->lods);
 }
 
 void MeshUpdateQueue::cleanupCache()
@@ -260,42 +281,111 @@ void MeshUpdateQueue::cleanupCache()
 }
 
 /*
-	MeshUpdateThread
+	MeshUpdateWorkerThread
 */
 
-MeshUpdateThread::MeshUpdateThread(Client *client):
+MeshUpdateWorkerThread::MeshUpdateWorkerThread(MeshUpdateQueue *queue_in,
+		MeshUpdateManager *manager, v3s16 *camera_offset):
 	UpdateThread("Mesh"),
-	m_queue_in(client)
+	m_queue_in(queue_in),
+	m_manager(manager),
+	m_camera_offset(camera_offset)
 {
 	m_generation_interval = g_settings->getU16("mesh_generation_interval");
 	m_generation_interval = rangelim(m_generation_interval, 0, 50);
 }
 
-void MeshUpdateThread::updateBlock(Map *map, v3s16 p, bool ack_block_to_server,
-		bool urgent)
-{
-	// Allow the MeshUpdateQueue to do whatever it wants
-	m_queue_in.addBlock(map, p, ack_block_to_server, urgent);
-	deferUpdate();
-}
-
-void MeshUpdateThread::doUpdate()
+void MeshUpdateWorkerThread::doUpdate()
 {
 	QueuedMeshUpdate *q;
-	while ((q = m_queue_in.pop())) {
+	while ((q = m_queue_in->pop())) {
 		if (m_generation_interval)
 			sleep_ms(m_generation_interval);
 		ScopeProfiler sp(g_profiler, "Client: Mesh making (sum)");
 
-		MapBlockMesh *mesh_new = new MapBlockMesh(q->data, m_camera_offset);
+		MapBlockMesh *mesh_new = new MapBlockMesh(q->data, *m_camera_offset);
 
 		MeshUpdateResult r;
 		r.p = q->p;
 		r.mesh = mesh_new;
 		r.ack_block_to_server = q->ack_block_to_server;
 
-		m_queue_out.push_back(r);
+		m_manager->putResult(r);
+		m_queue_in->done(q->p);
 
 		delete q;
 	}
 }
+
+/*
+	MeshUpdateManager
+*/
+
+MeshUpdateManager::MeshUpdateManager(Client *client):
+	m_queue_in(client)
+{
+	int number_of_threads = g_settings->getS32("mesh_generation_threads");
+	// Leave a proc for the main thread and one for some other misc thread
+	if (number_of_threads == 0)
+		number_of_threads = Thread::getNumberOfProcessors() - 2;
+	number_of_threads = rangelim(number_of_threads, 1, 32);
+
+	infostream << "MeshUpdateManager: using " << number_of_threads
+			<< " mesh update threads" << std::endl;
+	for (int i = 0; i < number_of_threads; i++)
+		m_workers.emplace_back(new MeshUpdateWorkerThread(&m_queue_in, this,
+				&m_camera_offset));
+}
+
+void MeshUpdateManager::updateBlock(Map *map, v3s16 p, bool ack_block_to_server,
+		bool urgent)
+{
+	// Allow the MeshUpdateQueue to do whatever it wants
+	m_queue_in.addBlock(map, p, ack_block_to_server, urgent);
+	deferUpdate();
+}
+
+void MeshUpdateManager::putResult(const MeshUpdateResult &result)
+{
+	m_queue_out.push_back(result);
+}
+
+bool MeshUpdateManager::getNextResult(MeshUpdateResult &r)
+{
+	if (m_queue_out.empty())
+		return false;
+	r = m_queue_out.pop_frontNoEx();
+	return true;
+}
+
+void MeshUpdateManager::deferUpdate()
+{
+	for (auto &thread : m_workers)
+		thread->deferUpdate();
+}
+
+void MeshUpdateManager::start()
+{
+	for (auto &thread : m_workers)
+		thread->start();
+}
+
+void MeshUpdateManager::stop()
+{
+	for (auto &thread : m_workers)
+		thread->stop();
+}
+
+void MeshUpdateManager::wait()
+{
+	for (auto &thread : m_workers)
+		thread->wait();
+}
+
+bool MeshUpdateManager::isRunning()
+{
+	for (auto &thread : m_workers)
+		if (thread->isRunning())
+			return true;
+	return false;
+}
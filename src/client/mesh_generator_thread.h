@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <ctime>
+#include <memory>
 #include <mutex>
 #include "mapblock_mesh.h"
 #include "threading/mutex_auto_lock.h"
@@ -41,6 +42,7 @@ struct QueuedMeshUpdate
 	v3s16 p = v3s16(-1337, -1337, -1337);
 	bool ack_block_to_server = false;
 	bool urgent = false;
+	u8 lods[3 * 3 * 3]; // See MeshMakeData::m_lods
 	int crack_level = -1;
 	v3s16 crack_pos;
 	MeshMakeData *data = nullptr; // This is generated in MeshUpdateQueue::pop()
@@ -51,6 +53,10 @@ struct QueuedMeshUpdate
 
 /*
 	A thread-safe queue of mesh update tasks and a cache of MapBlock data
+
+	Shared by all mesh update threads. A block that is being meshed is not
+	handed out again before done() was called for it, so the meshes of one
+	block are always finished in the order they were queued.
 */
 class MeshUpdateQueue
 {
@@ -70,9 +76,12 @@ class MeshUpdateQueue
 	void addBlock(Map *map, v3s16 p, bool ack_block_to_server, bool urgent);
 
 	// Returned pointer must be deleted
-	// Returns NULL if queue is empty
+	// Returns NULL if queue is empty or all queued blocks are being meshed
 	QueuedMeshUpdate *pop();
 
+	// Must be called after the mesh of a popped block was made
+	void done(v3s16 pos);
+
 	u32 size()
 	{
 		MutexAutoLock lock(m_mutex);
@@ -83,6 +92,7 @@ class MeshUpdateQueue
 	Client *m_client;
 	std::vector<QueuedMeshUpdate *> m_queue;
 	std::set<v3s16> m_urgents;
+	std::set<v3s16> m_inflight_blocks;
 	std::map<v3s16, CachedMapBlockData *> m_cache;
 	std::mutex m_mutex;
 
@@ -107,24 +117,52 @@ struct MeshUpdateResult
 	MeshUpdateResult() = default;
 };
 
-class MeshUpdateThread : public UpdateThread
+class MeshUpdateManager;
+
+class MeshUpdateWorkerThread : public UpdateThread
+{
+public:
+	MeshUpdateWorkerThread(MeshUpdateQueue *queue_in, MeshUpdateManager *manager,
+			v3s16 *camera_offset);
+
+protected:
+	virtual void doUpdate();
+
+private:
+	MeshUpdateQueue *m_queue_in;
+	MeshUpdateManager *m_manager;
+	v3s16 *m_camera_offset;
+
+	// TODO: Add callback to update these when g_settings changes
+	int m_generation_interval;
+};
+
+/*
+	Runs the mesh update threads, see mesh_generation_threads
+*/
+class MeshUpdateManager
 {
 public:
-	MeshUpdateThread(Client *client);
+	MeshUpdateManager(Client *client);
 
 	// Caches the block at p and its neighbors (if needed) and queues a mesh
 	// update for the block at p
 	void updateBlock(Map *map, v3s16 p, bool ack_block_to_server, bool urgent);
+	void putResult(const MeshUpdateResult &r);
+	bool getNextResult(MeshUpdateResult &r);
 
 	v3s16 m_camera_offset;
-	MutexedQueue<MeshUpdateResult> m_queue_out;
 
-private:
-	MeshUpdateQueue m_queue_in;
+	void start();
+	void stop();
+	void wait();
 
-	// TODO: Add callback to update these when g_settings changes
-	int m_generation_interval;
+	bool isRunning();
 
-protected:
-	virtual void doUpdate();
+private:
+	void deferUpdate();
+
+	MeshUpdateQueue m_queue_in;
+	MutexedQueue<MeshUpdateResult> m_queue_out;
+	std::vector<std::unique_ptr<MeshUpdateWorkerThread>> m_workers;
 };
@@ -209,6 +209,10 @@ void RemoteClient::GetNextBlocks (
 	s16 d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
 		wanted_range);
 
+	// Have the blocks in front of the player emerged first
+	emerge->updateViewpoint(peer_id, EmergeViewpoint{
+		camera_pos / (BS * MAP_BLOCKSIZE), camera_dir, full_d_max});
+
 	// cos(angle between velocity and camera) * |velocity|
 	// Limit to 0.0f in case player moves backwards.
 	f32 dot = rangelim(camera_dir.dotProduct(playerspeed), 0.0f, 300.0f);
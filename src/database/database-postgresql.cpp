@@ -38,6 +38,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "settings.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "util/string.h"
+#include <cstring>
+#include <map>
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string) :
 	m_connect_string(connect_string)
@@ -195,6 +198,11 @@ void MapDatabasePostgreSQL::initStatements()
 			"WHERE posX = $1::int4 AND posY = $2::int4 AND "
 			"posZ = $3::int4");
 
+	prepareStatement("read_blocks",
+		"SELECT posX, posY, posZ, data FROM blocks "
+			"WHERE (posX, posY, posZ) IN (SELECT * FROM "
+			"unnest($1::int4[], $2::int4[], $3::int4[]))");
+
 	if (getPGVersion() < 90500) {
 		prepareStatement("write_block_insert",
 			"INSERT INTO blocks (posX, posY, posZ, data) SELECT "
@@ -278,6 +286,54 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// One array literal per coordinate, e.g. "{1,-2,3}"
+	std::string coords[3];
+	std::map<v3s16, size_t> indices;
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &pos = positions[i];
+		const char *sep = i ? "," : "{";
+		coords[0].append(sep).append(itos(pos.X));
+		coords[1].append(sep).append(itos(pos.Y));
+		coords[2].append(sep).append(itos(pos.Z));
+		indices[pos] = i;
+	}
+	for (std::string &coord : coords)
+		coord.append("}");
+
+	const char *args[] = {
+		coords[0].c_str(), coords[1].c_str(), coords[2].c_str()
+	};
+
+	// Binary results, so that data isn't escaped
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		false, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		s32 xyz[3];
+		for (int col = 0; col < 3; col++) {
+			memcpy(&xyz[col], PQgetvalue(results, row, col), sizeof(s32));
+			xyz[col] = ntohl(xyz[col]);
+		}
+		auto it = indices.find(v3s16(xyz[0], xyz[1], xyz[2]));
+		if (it != indices.end())
+			(*blocks)[it->second].assign(PQgetvalue(results, row, 3),
+				PQgetlength(results, row, 3));
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
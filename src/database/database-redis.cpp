@@ -156,6 +156,54 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// HMGET <hash> <pos>...
+	std::vector<std::string> args;
+	args.reserve(positions.size() + 2);
+	args.emplace_back("HMGET");
+	args.push_back(hash);
+	for (const v3s16 &pos : positions)
+		args.push_back(i64tos(getBlockAsInteger(pos)));
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	for (const std::string &arg : args) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY ||
+			reply->elements != positions.size()) {
+		std::string errstr = reply->type == REDIS_REPLY_ERROR ?
+			std::string(reply->str, reply->len) : "invalid reply";
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' errored: ") + errstr);
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *element = reply->element[i];
+		// Nil if the block is not in the database
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -37,6 +37,8 @@ SQLite format specification:
 #include "server/player_sao.h"
 
 #include <cassert>
+#include <algorithm>
+#include <unordered_map>
 
 // When to print messages when the database is being held locked by another process
 // Note: I've seen occasional delays of over 250ms while running minetestmapper.
@@ -197,17 +199,20 @@ Database_SQLite3::~Database_SQLite3()
  * Map database
  */
 
-MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
+MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir, bool morton_keys):
 	Database_SQLite3(savedir, "map"),
-	MapDatabase()
+	MapDatabase(),
+	m_morton_keys(morton_keys)
 {
 }
 
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_bulk)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
+	FINALIZE_STATEMENT(m_stmt_list_range)
 	FINALIZE_STATEMENT(m_stmt_delete)
 }
 
@@ -216,6 +221,19 @@ void MapDatabaseSQLite3::createDatabase()
 {
 	assert(m_database); // Pre-condition
 
+	if (m_morton_keys) {
+		// INTEGER PRIMARY KEY makes `pos` the rowid, so the rows themselves
+		// are stored in key order rather than only an index over them
+		SQLOK(sqlite3_exec(m_database,
+			"CREATE TABLE IF NOT EXISTS `blocks_morton` (\n"
+				"	`pos` INTEGER PRIMARY KEY,\n"
+				"	`data` BLOB\n"
+				");\n",
+			NULL, NULL, NULL),
+			"Failed to create database table");
+		return;
+	}
+
 	SQLOK(sqlite3_exec(m_database,
 		"CREATE TABLE IF NOT EXISTS `blocks` (\n"
 			"	`pos` INT PRIMARY KEY,\n"
@@ -225,23 +243,60 @@ void MapDatabaseSQLite3::createDatabase()
 		"Failed to create database table");
 }
 
+s64 MapDatabaseSQLite3::getKey(const v3s16 &pos) const
+{
+	return m_morton_keys ? getBlockAsMortonKey(pos) : getBlockAsInteger(pos);
+}
+
+v3s16 MapDatabaseSQLite3::getKeyPos(s64 key) const
+{
+	return m_morton_keys ? getMortonKeyAsBlock(key) : getIntegerAsBlock(key);
+}
+
+std::string MapDatabaseSQLite3::blocksQuery(const char *query) const
+{
+	std::string ret(query);
+	if (m_morton_keys)
+		str_replace(ret, "`blocks`", "`blocks_morton`");
+	return ret;
+}
+
+// Number of parameters of the bulk read statement
+#define READ_BULK_SIZE 32
+#define READ_BULK_PARAMS_8 "?,?,?,?,?,?,?,?"
+
+// Like PREPARE_STATEMENT, with `blocks` naming the table of the key layout
+#define PREPARE_BLOCKS_STATEMENT(name, query) \
+	SQLOK(sqlite3_prepare_v2(m_database, blocksQuery(query).c_str(), -1, \
+			&m_stmt_##name, NULL), \
+		"Failed to prepare query '" query "'")
+
 void MapDatabaseSQLite3::initStatements()
 {
-	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	// An existing map.sqlite may not have the table of this layout yet,
+	// e.g. when migrating between the two
+	createDatabase();
+
+	PREPARE_BLOCKS_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	PREPARE_BLOCKS_STATEMENT(read_bulk, "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN ("
+		READ_BULK_PARAMS_8 "," READ_BULK_PARAMS_8 ","
+		READ_BULK_PARAMS_8 "," READ_BULK_PARAMS_8 ")");
 #ifdef __ANDROID__
-	PREPARE_STATEMENT(write,  "INSERT INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
+	PREPARE_BLOCKS_STATEMENT(write,  "INSERT INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 #else
-	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
+	PREPARE_BLOCKS_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 #endif
-	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
-	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
+	PREPARE_BLOCKS_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
+	PREPARE_BLOCKS_STATEMENT(list, "SELECT `pos` FROM `blocks`");
+	PREPARE_BLOCKS_STATEMENT(list_range,
+		"SELECT `pos` FROM `blocks` WHERE `pos` BETWEEN ? AND ?");
 
 	verbosestream << "ServerMap: SQLite3 database opened." << std::endl;
 }
 
 inline void MapDatabaseSQLite3::bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index)
 {
-	SQLOK(sqlite3_bind_int64(stmt, index, getBlockAsInteger(pos)),
+	SQLOK(sqlite3_bind_int64(stmt, index, getKey(pos)),
 		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
 }
 
@@ -309,16 +364,142 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	std::unordered_map<s64, size_t> indices;
+	for (size_t start = 0; start < positions.size(); start += READ_BULK_SIZE) {
+		size_t count = std::min<size_t>(positions.size() - start, READ_BULK_SIZE);
+
+		// Unused parameters repeat the first position
+		indices.clear();
+		for (size_t i = 0; i < READ_BULK_SIZE; i++) {
+			size_t index = start + (i < count ? i : 0);
+			bindPos(m_stmt_read_bulk, positions[index], i + 1);
+			indices[getKey(positions[index])] = index;
+		}
+
+		while (sqlite3_step(m_stmt_read_bulk) == SQLITE_ROW) {
+			auto it = indices.find(sqlite3_column_int64(m_stmt_read_bulk, 0));
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read_bulk, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_bulk, 1);
+			if (it != indices.end() && data)
+				(*blocks)[it->second].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read_bulk);
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
 
 	while (sqlite3_step(m_stmt_list) == SQLITE_ROW)
-		dst.push_back(getIntegerAsBlock(sqlite3_column_int64(m_stmt_list, 0)));
+		dst.push_back(getKeyPos(sqlite3_column_int64(m_stmt_list, 0)));
 
 	sqlite3_reset(m_stmt_list);
 }
 
+void MapDatabaseSQLite3::listKeyRange(s64 first, s64 last,
+		const v3s16 &min, const v3s16 &max, std::vector<v3s16> &dst)
+{
+	SQLOK(sqlite3_bind_int64(m_stmt_list_range, 1, first),
+		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+	SQLOK(sqlite3_bind_int64(m_stmt_list_range, 2, last),
+		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+
+	while (sqlite3_step(m_stmt_list_range) == SQLITE_ROW) {
+		v3s16 pos = getKeyPos(sqlite3_column_int64(m_stmt_list_range, 0));
+		if (pos.X >= min.X && pos.Y >= min.Y && pos.Z >= min.Z &&
+				pos.X <= max.X && pos.Y <= max.Y && pos.Z <= max.Z)
+			dst.push_back(pos);
+	}
+
+	sqlite3_reset(m_stmt_list_range);
+}
+
+// Octree cells up to this size (or 1/16 of the area, if larger) that only
+// partly overlap the area are scanned whole instead of split further,
+// trading a few extra rows for far fewer queries
+#define MORTON_MIN_CELL 4
+
+// Collects the Morton key ranges covering [min, max], in ascending order
+static void get_morton_ranges(const v3s16 &cell, s32 size, s32 min_cell,
+		const v3s16 &min, const v3s16 &max, std::vector<std::pair<s64, s64>> &ranges)
+{
+	if (cell.X > max.X || cell.Y > max.Y || cell.Z > max.Z ||
+			cell.X + size - 1 < min.X || cell.Y + size - 1 < min.Y ||
+			cell.Z + size - 1 < min.Z)
+		return;
+
+	bool inside = cell.X >= min.X && cell.Y >= min.Y && cell.Z >= min.Z &&
+		cell.X + size - 1 <= max.X && cell.Y + size - 1 <= max.Y &&
+		cell.Z + size - 1 <= max.Z;
+
+	if (inside || size <= min_cell) {
+		// An aligned cell covers one contiguous run of keys
+		s64 first = MapDatabase::getBlockAsMortonKey(cell);
+		s64 last = first + (s64) size * size * size - 1;
+		if (!ranges.empty() && ranges.back().second + 1 == first)
+			ranges.back().second = last;
+		else
+			ranges.emplace_back(first, last);
+		return;
+	}
+
+	// Children in key order: x is the lowest interleaved bit
+	s32 half = size / 2;
+	for (u8 i = 0; i < 8; i++) {
+		v3s16 child = cell + v3s16((i & 1) * half,
+			((i >> 1) & 1) * half, ((i >> 2) & 1) * half);
+		get_morton_ranges(child, half, min_cell, min, max, ranges);
+	}
+}
+
+void MapDatabaseSQLite3::listBlocksInArea(const v3s16 &min, const v3s16 &max,
+		std::vector<v3s16> &dst)
+{
+	verifyDatabase();
+
+	if (min.X > max.X || min.Y > max.Y || min.Z > max.Z)
+		return;
+
+	if (m_morton_keys) {
+		s32 extent = std::min(max.X - min.X, std::min(max.Y - min.Y, max.Z - min.Z)) + 1;
+		s32 min_cell = MORTON_MIN_CELL;
+		while (min_cell * 16 <= extent)
+			min_cell *= 2;
+
+		std::vector<std::pair<s64, s64>> ranges;
+		get_morton_ranges(v3s16(-2048, -2048, -2048), 4096, min_cell,
+			min, max, ranges);
+		for (const auto &range : ranges)
+			listKeyRange(range.first, range.second, min, max, dst);
+		return;
+	}
+
+	// Each X row is a contiguous run of keys in the legacy layout, and so
+	// is each XY plane. Scan planes when there would be too many rows.
+	if ((max.Y - min.Y + 1) * (max.Z - min.Z + 1) > 4096) {
+		for (s32 z = min.Z; z <= max.Z; z++) {
+			listKeyRange(getKey(v3s16(min.X, min.Y, z)),
+				getKey(v3s16(max.X, max.Y, z)), min, max, dst);
+		}
+		return;
+	}
+
+	for (s32 z = min.Z; z <= max.Z; z++)
+	for (s32 y = min.Y; y <= max.Y; y++) {
+		listKeyRange(getKey(v3s16(min.X, y, z)), getKey(v3s16(max.X, y, z)),
+			min, max, dst);
+	}
+}
+
 /*
  * Player Database
  */
@@ -143,13 +143,19 @@ class Database_SQLite3 : public Database
 class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 {
 public:
-	MapDatabaseSQLite3(const std::string &savedir);
+	// With morton_keys, blocks are stored in the `blocks_morton` table,
+	// clustered by getBlockAsMortonKey() instead of getBlockAsInteger().
+	MapDatabaseSQLite3(const std::string &savedir, bool morton_keys = false);
 	virtual ~MapDatabaseSQLite3();
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+	void listBlocksInArea(const v3s16 &min, const v3s16 &max,
+			std::vector<v3s16> &dst);
 
 	void beginSave() { Database_SQLite3::beginSave(); }
 	void endSave() { Database_SQLite3::endSave(); }
@@ -158,12 +164,21 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 	virtual void initStatements();
 
 private:
+	s64 getKey(const v3s16 &pos) const;
+	v3s16 getKeyPos(s64 key) const;
+	std::string blocksQuery(const char *query) const;
 	void bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index = 1);
+	void listKeyRange(s64 first, s64 last, const v3s16 &min, const v3s16 &max,
+			std::vector<v3s16> &dst);
+
+	const bool m_morton_keys;
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
+	sqlite3_stmt *m_stmt_read_bulk = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
+	sqlite3_stmt *m_stmt_list_range = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
 };
 
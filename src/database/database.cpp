@@ -48,6 +48,16 @@ static inline s64 pythonmodulo(s64 i, s16 mod)
 }
 
 
+void MapDatabase::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		loadBlock(positions[i], &(*blocks)[i]);
+}
+
+
 s64 MapDatabase::getBlockAsInteger(const v3s16 &pos)
 {
 	return (u64) pos.Z * 0x1000000 +
@@ -67,3 +77,57 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+
+// Spreads the low 12 bits of i so there are two zero bits between each
+static inline u64 morton_spread(u64 i)
+{
+	i &= 0xfff;
+	i = (i | i << 16) & 0x00f0000ffULL;
+	i = (i | i << 8) & 0x00f00f00fULL;
+	i = (i | i << 4) & 0x0c30c30c3ULL;
+	i = (i | i << 2) & 0x249249249ULL;
+	return i;
+}
+
+
+static inline u16 morton_compact(u64 i)
+{
+	i &= 0x249249249ULL;
+	i = (i | i >> 2) & 0x0c30c30c3ULL;
+	i = (i | i >> 4) & 0x00f00f00fULL;
+	i = (i | i >> 8) & 0x00f0000ffULL;
+	i = (i | i >> 16) & 0xfff;
+	return i;
+}
+
+
+s64 MapDatabase::getBlockAsMortonKey(const v3s16 &pos)
+{
+	// Offset into 0..4095 so the keys are never negative
+	return morton_spread(pos.X + 2048) |
+		morton_spread(pos.Y + 2048) << 1 |
+		morton_spread(pos.Z + 2048) << 2;
+}
+
+
+v3s16 MapDatabase::getMortonKeyAsBlock(s64 key)
+{
+	return v3s16(
+		(s16) morton_compact(key) - 2048,
+		(s16) morton_compact(key >> 1) - 2048,
+		(s16) morton_compact(key >> 2) - 2048);
+}
+
+
+void MapDatabase::listBlocksInArea(const v3s16 &min, const v3s16 &max,
+		std::vector<v3s16> &dst)
+{
+	std::vector<v3s16> all;
+	listAllLoadableBlocks(all);
+	for (const v3s16 &pos : all) {
+		if (pos.X >= min.X && pos.Y >= min.Y && pos.Z >= min.Z &&
+				pos.X <= max.X && pos.Y <= max.Y && pos.Z <= max.Z)
+			dst.push_back(pos);
+	}
+}
@@ -43,10 +43,25 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Loads many blocks, in as few round trips as the backend allows.
+	// (*blocks)[i] is left empty if there is no block at positions[i].
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
+	// Z-order (Morton) key: the bits of the three coordinates interleaved,
+	// so blocks that are near each other get keys that are near each other.
+	static s64 getBlockAsMortonKey(const v3s16 &pos);
+	static v3s16 getMortonKeyAsBlock(s64 key);
+
 	virtual void listAllLoadableBlocks(std::vector<v3s16> &dst) = 0;
+
+	// Lists the stored blocks within [min, max] (inclusive). The default
+	// filters listAllLoadableBlocks, backends should do a range scan.
+	virtual void listBlocksInArea(const v3s16 &min, const v3s16 &max,
+			std::vector<v3s16> &dst);
 };
 
 class PlayerSAO;
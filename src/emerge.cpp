@@ -21,7 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
 #include <iostream>
+#include <deque>
 #include <queue>
 
 #include "util/container.h"
@@ -39,25 +41,38 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_decoration.h"
 #include "mapgen/mg_schematic.h"
 #include "nodedef.h"
+#include "porting.h"
 #include "profiler.h"
+#include "scripting_emerge.h"
 #include "scripting_server.h"
 #include "server.h"
 #include "settings.h"
 #include "voxel.h"
 
+// Blocks of an emerge queue read from the database in one go
+#define EMERGE_PREFETCH_MAX 128
+
+// Each second in the queue makes a block count as this many blocks closer
+// to the players, so requests far from everyone are not starved
+#define EMERGE_PRIORITY_AGING 2.0f
+
+// Requested blocks are cancelled this far outside the player's range
+#define EMERGE_CANCEL_MARGIN 2
+
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
 	int id;
 
 	EmergeThread(Server *server, int ethreadid);
-	~EmergeThread() = default;
+	~EmergeThread() { delete m_script; }
 
 	void *run();
 	void signal();
 
 	// Requires queue mutex held
 	bool pushBlock(const v3s16 &pos);
+	bool stealBlock();
 
 	void cancelPendingItems();
 
@@ -70,11 +85,19 @@ class EmergeThread : public Thread {
 	ServerMap *m_map;
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
+	// Lua environment of the mapgen scripts, if any are registered
+	EmergeScripting *m_script = nullptr;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	std::deque<v3s16> m_block_queue;
+
+	// Protected by the queue mutex: whether a block is being emerged and
+	// which chunk it is in, so no other thread steals blocks of that chunk
+	bool m_busy = false;
+	v3s16 m_current_chunk;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	void prefetchQueuedBlocks(const v3s16 &pos);
 
 	EmergeAction getBlockOrStartGen(
 		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
@@ -241,8 +264,7 @@ void EmergeManager::initMapgens(MapgenParams *params)
 	mgparams = params;
 
 	for (u32 i = 0; i != m_threads.size(); i++) {
-		EmergeParams *p = new EmergeParams(
-			this, biomemgr, oremgr, decomgr, schemmgr);
+		EmergeParams *p = createEmergeParams();
 		infostream << "EmergeManager: Created params " << p
 			<< " for thread " << i << std::endl;
 		m_mapgens.push_back(Mapgen::createMapgen(params->mgtype, params, p));
@@ -250,6 +272,21 @@ void EmergeManager::initMapgens(MapgenParams *params)
 }
 
 
+void EmergeManager::addMapgenScript(const std::string &mod_name,
+	const std::string &path)
+{
+	FATAL_ERROR_IF(!m_mapgens.empty(),
+		"Mapgen scripts can only be added before mapgen init");
+	m_mapgen_scripts.emplace_back(mod_name, path);
+}
+
+
+EmergeParams *EmergeManager::createEmergeParams()
+{
+	return new EmergeParams(this, biomemgr, oremgr, decomgr, schemmgr);
+}
+
+
 Mapgen *EmergeManager::getCurrentMapgen()
 {
 	if (!m_threads_active)
@@ -340,6 +377,8 @@ bool EmergeManager::enqueueBlockEmergeEx(
 
 		thread = getOptimalThread();
 		thread->pushBlock(blockpos);
+		if (thread->m_busy || thread->m_block_queue.size() > 1)
+			signalIdleThreads();
 	}
 
 	thread->signal();
@@ -348,6 +387,25 @@ bool EmergeManager::enqueueBlockEmergeEx(
 }
 
 
+void EmergeManager::updateViewpoint(session_t peer_id,
+	const EmergeViewpoint &viewpoint)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	m_viewpoints[peer_id] = viewpoint;
+	cancelOutOfRange(peer_id);
+}
+
+
+void EmergeManager::removeViewpoint(session_t peer_id)
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	m_viewpoints.erase(peer_id);
+	cancelOutOfRange(peer_id);
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -415,7 +473,7 @@ bool EmergeManager::pushBlockEmergeData(
 	void *callback_param,
 	bool *entry_already_exists)
 {
-	u16 &count_peer = m_peer_queue_count[peer_requested];
+	std::set<v3s16> &peer_requests = m_peer_requests[peer_requested];
 
 	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
 		if (m_blocks_enqueued.size() >= m_qlimit_total)
@@ -424,7 +482,7 @@ bool EmergeManager::pushBlockEmergeData(
 		if (peer_requested != PEER_ID_INEXISTENT) {
 			u16 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
 				m_qlimit_generate : m_qlimit_diskonly;
-			if (count_peer >= qlimit_peer)
+			if (peer_requests.size() >= qlimit_peer)
 				return false;
 		}
 	}
@@ -442,9 +500,12 @@ bool EmergeManager::pushBlockEmergeData(
 		bedata.flags |= flags;
 	} else {
 		bedata.flags = flags;
-		bedata.peer_requested = peer_requested;
+		bedata.time_queued = porting::getTimeMs();
+	}
 
-		count_peer++;
+	if (peer_requests.insert(pos).second) {
+		bedata.peers_requested.push_back(peer_requested);
+		updateViewDistance(pos, bedata);
 	}
 
 	return true;
@@ -454,7 +515,6 @@ bool EmergeManager::pushBlockEmergeData(
 bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 {
 	std::map<v3s16, BlockEmergeData>::iterator it;
-	std::unordered_map<u16, u16>::iterator it2;
 
 	it = m_blocks_enqueued.find(pos);
 	if (it == m_blocks_enqueued.end())
@@ -462,13 +522,14 @@ bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 
 	*bedata = it->second;
 
-	it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
-		return false;
-
-	u16 &count_peer = it2->second;
-	assert(count_peer != 0);
-	count_peer--;
+	for (session_t peer_id : bedata->peers_requested) {
+		auto it2 = m_peer_requests.find(peer_id);
+		if (it2 == m_peer_requests.end())
+			continue;
+		it2->second.erase(pos);
+		if (it2->second.empty())
+			m_peer_requests.erase(it2);
+	}
 
 	m_blocks_enqueued.erase(it);
 
@@ -482,11 +543,13 @@ EmergeThread *EmergeManager::getOptimalThread()
 
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
+	// Count the block being worked on, so idle threads are preferred
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->m_block_queue.size() +
+		m_threads[0]->m_busy;
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = m_threads[i]->m_block_queue.size() + m_threads[i]->m_busy;
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -497,6 +560,120 @@ EmergeThread *EmergeManager::getOptimalThread()
 }
 
 
+void EmergeManager::signalIdleThreads()
+{
+	for (EmergeThread *thread : m_threads) {
+		if (!thread->m_busy && thread->m_block_queue.empty())
+			thread->signal();
+	}
+}
+
+
+bool EmergeManager::isChunkInProgress(v3s16 chunkpos)
+{
+	for (EmergeThread *thread : m_threads) {
+		if (thread->m_busy && thread->m_current_chunk == chunkpos)
+			return true;
+	}
+	return false;
+}
+
+
+float EmergeManager::getViewDistance(v3s16 pos,
+	const EmergeViewpoint &viewpoint)
+{
+	v3f offset = v3f(pos.X + 0.5f, pos.Y + 0.5f, pos.Z + 0.5f) - viewpoint.pos;
+	float dist = offset.getLength();
+	// A block straight behind the player counts as three times as far
+	float cos_angle = dist > 0.001f ?
+		viewpoint.dir.dotProduct(offset) / dist : 1.0f;
+	return dist * (2.0f - cos_angle);
+}
+
+
+void EmergeManager::updateViewDistance(v3s16 pos, BlockEmergeData &bedata)
+{
+	bool found = false;
+	float distance = 0.0f;
+	for (session_t peer_id : bedata.peers_requested) {
+		auto it = m_viewpoints.find(peer_id);
+		if (it == m_viewpoints.end())
+			continue;
+		float d = getViewDistance(pos, it->second);
+		if (!found || d < distance)
+			distance = d;
+		found = true;
+	}
+
+	// Blocks not requested by a player go by the nearest one when queued
+	if (!found) {
+		for (const auto &it : m_viewpoints) {
+			float d = getViewDistance(pos, it.second);
+			if (!found || d < distance)
+				distance = d;
+			found = true;
+		}
+	}
+
+	bedata.view_distance = distance;
+}
+
+
+float EmergeManager::getBlockPriority(const BlockEmergeData &bedata, u64 now)
+{
+	// Lower is more urgent. Without players, this is just the queue order.
+	return bedata.view_distance -
+		(now - bedata.time_queued) / 1000.0f * EMERGE_PRIORITY_AGING;
+}
+
+
+void EmergeManager::cancelOutOfRange(session_t peer_id)
+{
+	auto requests = m_peer_requests.find(peer_id);
+	if (requests == m_peer_requests.end())
+		return;
+
+	// Blocks without a viewpoint of the requesting player are cancelled too,
+	// that player is gone
+	auto viewpoint = m_viewpoints.find(peer_id);
+
+	std::vector<v3s16> cancelled;
+	for (const v3s16 &pos : requests->second) {
+		BlockEmergeData &bedata = m_blocks_enqueued[pos];
+
+		if (viewpoint != m_viewpoints.end()) {
+			v3f center(pos.X + 0.5f, pos.Y + 0.5f, pos.Z + 0.5f);
+			if ((center - viewpoint->second.pos).getLength() <=
+					viewpoint->second.range + EMERGE_CANCEL_MARGIN) {
+				// The viewpoint moved
+				updateViewDistance(pos, bedata);
+				continue;
+			}
+		}
+
+		if (bedata.callbacks.empty() &&
+				!(bedata.flags & BLOCK_EMERGE_FORCE_QUEUE))
+			cancelled.push_back(pos);
+	}
+
+	// Blocks still wanted by other requesters stay queued
+	for (const v3s16 &pos : cancelled) {
+		requests->second.erase(pos);
+
+		auto it = m_blocks_enqueued.find(pos);
+		std::vector<session_t> &peers = it->second.peers_requested;
+		peers.erase(std::find(peers.begin(), peers.end(), peer_id));
+		if (peers.empty())
+			m_blocks_enqueued.erase(it);
+		else
+			updateViewDistance(pos, it->second);
+	}
+
+	if (requests->second.empty())
+		m_peer_requests.erase(requests);
+}
+
+
 ////
 //// EmergeThread
 ////
@@ -521,7 +698,50 @@ void EmergeThread::signal()
 
 bool EmergeThread::pushBlock(const v3s16 &pos)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back(pos);
+	return true;
+}
+
+
+bool EmergeThread::stealBlock()
+{
+	EmergeThread *victim = nullptr;
+	size_t nitems_highest = 0;
+	for (EmergeThread *thread : m_emerge->m_threads) {
+		if (thread != this && thread->m_block_queue.size() > nitems_highest) {
+			victim = thread;
+			nitems_highest = thread->m_block_queue.size();
+		}
+	}
+
+	if (!victim)
+		return false;
+
+	// Take the most urgent block. Blocks of a chunk that is being generated
+	// are left alone, they are done as soon as that finishes.
+	u64 now = porting::getTimeMs();
+	auto best = victim->m_block_queue.end();
+	float best_priority = 0.0f;
+	for (auto it = victim->m_block_queue.begin();
+			it != victim->m_block_queue.end(); ++it) {
+		auto bedata = m_emerge->m_blocks_enqueued.find(*it);
+		if (bedata == m_emerge->m_blocks_enqueued.end() ||
+				m_emerge->isChunkInProgress(m_emerge->getContainingChunk(*it)))
+			continue;
+
+		float priority = m_emerge->getBlockPriority(bedata->second, now);
+		if (best == victim->m_block_queue.end() || priority < best_priority) {
+			best = it;
+			best_priority = priority;
+		}
+	}
+
+	if (best == victim->m_block_queue.end())
+		return false;
+
+	m_block_queue.push_back(*best);
+	victim->m_block_queue.erase(best);
+	g_profiler->add(m_name + ": blocks stolen", 1);
 	return true;
 }
 
@@ -535,11 +755,10 @@ void EmergeThread::cancelPendingItems()
 		v3s16 pos;
 
 		pos = m_block_queue.front();
-		m_block_queue.pop();
+		m_block_queue.pop_front();
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
-
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+		if (m_emerge->popBlockEmergeData(pos, &bedata))
+			runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
 	}
 }
 
@@ -563,11 +782,39 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
+	// Drop the blocks that were cancelled in the meantime
+	const auto &enqueued = m_emerge->m_blocks_enqueued;
+	m_block_queue.erase(std::remove_if(m_block_queue.begin(), m_block_queue.end(),
+		[&enqueued] (const v3s16 &p) { return enqueued.find(p) == enqueued.end(); }),
+		m_block_queue.end());
+
+	if (m_block_queue.empty() && !stealBlock()) {
+		m_busy = false;
 		return false;
+	}
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	// Most urgent first
+	u64 now = porting::getTimeMs();
+	auto best = m_block_queue.begin();
+	float best_priority = m_emerge->getBlockPriority(enqueued.at(*best), now);
+	for (auto it = best + 1; it != m_block_queue.end(); ++it) {
+		float priority = m_emerge->getBlockPriority(enqueued.at(*it), now);
+		if (priority < best_priority) {
+			best = it;
+			best_priority = priority;
+		}
+	}
+
+	*pos = *best;
+	m_block_queue.erase(best);
+
+	m_busy = true;
+	m_current_chunk = m_emerge->getContainingChunk(*pos);
+
+	// Blocks that were left alone while their chunk was in progress can
+	// be stolen again now
+	if (!m_block_queue.empty())
+		m_emerge->signalIdleThreads();
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -575,6 +822,24 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+void EmergeThread::prefetchQueuedBlocks(const v3s16 &pos)
+{
+	// Requires the environment locked, like all map access
+	std::vector<v3s16> positions;
+	positions.push_back(pos);
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		for (const v3s16 &p : m_block_queue) {
+			if (positions.size() >= EMERGE_PREFETCH_MAX)
+				break;
+			positions.push_back(p);
+		}
+	}
+
+	m_map->prefetchBlocks(positions);
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -586,7 +851,10 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 		if ((*block)->isGenerated())
 			return EMERGE_FROM_MEMORY;
 	} else {
-		// 2). Attempt to load block from disk if it was not in the memory
+		// 2). Attempt to load block from disk if it was not in the memory,
+		// along with the rest of the queue to save database round trips
+		if (!m_map->isBlockPrefetched(pos))
+			prefetchQueuedBlocks(pos);
 		*block = m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
@@ -669,6 +937,12 @@ void *EmergeThread::run()
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
 
 	try {
+	if (!m_script && !m_emerge->m_mapgen_scripts.empty()) {
+		m_script = new EmergeScripting(m_server,
+			m_emerge->createEmergeParams());
+		m_script->loadScripts(m_emerge->m_mapgen_scripts);
+	}
+
 	while (!stopRequested()) {
 		std::map<v3s16, MapBlock *> modified_blocks;
 		BlockEmergeData bedata;
@@ -681,6 +955,9 @@ void *EmergeThread::run()
 			continue;
 		}
 
+		g_profiler->avg(m_name + ": queue wait time [ms]",
+			porting::getTimeMs() - bedata.time_queued);
+
 		if (blockpos_over_max_limit(pos))
 			continue;
 
@@ -696,6 +973,13 @@ void *EmergeThread::run()
 				m_mapgen->makeChunk(&bmdata);
 			}
 
+			if (m_script) {
+				ScopeProfiler sp(g_profiler,
+					"EmergeThread: Lua on_generated", SPT_AVG);
+
+				m_script->on_generated(&bmdata, m_mapgen->blockseed);
+			}
+
 			block = finishGen(pos, &bmdata, &modified_blocks);
 		}
 
@@ -725,6 +1009,12 @@ void *EmergeThread::run()
 			<< "You can ignore this using [ignore_world_load_errors = true]."
 			<< std::endl;
 		m_server->setAsyncFatalError(err.str());
+	} catch (LuaError &e) {
+		m_server->setAsyncFatalError("Lua: on_generated: " +
+			std::string(e.what()));
+	} catch (ModError &e) {
+		m_server->setAsyncFatalError("Lua: mapgen script: " +
+			std::string(e.what()));
 	}
 
 	END_DEBUG_EXCEPTION_HANDLER
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <map>
 #include <mutex>
+#include <set>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
 #include "util/container.h"
@@ -82,11 +83,22 @@ typedef std::vector<
 > EmergeCallbackList;
 
 struct BlockEmergeData {
-	u16 peer_requested;
+	// PEER_ID_INEXISTENT stands for requests not made by a player
+	std::vector<session_t> peers_requested;
 	u16 flags;
+	u64 time_queued; // ms
+	// Distance to the nearest viewpoint of the requesting players
+	float view_distance;
 	EmergeCallbackList callbacks;
 };
 
+// Where a player looks from, in block coordinates, used to order the queue
+struct EmergeViewpoint {
+	v3f pos;
+	v3f dir;
+	s16 range;
+};
+
 class EmergeParams {
 	friend class EmergeManager;
 public:
@@ -154,6 +166,10 @@ class EmergeManager {
 
 	void initMapgens(MapgenParams *mgparams);
 
+	// Lua files each EmergeThread runs in its mapgen environment,
+	// only usable before mapgen init
+	void addMapgenScript(const std::string &mod_name, const std::string &path);
+
 	void startThreads();
 	void stopThreads();
 	bool isRunning();
@@ -171,6 +187,12 @@ class EmergeManager {
 		EmergeCompletionCallback callback,
 		void *callback_param);
 
+	// Queued blocks are emerged nearest to a viewpoint first. Blocks a
+	// player requested are dropped once out of range of all the players
+	// that requested them.
+	void updateViewpoint(session_t peer_id, const EmergeViewpoint &viewpoint);
+	void removeViewpoint(session_t peer_id);
+
 	v3s16 getContainingChunk(v3s16 blockpos);
 
 	Mapgen *getCurrentMapgen();
@@ -189,7 +211,10 @@ class EmergeManager {
 
 	std::mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
-	std::unordered_map<u16, u16> m_peer_queue_count;
+	// Queued blocks by requesting peer. Blocks are only removed from the
+	// thread queues when popped, those without data are skipped then.
+	std::unordered_map<session_t, std::set<v3s16>> m_peer_requests;
+	std::unordered_map<session_t, EmergeViewpoint> m_viewpoints;
 
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
@@ -202,8 +227,21 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Mod name and path of the mapgen scripts
+	std::vector<std::pair<std::string, std::string>> m_mapgen_scripts;
+
+	// Clones the managers for a user other than the mapgens
+	EmergeParams *createEmergeParams();
+
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	// Idle threads only steal blocks when woken up
+	void signalIdleThreads();
+	bool isChunkInProgress(v3s16 chunkpos);
+	static float getViewDistance(v3s16 pos, const EmergeViewpoint &viewpoint);
+	void updateViewDistance(v3s16 pos, BlockEmergeData &bedata);
+	float getBlockPriority(const BlockEmergeData &bedata, u64 now);
+	void cancelOutOfRange(session_t peer_id);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
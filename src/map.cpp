@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "gamedef.h"
 #include "util/directiontables.h"
 #include "util/basic_macros.h"
+#include "util/workerpool.h"
 #include "rollback_interface.h"
 #include "environment.h"
 #include "reflowscan.h"
@@ -45,6 +46,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
+#include "map_saver.h"
 #include <deque>
 #include <queue>
 #if USE_LEVELDB
@@ -78,6 +80,23 @@ Map::~Map()
 	}
 }
 
+void Map::setLiquidThreads(s16 num_threads)
+{
+	// The calling thread takes part in the work
+	if (num_threads > 1)
+		m_liquid_workers.reset(new WorkerPool("Liquids", num_threads - 1));
+	else
+		m_liquid_workers.reset();
+}
+
+void Map::setLightingThreads(s16 num_threads)
+{
+	if (num_threads > 1)
+		m_lighting_workers.reset(new WorkerPool("Lighting", num_threads - 1));
+	else
+		m_lighting_workers.reset();
+}
+
 void Map::addEventReceiver(MapEventReceiver *event_receiver)
 {
 	m_event_receivers.insert(event_receiver);
@@ -90,6 +109,13 @@ void Map::removeEventReceiver(MapEventReceiver *event_receiver)
 
 void Map::dispatchEvent(const MapEditEvent &event)
 {
+	// Metadata is edited in place, so the block doesn't know about it.
+	// Don't let the outdated network data be sent until the event is handled.
+	if (event.type == MEET_BLOCK_NODE_METADATA_CHANGED) {
+		if (MapBlock *block = getBlockNoCreateNoEx(getNodeBlockPos(event.p)))
+			block->invalidateNetworkCache();
+	}
+
 	for (MapEventReceiver *event_receiver : m_event_receivers) {
 		event_receiver->onMapEditEvent(event);
 	}
@@ -123,12 +149,7 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerate(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
+	return m_block_index.get(p3d);
 }
 
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
@@ -362,6 +383,13 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 						saved_blocks_count++;
 					}
 
+					// Keep it until it is written
+					if (isBlockSaving(p)) {
+						all_blocks_deleted = false;
+						block_count_all++;
+						continue;
+					}
+
 					// Delete from memory
 					sector->deleteBlock(block);
 
@@ -414,6 +442,10 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 				saved_blocks_count++;
 			}
 
+			// Keep it until it is written
+			if (isBlockSaving(p))
+				continue;
+
 			// Delete from memory
 			b.sect->deleteBlock(block);
 
@@ -513,339 +545,463 @@ void Map::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
 }
 
-void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
-		ServerEnvironment *env)
+/*
+	Output of transforming a set of liquid nodes, collected separately for
+	each region when they are transformed in parallel.
+*/
+struct LiquidTransformState
 {
-	u32 loopcount = 0;
-	u32 initial_size = m_transforming_liquid.size();
+	LiquidTransformState(Map *map, ServerEnvironment *env,
+			std::map<v3s16, MapBlock*> &modified_blocks) :
+		map(map), env(env), modified_blocks(modified_blocks)
+	{}
 
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
+	void enqueue(v3s16 p)
+	{
+		if (queued)
+			queued->push_back(p);
+		else
+			map->transforming_liquid_add(p);
+	}
 
+	Map *map;
+	ServerEnvironment *env;
+	std::map<v3s16, MapBlock*> &modified_blocks;
 	// list of nodes that due to viscosity have not reached their max level height
 	std::deque<v3s16> must_reflow;
-
 	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
 
-	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
-	u32 loop_max = liquid_loop_max;
-
-#if 0
+	// If set, the neighbors to update are collected here instead of being
+	// added to the queue of the map
+	std::vector<v3s16> *queued = nullptr;
+	// If set, nodes that need to call on_flood() are not changed but
+	// collected in 'deferred'
+	bool defer_callbacks = false;
+	std::vector<v3s16> deferred;
+};
 
-	/* If liquid_loop_max is not keeping up with the queue size increase
-	 * loop_max up to a maximum of liquid_loop_max * dedicated_server_step.
-	 */
-	if (m_transforming_liquid.size() > loop_max * 2) {
-		// "Burst" mode
-		float server_step = g_settings->getFloat("dedicated_server_step");
-		if (m_transforming_liquid_loop_count_multiplier - 1.0 < server_step)
-			m_transforming_liquid_loop_count_multiplier *= 1.0 + server_step / 10;
-	} else {
-		m_transforming_liquid_loop_count_multiplier = 1.0;
-	}
+void Map::transformLiquidNode(v3s16 p0, LiquidTransformState &state)
+{
+	MapNode n0 = getNode(p0);
 
-	loop_max *= m_transforming_liquid_loop_count_multiplier;
-#endif
+	// What a deferred node queued so far is queued again when it is redone
+	size_t queued_size = state.queued ? state.queued->size() : 0;
+	size_t must_reflow_size = state.must_reflow.size();
 
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = m_nodedef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
 			break;
-		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
-		m_transforming_liquid.pop_front();
-
-		MapNode n0 = getNode(p0);
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
 
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = cf.liquid_alternative_flowing_id;
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
 				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
+			case 5:
+				nt = NEIGHBOR_LOWER;
 				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
+			default:
 				break;
 		}
-
-		/*
-			Collect information about the environment
-		 */
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 0:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 5:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + liquid_6dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			switch (m_nodedef->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(getNode(npos), nt, npos);
+		const ContentFeatures &cfnb = m_nodedef->get(nb.n);
+		switch (m_nodedef->get(nb.n.getContent()).liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						state.enqueue(npos);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
 						if (nb.t == NEIGHBOR_LOWER)
 							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
+						else
+							ignored_sources = true;
 					}
-					break;
-				case LIQUID_SOURCE:
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
 					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
 					if (liquid_kind == CONTENT_AIR)
 						liquid_kind = cfnb.liquid_alternative_flowing_id;
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(nt != NEIGHBOR_LOWER)
-							sources[num_sources++] = nb;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = m_nodedef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighbouring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
 					}
 					break;
-				case LIQUID_FLOWING:
-					if (nb.t != NEIGHBOR_SAME_LEVEL ||
-						(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
-						// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-						// but exclude falling liquids on the same level, they cannot flow here anyway
-						if (liquid_kind == CONTENT_AIR)
-							liquid_kind = cfnb.liquid_alternative_flowing_id;
-					}
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
 					break;
 			}
 		}
 
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighbouring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
+		u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				state.must_reflow.push_back(p0);
 		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
+			new_node_level = max_node_level;
+		}
 
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
 
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return;
 
+
+	/*
+		update the current node
+	 */
+	MapNode n00 = n0;
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+
+	// change the node.
+	n0.setContent(new_node_content);
+
+	// on_flood() the node
+	if (floodable_node != CONTENT_AIR) {
+		// Callbacks can't run on a worker thread, redo the node later
+		if (state.defer_callbacks) {
+			if (state.queued)
+				state.queued->resize(queued_size);
+			state.must_reflow.resize(must_reflow_size);
+			state.deferred.push_back(p0);
+			return;
 		}
+		if (state.env->getScriptIface()->node_on_flood(p0, n00, n0))
+			return;
+	}
 
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
-			continue;
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
+	n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
+
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if (m_gamedef->rollback())
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+
+	if (m_gamedef->rollback() && !suspect.empty()) {
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		// Get old node for rollback
+		RollbackNode rollback_oldnode(this, p0, m_gamedef);
+		// Set node
+		setNode(p0, n0);
+		// Report
+		RollbackNode rollback_newnode(this, p0, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	} else {
+		// Set node
+		setNode(p0, n0);
+	}
 
+	v3s16 blockpos = getNodeBlockPos(p0);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block != NULL) {
+		state.modified_blocks[blockpos] = block;
+		state.changed_nodes.emplace_back(p0, n00);
+	}
 
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bits to 0
-			n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (m_nodedef->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					state.enqueue(flows[i].p);
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					state.enqueue(airs[i].p);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				state.enqueue(flows[i].p);
+			break;
+	}
+}
 
-		// change the node.
-		n0.setContent(new_node_content);
+void Map::transformLiquidsParallel(u32 count, LiquidTransformState &state)
+{
+	/*
+		A node only reads its direct neighbors and only changes itself, so
+		nodes in mapblocks that don't touch each other can be transformed at
+		the same time. The blocks are done in 8 passes by the parity of their
+		coordinates, which keeps the blocks of a pass apart.
+		Everything a block produces is merged in block order afterwards, so
+		the result doesn't depend on the number of threads.
+	*/
+	std::map<v3s16, std::vector<v3s16>> nodes_by_block;
+	for (u32 i = 0; i < count && m_transforming_liquid.size() != 0; i++) {
+		v3s16 p = m_transforming_liquid.front();
+		m_transforming_liquid.pop_front();
+		nodes_by_block[getNodeBlockPos(p)].push_back(p);
+	}
 
-		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
+	struct LiquidRegion {
+		LiquidRegion(Map *map, ServerEnvironment *env) :
+			state(map, env, modified_blocks)
+		{
+			state.queued = &queued;
+			state.defer_callbacks = true;
 		}
 
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
-		n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
+		const std::vector<v3s16> *nodes;
+		std::map<v3s16, MapBlock*> modified_blocks;
+		std::vector<v3s16> queued;
+		LiquidTransformState state;
+	};
 
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			changed_nodes.emplace_back(p0, n00);
-		}
+	std::vector<std::unique_ptr<LiquidRegion>> regions;
+	std::vector<size_t> passes[8];
+	regions.reserve(nodes_by_block.size());
+	for (const auto &it : nodes_by_block) {
+		const v3s16 &bp = it.first;
+		passes[(bp.X & 1) | (bp.Y & 1) << 1 | (bp.Z & 1) << 2].push_back(regions.size());
+		regions.emplace_back(new LiquidRegion(this, state.env));
+		regions.back()->nodes = &it.second;
+	}
+
+	for (const std::vector<size_t> &pass : passes) {
+		m_liquid_workers->run(pass.size(), [&] (size_t i, unsigned int worker) {
+			LiquidRegion &region = *regions[pass[i]];
+			for (v3s16 p : *region.nodes)
+				transformLiquidNode(p, region.state);
+		});
+	}
+
+	std::vector<v3s16> deferred;
+	for (const auto &region : regions) {
+		for (v3s16 p : region->queued)
+			m_transforming_liquid.push_back(p);
+		state.must_reflow.insert(state.must_reflow.end(),
+				region->state.must_reflow.begin(), region->state.must_reflow.end());
+		state.changed_nodes.insert(state.changed_nodes.end(),
+				region->state.changed_nodes.begin(), region->state.changed_nodes.end());
+		state.modified_blocks.insert(region->modified_blocks.begin(),
+				region->modified_blocks.end());
+		deferred.insert(deferred.end(),
+				region->state.deferred.begin(), region->state.deferred.end());
+	}
+
+	// Nodes with on_flood() callbacks, now on this thread
+	for (v3s16 p : deferred)
+		transformLiquidNode(p, state);
+
+	g_profiler->avg("Map::transformLiquids(): regions [#]", regions.size());
+}
 
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
+void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
+		ServerEnvironment *env)
+{
+	u32 loopcount = 0;
+	u32 initial_size = m_transforming_liquid.size();
+
+	/*if(initial_size != 0)
+		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
+
+	LiquidTransformState state(this, env, modified_blocks);
+
+	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
+	u32 loop_max = liquid_loop_max;
+
+#if 0
+
+	/* If liquid_loop_max is not keeping up with the queue size increase
+	 * loop_max up to a maximum of liquid_loop_max * dedicated_server_step.
+	 */
+	if (m_transforming_liquid.size() > loop_max * 2) {
+		// "Burst" mode
+		float server_step = g_settings->getFloat("dedicated_server_step");
+		if (m_transforming_liquid_loop_count_multiplier - 1.0 < server_step)
+			m_transforming_liquid_loop_count_multiplier *= 1.0 + server_step / 10;
+	} else {
+		m_transforming_liquid_loop_count_multiplier = 1.0;
+	}
+
+	loop_max *= m_transforming_liquid_loop_count_multiplier;
+#endif
+
+	// The rollback manager is not thread-safe
+	if (m_liquid_workers && !m_gamedef->rollback()) {
+		transformLiquidsParallel(std::min(initial_size, loop_max), state);
+	} else {
+		while (m_transforming_liquid.size() != 0)
+		{
+			// This should be done here so that it is done when continue is used
+			if (loopcount >= initial_size || loopcount >= loop_max)
 				break;
+			loopcount++;
+
+			/*
+				Get a queued transforming liquid node
+			*/
+			v3s16 p0 = m_transforming_liquid.front();
+			m_transforming_liquid.pop_front();
+
+			transformLiquidNode(p0, state);
 		}
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
-	for (auto &iter : must_reflow)
+	for (auto &iter : state.must_reflow)
 		m_transforming_liquid.push_back(iter);
 
-	voxalgo::update_lighting_nodes(this, changed_nodes, modified_blocks);
+	voxalgo::update_lighting_nodes(this, state.changed_nodes, modified_blocks);
 
 
 	/* ----------------------------------------------------------------------
@@ -973,6 +1129,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->invalidateNetworkCache();
 	return true;
 }
 
@@ -988,6 +1145,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->invalidateNetworkCache();
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -1198,6 +1356,9 @@ bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
 /*
 	ServerMap
 */
+// Bounds the number of prefetched blocks waiting to be loaded
+#define MAP_PREFETCH_MAX 1024
+
 ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 		EmergeManager *emerge, MetricsBackend *mb):
 	Map(gamedef),
@@ -1209,6 +1370,9 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	// Tell the EmergeManager about our MapSettingsManager
 	emerge->map_settings_mgr = &settings_mgr;
 
+	setLiquidThreads(resolve_thread_count("num_liquid_threads"));
+	setLightingThreads(resolve_thread_count("num_lighting_threads"));
+
 	/*
 		Try to load map; if not found, create a new one.
 	*/
@@ -1229,10 +1393,31 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	}
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
+	m_saver.reset(new MapSaver(dbase, m_db_mutex));
 
 	m_savedir = savedir;
 	m_map_saving_enabled = false;
 
+	m_save_ser_ver = SER_FMT_VER_HIGHEST_WRITE;
+	if (g_settings->get("map_compression") == "zstd") {
+#if USE_ZSTD
+		m_save_ser_ver = SER_FMT_VER_ZSTD;
+#else
+		warningstream << "ServerMap: Built without zstd support, "
+				"saving the map with zlib" << std::endl;
+#endif
+	}
+
+	// Blocks saved with a dictionary can't be loaded without it,
+	// so it is always read from the world
+	std::string dict;
+	if (fs::ReadFile(savedir + DIR_DELIM + "zstd_dictionary", dict) &&
+			!dict.empty())
+		infostream << "ServerMap: Using the zstd dictionary of the world"
+				<< std::endl;
+	if (!setZstdDictionary(dict))
+		throw SerializationError("ServerMap: Could not load zstd_dictionary");
+
 	m_save_time_counter = mb->addCounter("minetest_core_map_save_time", "Map save time (in nanoseconds)");
 
 	try {
@@ -1295,6 +1480,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Finish writing before the database is closed
+	m_saver.reset();
+
 	/*
 		Close database if it was opened
 	*/
@@ -1744,15 +1932,22 @@ void ServerMap::save(ModifiedState save_level)
 			m_map_metadata_changed = false;
 	}
 
+	// The snapshots of these were lost, write the blocks again. They are
+	// kept in memory until then, unless deleted on purpose.
+	std::vector<v3s16> failed;
+	m_saver->takeFailed(failed);
+	for (v3s16 p : failed) {
+		MapBlock *block = getBlockNoCreateNoEx(p);
+		if (block)
+			block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_UNKNOWN);
+	}
+
 	// Profile modified reasons
 	Profiler modprofiler;
 
 	u32 block_count = 0;
 	u32 block_count_all = 0; // Number of blocks in memory
 
-	// Don't do anything with sqlite unless something is really saved
-	bool save_started = false;
-
 	for (auto &sector_it : m_sectors) {
 		MapSector *sector = sector_it.second;
 
@@ -1763,12 +1958,6 @@ void ServerMap::save(ModifiedState save_level)
 			block_count_all++;
 
 			if(block->getModified() >= (u32)save_level) {
-				// Lazy beginSave()
-				if(!save_started) {
-					beginSave();
-					save_started = true;
-				}
-
 				modprofiler.add(block->getModifiedReasonString(), 1);
 
 				saveBlock(block);
@@ -1777,15 +1966,12 @@ void ServerMap::save(ModifiedState save_level)
 		}
 	}
 
-	if(save_started)
-		endSave();
-
 	/*
 		Only print if something happened or saved whole map
 	*/
 	if(save_level == MOD_STATE_CLEAN
 			|| block_count != 0) {
-		infostream << "ServerMap: Written: "
+		infostream << "ServerMap: Queued for writing: "
 				<< block_count << " blocks"
 				<< ", " << block_count_all << " blocks in memory."
 				<< std::endl;
@@ -1800,7 +1986,11 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
-	dbase->listAllLoadableBlocks(dst);
+	m_saver->flush();
+	{
+		MutexAutoLock lock(m_db_mutex);
+		dbase->listAllLoadableBlocks(dst);
+	}
 	if (dbase_ro)
 		dbase_ro->listAllLoadableBlocks(dst);
 }
@@ -1827,6 +2017,8 @@ MapDatabase *ServerMap::createDatabase(
 {
 	if (name == "sqlite3")
 		return new MapDatabaseSQLite3(savedir);
+	if (name == "sqlite3_morton")
+		return new MapDatabaseSQLite3(savedir, true);
 	if (name == "dummy")
 		return new Database_Dummy();
 	#if USE_LEVELDB
@@ -1848,22 +2040,32 @@ MapDatabase *ServerMap::createDatabase(
 	throw BaseException(std::string("Database backend ") + name + " not supported.");
 }
 
-void ServerMap::beginSave()
+bool ServerMap::saveBlock(MapBlock *block)
 {
-	dbase->beginSave();
-}
+	// Dummy blocks are not written
+	if (block->isDummy()) {
+		warningstream << "saveBlock: Not writing dummy block "
+			<< PP(block->getPos()) << std::endl;
+		return true;
+	}
 
-void ServerMap::endSave()
-{
-	dbase->endSave();
+	m_prefetched.erase(block->getPos());
+
+	std::unique_ptr<MapBlockSnapshot> snapshot(new MapBlockSnapshot());
+	block->takeSnapshot(*snapshot, m_save_ser_ver, true);
+	m_saver->push(std::move(snapshot));
+
+	// The snapshot has it, so clear modified flag
+	block->resetModified();
+	return true;
 }
 
-bool ServerMap::saveBlock(MapBlock *block)
+bool ServerMap::isBlockSaving(v3s16 blockpos)
 {
-	return saveBlock(block, dbase);
+	return m_saver->isPending(blockpos);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, u8 version)
 {
 	v3s16 p3d = block->getPos();
 
@@ -1874,9 +2076,6 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
 		return true;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
-
 	/*
 		[0] u8 serialization version
 		[1] data
@@ -1961,7 +2160,15 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
+	auto prefetched = m_prefetched.find(blockpos);
+	if (prefetched != m_prefetched.end()) {
+		ret = std::move(prefetched->second);
+		m_prefetched.erase(prefetched);
+	} else {
+		m_saver->waitForBlock(blockpos);
+		MutexAutoLock lock(m_db_mutex);
+		dbase->loadBlock(blockpos, &ret);
+	}
 	if (!ret.empty()) {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 	} else if (dbase_ro) {
@@ -1992,10 +2199,44 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	return block;
 }
 
+void ServerMap::prefetchBlocks(const std::vector<v3s16> &positions)
+{
+	std::vector<v3s16> wanted;
+	for (const v3s16 &p : positions) {
+		MapBlock *block = getBlockNoCreateNoEx(p);
+		if ((block && !block->isDummy()) || isBlockPrefetched(p))
+			continue;
+		wanted.push_back(p);
+	}
+	// Nothing to gain
+	if (wanted.size() < 2)
+		return;
+
+	// Entries of blocks that were never loaded would pile up otherwise
+	if (m_prefetched.size() + wanted.size() > MAP_PREFETCH_MAX)
+		m_prefetched.clear();
+
+	for (const v3s16 &p : wanted)
+		m_saver->waitForBlock(p);
+
+	std::vector<std::string> blocks;
+	{
+		MutexAutoLock lock(m_db_mutex);
+		dbase->loadBlocks(wanted, &blocks);
+	}
+	for (size_t i = 0; i < wanted.size(); i++)
+		m_prefetched[wanted[i]] = std::move(blocks[i]);
+}
+
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	m_prefetched.erase(blockpos);
+	m_saver->waitForBlock(blockpos);
+	{
+		MutexAutoLock lock(m_db_mutex);
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
@@ -24,9 +24,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <memory>
+#include <mutex>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
+#include "mapblockindex.h"
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
@@ -34,10 +37,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/metricsbackend.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "serialization.h"
 #include "debug.h"
 
 class Settings;
 class MapDatabase;
+class MapSaver;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -112,6 +117,9 @@ struct MapEditEvent
 	}
 };
 
+struct LiquidTransformState;
+class WorkerPool;
+
 class MapEventReceiver
 {
 public:
@@ -207,6 +215,9 @@ class Map /*: public NodeContainer*/
 	// Client leaves them as no-op.
 	virtual bool saveBlock(MapBlock *block) { return false; }
 	virtual bool deleteBlock(v3s16 blockpos) { return false; }
+	// Whether a save of the block is not written yet or failed, the block
+	// is then kept in memory
+	virtual bool isBlockSaving(v3s16 blockpos) { return false; }
 
 	/*
 		Updates usage timers and unloads unused blocks and sectors.
@@ -232,6 +243,17 @@ class Map /*: public NodeContainer*/
 	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
 			ServerEnvironment *env);
 
+	// Number of threads transforming liquids, including the calling one.
+	// With more than one, the queued nodes are processed by mapblock and
+	// blocks that don't touch each other are transformed in parallel.
+	void setLiquidThreads(s16 num_threads);
+
+	// Number of threads spreading light, including the calling one.
+	// With more than one, large light updates are spread by mapblock.
+	void setLightingThreads(s16 num_threads);
+	// Only to be used while the map is locked, like the map itself
+	WorkerPool *getLightingWorkers() { return m_lighting_workers.get(); }
+
 	/*
 		Node metadata
 		These are basically coordinate wrappers to MapBlock
@@ -275,6 +297,7 @@ class Map /*: public NodeContainer*/
 	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes);
 protected:
 	friend class LuaVoxelManip;
+	friend class MapSector;
 
 	IGameDef *m_gamedef;
 
@@ -286,6 +309,9 @@ class Map /*: public NodeContainer*/
 	MapSector *m_sector_cache = nullptr;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of m_sectors by position, kept up to date by MapSector
+	MapBlockIndex m_block_index;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
 
@@ -299,6 +325,12 @@ class Map /*: public NodeContainer*/
 		u32 needed_count);
 
 private:
+	void transformLiquidNode(v3s16 p0, LiquidTransformState &state);
+	void transformLiquidsParallel(u32 count, LiquidTransformState &state);
+
+	std::unique_ptr<WorkerPool> m_liquid_workers;
+	std::unique_ptr<WorkerPool> m_lighting_workers;
+
 	f32 m_transforming_liquid_loop_count_multiplier = 1.0f;
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
@@ -370,18 +402,21 @@ class ServerMap : public Map
 	*/
 	static MapDatabase *createDatabase(const std::string &name, const std::string &savedir, Settings &conf);
 
-	// Call these before and after saving of blocks
-	void beginSave();
-	void endSave();
-
 	void save(ModifiedState save_level);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	void listAllLoadedBlocks(std::vector<v3s16> &dst);
 
 	MapgenParams *getMapgenParams();
 
+	// Queues the block for saving on the map saving thread
 	bool saveBlock(MapBlock *block);
-	static bool saveBlock(MapBlock *block, MapDatabase *db);
+	static bool saveBlock(MapBlock *block, MapDatabase *db,
+			u8 version = SER_FMT_VER_HIGHEST_WRITE);
+	bool isBlockSaving(v3s16 blockpos);
+	// Reads the data of many blocks from the database at once, to be used
+	// by the following loadBlock() calls for them.
+	void prefetchBlocks(const std::vector<v3s16> &positions);
+	bool isBlockPrefetched(v3s16 p) const { return m_prefetched.count(p) != 0; }
 	MapBlock* loadBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
@@ -415,6 +450,8 @@ class ServerMap : public Map
 
 	std::string m_savedir;
 	bool m_map_saving_enabled;
+	// Serialization version used for saving blocks
+	u8 m_save_ser_ver;
 
 #if 0
 	// Chunk size in MapSectors
@@ -431,6 +468,12 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+	// Held for every access to dbase, which is shared with m_saver
+	std::mutex m_db_mutex;
+	std::unique_ptr<MapSaver> m_saver;
+	// Block data from prefetchBlocks(), empty if not in dbase.
+	// Entries are dropped when the block is saved or deleted.
+	std::map<v3s16, std::string> m_prefetched;
 
 	MetricCounterPtr m_save_time_counter;
 };
@@ -0,0 +1,177 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "map_saver.h"
+#include <sstream>
+#include "database/database.h"
+#include "mapblock.h"
+#include "threading/thread.h"
+#include "threading/mutex_auto_lock.h"
+#include "log.h"
+#include "debug.h"
+
+// Bounds the memory used by queued snapshots (~20 KiB each)
+#define MAP_SAVE_QUEUE_LIMIT 1024
+// Blocks written per database transaction
+#define MAP_SAVE_BATCH_SIZE 256
+
+class MapSaver::SaveThread : public Thread
+{
+public:
+	SaveThread(MapSaver *saver) :
+		Thread("MapSave"),
+		m_saver(saver)
+	{
+	}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (m_saver->saveBatch())
+			;
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	MapSaver *m_saver;
+};
+
+MapSaver::MapSaver(MapDatabase *db, std::mutex &db_mutex) :
+	m_db(db),
+	m_db_mutex(db_mutex),
+	m_thread(new SaveThread(this))
+{
+	if (!m_thread->start())
+		throw BaseException("MapSaver: failed to start thread");
+}
+
+MapSaver::~MapSaver()
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		m_stop = true;
+	}
+	m_queue_cv.notify_all();
+	m_thread->wait();
+	delete m_thread;
+}
+
+void MapSaver::push(std::unique_ptr<MapBlockSnapshot> snapshot)
+{
+	MutexAutoLock lock(m_mutex);
+	m_written_cv.wait(lock, [this] {
+		return m_queue.size() < MAP_SAVE_QUEUE_LIMIT;
+	});
+
+	m_pending[snapshot->pos]++;
+	m_queue.push_back(std::move(snapshot));
+	m_queue_cv.notify_one();
+}
+
+void MapSaver::waitForBlock(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	m_written_cv.wait(lock, [this, pos] {
+		return m_pending.find(pos) == m_pending.end();
+	});
+}
+
+void MapSaver::flush()
+{
+	MutexAutoLock lock(m_mutex);
+	m_written_cv.wait(lock, [this] { return m_pending.empty(); });
+}
+
+bool MapSaver::isPending(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	return m_pending.find(pos) != m_pending.end() ||
+		m_failed.find(pos) != m_failed.end();
+}
+
+void MapSaver::takeFailed(std::vector<v3s16> &dst)
+{
+	MutexAutoLock lock(m_mutex);
+	dst.insert(dst.end(), m_failed.begin(), m_failed.end());
+	m_failed.clear();
+}
+
+bool MapSaver::saveBatch()
+{
+	std::vector<std::unique_ptr<MapBlockSnapshot>> batch;
+	{
+		MutexAutoLock lock(m_mutex);
+		m_queue_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		// Stopping still writes what is queued
+		if (m_queue.empty())
+			return false;
+		while (!m_queue.empty() && batch.size() < MAP_SAVE_BATCH_SIZE) {
+			batch.push_back(std::move(m_queue.front()));
+			m_queue.pop_front();
+		}
+	}
+
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	std::vector<std::string> blobs(batch.size());
+	std::vector<v3s16> failed;
+	for (size_t i = 0; i < batch.size(); i++) {
+		try {
+			std::ostringstream os(std::ios_base::binary);
+			os.write((const char *)&batch[i]->version, 1);
+			MapBlock::serializeSnapshot(*batch[i], os);
+			blobs[i] = os.str();
+		} catch (SerializationError &e) {
+			errorstream << "MapSaver: Failed to serialize block "
+				<< PP(batch[i]->pos) << ": " << e.what() << std::endl;
+			failed.push_back(batch[i]->pos);
+		}
+	}
+
+	{
+		MutexAutoLock lock(m_db_mutex);
+		m_db->beginSave();
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (!blobs[i].empty() && !m_db->saveBlock(batch[i]->pos, blobs[i])) {
+				errorstream << "MapSaver: Failed to save block "
+					<< PP(batch[i]->pos) << std::endl;
+				failed.push_back(batch[i]->pos);
+			}
+		}
+		m_db->endSave();
+	}
+
+	{
+		MutexAutoLock lock(m_mutex);
+		m_failed.insert(failed.begin(), failed.end());
+		for (const auto &snapshot : batch) {
+			auto it = m_pending.find(snapshot->pos);
+			if (--it->second == 0)
+				m_pending.erase(it);
+		}
+	}
+	m_written_cv.notify_all();
+	return true;
+}
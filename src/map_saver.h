@@ -0,0 +1,86 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "irr_v3d.h"
+#include "util/basic_macros.h"
+
+class MapDatabase;
+struct MapBlockSnapshot;
+
+/*
+	Compresses and writes block snapshots to the map database on its own
+	thread, so that saving doesn't stall the server step.
+
+	All other access to the database must hold the database mutex, and
+	must call waitForBlock() first so that it never reads data that is
+	still queued.
+*/
+class MapSaver
+{
+public:
+	MapSaver(MapDatabase *db, std::mutex &db_mutex);
+	// Writes everything that is still queued
+	~MapSaver();
+	DISABLE_CLASS_COPY(MapSaver)
+
+	// Queues a block for writing. Waits while too many blocks are queued.
+	void push(std::unique_ptr<MapBlockSnapshot> snapshot);
+
+	// Waits until the block is written, if it is queued
+	void waitForBlock(v3s16 pos);
+
+	// Waits until everything queued so far is written
+	void flush();
+
+	// Whether the block is queued, being written, or failed to be written
+	// and not taken yet
+	bool isPending(v3s16 pos);
+
+	// Moves the positions of blocks that failed to be written into dst
+	void takeFailed(std::vector<v3s16> &dst);
+
+private:
+	class SaveThread;
+
+	// Returns false once stopped and everything is written
+	bool saveBatch();
+
+	MapDatabase *m_db;
+	std::mutex &m_db_mutex;
+	SaveThread *m_thread;
+
+	std::mutex m_mutex;
+	// Signaled when blocks are queued or written
+	std::condition_variable m_queue_cv;
+	std::condition_variable m_written_cv;
+	std::deque<std::unique_ptr<MapBlockSnapshot>> m_queue;
+	// Number of queued or being written snapshots per position
+	std::map<v3s16, u32> m_pending;
+	std::set<v3s16> m_failed;
+	bool m_stop = false;
+};
@@ -66,12 +66,15 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+std::atomic<u64> MapBlock::s_last_block_id(0);
+
 MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_parent(parent),
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
 		m_gamedef(gamedef)
 {
+	newChangeId();
 	if (!dummy)
 		reallocate();
 }
@@ -152,6 +155,36 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	updateContents();
+}
+
+void MapBlock::updateContents()
+{
+	contents.clear();
+	contents_cached = false;
+	contents_may_be_stale = false;
+	do_not_cache_contents = false;
+	if (!data)
+		return;
+
+	// Blocks mostly consist of long runs of the same content
+	content_t prev = data[0].getContent();
+	contents.insert(prev);
+	for (u32 i = 1; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c == prev)
+			continue;
+		prev = c;
+		contents.insert(c);
+		if (contents.size() > max_cached_contents) {
+			// Too many different nodes... don't try to cache
+			do_not_cache_contents = true;
+			contents.clear();
+			return;
+		}
+	}
+	contents_cached = true;
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -252,7 +285,8 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 // sure we can handle all content ids. But it's absolutely worth it as it's
 // a speedup of 4 for one of the major time consuming functions on storing
 // mapblocks.
-static content_t getBlockNodeIdMapping_mapping[USHRT_MAX + 1];
+// Per thread, as blocks are serialized by the map saving thread too
+static thread_local content_t getBlockNodeIdMapping_mapping[USHRT_MAX + 1];
 static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 	const NodeDefManager *nodedef)
 {
@@ -356,6 +390,13 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 }
 
 void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
+{
+	MapBlockSnapshot snapshot;
+	takeSnapshot(snapshot, version, disk);
+	serializeSnapshot(snapshot, os);
+}
+
+void MapBlock::takeSnapshot(MapBlockSnapshot &snapshot, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -365,7 +406,10 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
-	// First byte
+	snapshot.pos = getPos();
+	snapshot.version = version;
+	snapshot.disk = disk;
+
 	u8 flags = 0;
 	if(is_underground)
 		flags |= 0x01;
@@ -373,46 +417,58 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 		flags |= 0x02;
 	if (!m_generated)
 		flags |= 0x08;
-	writeU8(os, flags);
+	snapshot.flags = flags;
+	snapshot.lighting_complete = m_lighting_complete;
+
+	snapshot.data.reset(new MapNode[nodecount]);
+	std::copy(data, data + nodecount, snapshot.data.get());
+
+	std::ostringstream oss(std::ios_base::binary);
+	m_node_metadata.serialize(oss, version, disk);
+	snapshot.node_metadata = oss.str();
+
+	if (disk) {
+		getBlockNodeIdMapping(&snapshot.nimap, snapshot.data.get(),
+				m_gamedef->ndef());
+
+		std::ostringstream oss_objects(std::ios_base::binary);
+		m_static_objects.serialize(oss_objects);
+		snapshot.static_objects = oss_objects.str();
+
+		std::ostringstream oss_timers(std::ios_base::binary);
+		m_node_timers.serialize(oss_timers, version);
+		snapshot.node_timers = oss_timers.str();
+
+		snapshot.timestamp = getTimestamp();
+	}
+}
+
+void MapBlock::serializeSnapshot(const MapBlockSnapshot &snapshot,
+		std::ostream &os)
+{
+	u8 version = snapshot.version;
+	bool disk = snapshot.disk;
+
+	// First byte
+	writeU8(os, snapshot.flags);
 	if (version >= 27) {
-		writeU16(os, m_lighting_complete);
+		writeU16(os, snapshot.lighting_complete);
 	}
 
 	/*
 		Bulk node data
 	*/
-	NameIdMapping nimap;
-	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
-	}
-	else
-	{
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
-	}
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, version, snapshot.data.get(), nodecount,
+			content_width, params_width, true, disk);
 
 	/*
 		Node metadata
 	*/
-	std::ostringstream oss(std::ios_base::binary);
-	m_node_metadata.serialize(oss, version, disk);
-	compressZlib(oss.str(), os);
+	compress(snapshot.node_metadata, os, version, disk);
 
 	/*
 		Data that goes to disk, but not the network
@@ -421,21 +477,21 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	{
 		if(version <= 24){
 			// Node timers
-			m_node_timers.serialize(os, version);
+			os << snapshot.node_timers;
 		}
 
 		// Static objects
-		m_static_objects.serialize(os);
+		os << snapshot.static_objects;
 
 		// Timestamp
-		writeU32(os, getTimestamp());
+		writeU32(os, snapshot.timestamp);
 
 		// Write block-specific node definition id mapping
-		nimap.serialize(os);
+		snapshot.nimap.serialize(os);
 
 		if(version >= 25){
 			// Node timers
-			m_node_timers.serialize(os, version);
+			os << snapshot.node_timers;
 		}
 	}
 }
@@ -449,6 +505,19 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
+const std::string &MapBlock::serializeNetwork(u8 version)
+{
+	if (m_network_cache.empty() || m_network_cache_version != version) {
+		std::ostringstream os(std::ios_base::binary);
+		serialize(os, version, false);
+		serializeNetworkSpecific(os);
+		m_network_cache = os.str();
+		m_network_cache_version = version;
+	}
+	m_network_cache_timer = 0;
+	return m_network_cache;
+}
+
 void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
@@ -456,11 +525,14 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
+	invalidateNetworkCache();
+	newChangeId();
 	m_day_night_differs_expired = false;
 
 	if(version <= 21)
 	{
 		deSerialize_pre22(is, version, disk);
+		updateContents();
 		return;
 	}
 
@@ -485,7 +557,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	if(params_width != 2)
 		throw SerializationError("MapBlock::deSerialize(): invalid params_width");
 	MapNode::deSerializeBulk(is, version, data, nodecount,
-			content_width, params_width, true);
+			content_width, params_width, true, disk);
 
 	/*
 		NodeMetadata
@@ -495,7 +567,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompress(is, oss, version, disk);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -550,6 +622,8 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	updateContents();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -19,7 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
 #include <set>
+#include <memory>
 #include "irr_v3d.h"
 #include "mapnode.h"
 #include "exceptions.h"
@@ -28,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "nodetimer.h"
 #include "modifiedstate.h"
+#include "nameidmapping.h"
 #include "util/numeric.h" // getContainerPos
 #include "settings.h"
 #include "mapgen/mapgen.h"
@@ -40,6 +43,9 @@ class VoxelManipulator;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+// Seconds the result of MapBlock::serializeNetwork() is kept without use
+#define BLOCK_NETWORK_CACHE_TIMEOUT 10.0f
+
 ////
 //// MapBlock modified reason flags
 ////
@@ -66,6 +72,56 @@ class VoxelManipulator;
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+////
+//// MapBlock serialization snapshot
+////
+
+/*
+	Everything MapBlock::serialize() writes, copied from the block.
+	Taking a snapshot is cheap; the expensive part of the serialization
+	(compression) can then run on another thread while the block keeps
+	changing.
+*/
+struct MapBlockSnapshot
+{
+	v3s16 pos;
+	u8 version;
+	bool disk;
+	u8 flags;
+	u16 lighting_complete;
+	// For disk, the content ids are those of nimap
+	std::unique_ptr<MapNode[]> data;
+	// Uncompressed
+	std::string node_metadata;
+
+	// Only for disk
+	NameIdMapping nimap;
+	std::string static_objects;
+	std::string node_timers;
+	u32 timestamp;
+};
+
+////
+//// MapBlock change id
+////
+
+// Tells whether the data of a block changed, see MapBlock::getChangeId()
+struct MapBlockChangeId
+{
+	u64 block_id = 0; // Unique per loaded block, 0 for none
+	u32 count = 0; // Modifications since the block was loaded
+
+	bool operator==(const MapBlockChangeId &other) const
+	{
+		return block_id == other.block_id && count == other.count;
+	}
+
+	bool operator!=(const MapBlockChangeId &other) const
+	{
+		return !(*this == other);
+	}
+};
+
 ////
 //// MapBlock itself
 ////
@@ -93,6 +149,7 @@ class MapBlock
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
 
+		updateContents();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -106,6 +163,12 @@ class MapBlock
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		// Anything that needs a write also changes what clients see
+		if (mod >= MOD_STATE_WRITE_NEEDED) {
+			invalidateNetworkCache();
+			m_change_id.count++;
+		}
+
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -114,8 +177,6 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents_cached = false;
 	}
 
 	inline u32 getModified()
@@ -136,6 +197,13 @@ class MapBlock
 		m_modified_reason = 0;
 	}
 
+	// Changes whenever the block data may have changed. No two blocks
+	// share a change id, so it also tells a reloaded block apart.
+	inline MapBlockChangeId getChangeId() const
+	{
+		return m_change_id;
+	}
+
 	////
 	//// Flags
 	////
@@ -280,6 +348,7 @@ class MapBlock
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -328,6 +397,7 @@ class MapBlock
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -356,6 +426,10 @@ class MapBlock
 	// Copies data from VoxelManipulator getPosRelative()
 	void copyFrom(VoxelManipulator &dst);
 
+	// Rebuilds the content type cache from the node data.
+	// Called after bulk changes, setNode() keeps it up to date otherwise.
+	void updateContents();
+
 	// Update day-night lighting difference flag.
 	// Sets m_day_night_differs to appropriate value.
 	// These methods don't care about neighboring blocks.
@@ -425,6 +499,14 @@ class MapBlock
 	inline void incrementUsageTimer(float dtime)
 	{
 		m_usage_timer += dtime;
+
+		// Clients near each other ask for the block at about the same
+		// time, later the copy only takes up memory
+		if (!m_network_cache.empty()) {
+			m_network_cache_timer += dtime;
+			if (m_network_cache_timer > BLOCK_NETWORK_CACHE_TIMEOUT)
+				invalidateNetworkCache();
+		}
 	}
 
 	inline float getUsageTimer()
@@ -483,12 +565,28 @@ class MapBlock
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &os, u8 version, bool disk);
+	// Same as serialize(), split in two parts. Only the first one
+	// accesses the block or the node definitions.
+	void takeSnapshot(MapBlockSnapshot &snapshot, u8 version, bool disk);
+	static void serializeSnapshot(const MapBlockSnapshot &snapshot,
+			std::ostream &os);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
+
+	// serialize() and serializeNetworkSpecific() for sending to clients.
+	// The result is shared by all clients using the same version and is
+	// kept until the block is modified or it hasn't been used for
+	// BLOCK_NETWORK_CACHE_TIMEOUT.
+	const std::string &serializeNetwork(u8 version);
+	inline void invalidateNetworkCache()
+	{
+		// Give the memory back, clear() keeps it
+		std::string().swap(m_network_cache);
+	}
 private:
 	/*
 		Private methods
@@ -513,6 +611,18 @@ class MapBlock
 		return getNodeRef(p.X, p.Y, p.Z);
 	}
 
+	inline void addContent(content_t c)
+	{
+		if (!contents_cached)
+			return;
+		contents_may_be_stale = true;
+		contents.insert(c);
+		if (contents.size() > max_cached_contents) {
+			contents_cached = false;
+			contents.clear();
+		}
+	}
+
 public:
 	/*
 		Public member variables
@@ -520,6 +630,12 @@ class MapBlock
 
 #ifndef SERVER // Only on client
 	MapBlockMesh *mesh = nullptr;
+	// Level of detail of the last queued mesh update, see
+	// ClientMap::getMeshLod()
+	u8 mesh_lod = 1;
+	// Which faces of the block see each other, see MapBlockFaceConnectivity.
+	// All of them until the block has been meshed.
+	u64 face_connectivity = ~(u64)0;
 #endif
 
 	NodeMetadataList m_node_metadata;
@@ -532,13 +648,20 @@ class MapBlock
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
 	//// ABM optimizations ////
-	// Cache of content types
+	// Cache of content types. May contain types that have since been
+	// replaced, but never misses one that is present.
 	std::unordered_set<content_t> contents;
 	// True if content types are cached
 	bool contents_cached = false;
-	// True if we never want to cache content types for this block
+	// True if nodes were replaced since the last updateContents()
+	bool contents_may_be_stale = false;
+	// True if the block had too many content types to cache them
+	// at the last call of updateContents()
 	bool do_not_cache_contents = false;
 
+	// Blocks with more content types than this are not cached
+	static const u32 max_cached_contents = 64;
+
 private:
 	/*
 		Private member variables
@@ -607,6 +730,23 @@ class MapBlock
 	// The on-disk (or to-be on-disk) timestamp value
 	u32 m_disk_timestamp = BLOCK_TIMESTAMP_UNDEFINED;
 
+	// Cached result of serializeNetwork(), empty if invalid
+	std::string m_network_cache;
+	u8 m_network_cache_version = 0;
+	// Seconds since m_network_cache was last used
+	float m_network_cache_timer = 0;
+
+	// Only taken from the shared counter when the whole data is replaced,
+	// modifications just count up
+	inline void newChangeId()
+	{
+		m_change_id.block_id = ++s_last_block_id;
+		m_change_id.count = 0;
+	}
+
+	static std::atomic<u64> s_last_block_id;
+	MapBlockChangeId m_change_id;
+
 	/*
 		When the block is accessed, this is set to 0.
 		Map will unload the block when this reaches a timeout.
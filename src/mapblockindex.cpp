@@ -0,0 +1,106 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblockindex.h"
+#include "mapblock.h"
+
+// 2^MIN_SIZE_LOG2 slots when empty
+#define MIN_SIZE_LOG2 10
+
+MapBlockIndex::MapBlockIndex()
+{
+	rehash(MIN_SIZE_LOG2);
+}
+
+void MapBlockIndex::insert(MapBlock *block)
+{
+	assert(block);
+	v3s16 p = block->getPos();
+
+	// Keep the load factor at most 1/2
+	if ((m_count + 1) * 2 > m_slots.size())
+		rehash(64 - m_shift + 1);
+
+	u32 i = slotOf(p);
+	while (m_slots[i].block) {
+		if (m_slots[i].pos == p) {
+			m_slots[i].block = block;
+			return;
+		}
+		i = (i + 1) & m_mask;
+	}
+	m_slots[i].pos = p;
+	m_slots[i].block = block;
+	m_count++;
+}
+
+void MapBlockIndex::erase(v3s16 p)
+{
+	u32 i = slotOf(p);
+	while (m_slots[i].block && m_slots[i].pos != p)
+		i = (i + 1) & m_mask;
+	if (!m_slots[i].block)
+		return;
+
+	// Move back the following entries of the probe run that would not be
+	// found anymore with the hole, so that no tombstones are needed
+	u32 hole = i;
+	for (u32 j = (i + 1) & m_mask; m_slots[j].block; j = (j + 1) & m_mask) {
+		u32 home = slotOf(m_slots[j].pos);
+		// Can the entry at j be moved to the hole? Yes unless its home slot
+		// lies cyclically in (hole, j].
+		bool keep = hole <= j ? (hole < home && home <= j) :
+				(hole < home || home <= j);
+		if (keep)
+			continue;
+		m_slots[hole] = m_slots[j];
+		hole = j;
+	}
+	m_slots[hole] = Slot();
+	m_count--;
+
+	// Shrink after mass unloading, with some hysteresis
+	u32 size_log2 = 64 - m_shift;
+	if (size_log2 > MIN_SIZE_LOG2 && m_count * 8 < m_slots.size())
+		rehash(size_log2 - 1);
+}
+
+void MapBlockIndex::clear()
+{
+	m_slots.clear();
+	m_count = 0;
+	rehash(MIN_SIZE_LOG2);
+}
+
+void MapBlockIndex::rehash(u32 new_size_log2)
+{
+	std::vector<Slot> old_slots(1U << new_size_log2);
+	old_slots.swap(m_slots);
+	m_mask = (1U << new_size_log2) - 1;
+	m_shift = 64 - new_size_log2;
+
+	for (const Slot &slot : old_slots) {
+		if (!slot.block)
+			continue;
+		u32 i = slotOf(slot.pos);
+		while (m_slots[i].block)
+			i = (i + 1) & m_mask;
+		m_slots[i] = slot;
+	}
+}
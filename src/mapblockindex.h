@@ -0,0 +1,78 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+
+class MapBlock;
+
+/*
+	Flat position -> MapBlock lookup table of a Map.
+
+	Open addressing with linear probing, so that a lookup is one hash and
+	usually a single cache line, instead of going through the sector map
+	and the block map of the sector. The MapSectors still own the blocks,
+	this only indexes them.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+
+	MapBlock *get(v3s16 p) const
+	{
+		u32 i = slotOf(p);
+		while (m_slots[i].block) {
+			if (m_slots[i].pos == p)
+				return m_slots[i].block;
+			i = (i + 1) & m_mask;
+		}
+		return nullptr;
+	}
+
+	// Replaces the block at the same position, if any
+	void insert(MapBlock *block);
+	void erase(v3s16 p);
+	void clear();
+
+	size_t size() const { return m_count; }
+
+private:
+	struct Slot {
+		v3s16 pos;
+		MapBlock *block = nullptr;
+	};
+
+	u32 slotOf(v3s16 p) const
+	{
+		u64 key = ((u64)(u16)p.X << 32) | ((u64)(u16)p.Y << 16) | (u16)p.Z;
+		// Fibonacci hashing, the high bits are the best mixed
+		return (u32)((key * 0x9E3779B97F4A7C15ULL) >> m_shift);
+	}
+
+	void rehash(u32 new_size_log2);
+
+	std::vector<Slot> m_slots;
+	u32 m_mask;
+	u32 m_shift;
+	size_t m_count = 0;
+};
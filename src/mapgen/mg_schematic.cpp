@@ -333,7 +333,8 @@ bool Schematic::deserializeFromMts(std::istream *is,
 	delete []schemdata;
 	schemdata = new MapNode[nodecount];
 
-	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_READ, schemdata,
+	// MTS files are always zlib-compressed
+	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_WRITE, schemdata,
 		nodecount, 2, 2, true);
 
 	// Fix probability values for nodes that were ignore; removed in v2
@@ -706,7 +706,8 @@ void MapNode::deSerialize(u8 *source, u8 version)
 }
 void MapNode::serializeBulk(std::ostream &os, int version,
 		const MapNode *nodes, u32 nodecount,
-		u8 content_width, u8 params_width, bool compressed)
+		u8 content_width, u8 params_width, bool compressed,
+		bool use_dictionary)
 {
 	if (!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapNode format not supported");
@@ -738,7 +739,7 @@ void MapNode::serializeBulk(std::ostream &os, int version,
 	*/
 
 	if (compressed)
-		compressZlib(databuf, databuf_size, os);
+		compress(databuf, databuf_size, os, version, use_dictionary);
 	else
 		os.write((const char*) &databuf[0], databuf_size);
 
@@ -748,7 +749,8 @@ void MapNode::serializeBulk(std::ostream &os, int version,
 // Deserialize bulk node data
 void MapNode::deSerializeBulk(std::istream &is, int version,
 		MapNode *nodes, u32 nodecount,
-		u8 content_width, u8 params_width, bool compressed)
+		u8 content_width, u8 params_width, bool compressed,
+		bool use_dictionary)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapNode format not supported");
@@ -764,7 +766,7 @@ void MapNode::deSerializeBulk(std::istream &is, int version,
 	if(compressed)
 	{
 		std::ostringstream os(std::ios_base::binary);
-		decompressZlib(is, os);
+		decompress(is, os, version, use_dictionary);
 		std::string s = os.str();
 		if(s.size() != len)
 			throw SerializationError("deSerializeBulkNodes: "
@@ -289,13 +289,16 @@ struct MapNode
 	//   version = serialization version. Must be >= 22
 	//   content_width = the number of bytes of content per node
 	//   params_width = the number of bytes of params per node
-	//   compressed = true to zlib-compress output
+	//   compressed = true to compress output (zlib, or zstd if version >= 29)
+	//   use_dictionary = true to use the zstd map dictionary, for disk only
 	static void serializeBulk(std::ostream &os, int version,
 			const MapNode *nodes, u32 nodecount,
-			u8 content_width, u8 params_width, bool compressed);
+			u8 content_width, u8 params_width, bool compressed,
+			bool use_dictionary = false);
 	static void deSerializeBulk(std::istream &is, int version,
 			MapNode *nodes, u32 nodecount,
-			u8 content_width, u8 params_width, bool compressed);
+			u8 content_width, u8 params_width, bool compressed,
+			bool use_dictionary = false);
 
 private:
 	// Deprecated serialization methods
@@ -31,11 +31,7 @@
 #include "util/numeric.h"
 #include "util/string.h"
 #include "exceptions.h"
-
-#define NOISE_MAGIC_X    1619
-#define NOISE_MAGIC_Y    31337
-#define NOISE_MAGIC_Z    52591
-#define NOISE_MAGIC_SEED 1013
+#include "noise_simd.h"
 
 typedef float (*Interp2dFxn)(
 		float v00, float v10, float v01, float v11,
@@ -440,6 +436,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] xindex_buf;
+	delete[] xt_buf;
 }
 
 
@@ -458,12 +456,16 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] xindex_buf;
+	delete[] xt_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		this->xindex_buf   = new u32[sx];
+		this->xt_buf       = new float[sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -556,6 +558,11 @@ void Noise::gradientMap2D(
 		float step_x, float step_y,
 		s32 seed)
 {
+	if (simd_level != NOISE_SIMD_NONE) {
+		gradientMap2DSimd(x, y, step_x, step_y, seed);
+		return;
+	}
+
 	float v00, v01, v10, v11, u, v, orig_u;
 	u32 index, i, j, noisex, noisey;
 	u32 nlx, nly;
@@ -620,6 +627,11 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
+	if (simd_level != NOISE_SIMD_NONE) {
+		gradientMap3DSimd(x, y, z, step_x, step_y, step_z, seed);
+		return;
+	}
+
 	float v000, v010, v100, v110;
 	float v001, v011, v101, v111;
 	float u, v, w, orig_u, orig_v;
@@ -706,6 +718,112 @@ void Noise::gradientMap3D(
 #undef idx
 
 
+/*
+ * Same as above, restructured for the vectorized kernels: the X steps are
+ * the same for every row, so they are computed once, and the rows then have
+ * no dependencies between their elements.
+ */
+void Noise::fillXInterpolation(float u, float step_x, bool eased)
+{
+	u32 noisex = 0;
+	for (u32 i = 0; i != sx; i++) {
+		xindex_buf[i] = noisex;
+		xt_buf[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
+void Noise::gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed)
+{
+	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
+
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	noise_lattice_2d(simd_level, noise_buf, x0, y0, nlx, nly, seed);
+
+	fillXInterpolation(u, step_x, eased);
+
+	u32 noisey = 0;
+	for (u32 j = 0; j != sy; j++) {
+		const float *row = noise_buf + noisey * nlx;
+		noise_interp_row_2d(simd_level, gradient_buf + j * sx, sx,
+			row, row + nlx, xindex_buf, xt_buf, eased ? easeCurve(v) : v);
+
+		v += step_y;
+		if (v >= 1.0) {
+			v -= 1.0;
+			noisey++;
+		}
+	}
+}
+
+
+void Noise::gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed)
+{
+	bool eased = np.flags & NOISE_FLAG_EASED;
+
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	s32 z0 = std::floor(z);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+	float w = z - (float)z0;
+	float orig_v = v;
+
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	u32 nlz = (u32)(w + sz * step_z) + 2;
+	noise_lattice_3d(simd_level, noise_buf, x0, y0, z0, nlx, nly, nlz, seed);
+
+	fillXInterpolation(u, step_x, eased);
+
+	float *out = gradient_buf;
+	u32 noisez = 0;
+	for (u32 k = 0; k != sz; k++) {
+		float zt = eased ? easeCurve(w) : w;
+		v = orig_v;
+		u32 noisey = 0;
+		for (u32 j = 0; j != sy; j++, out += sx) {
+			const float *row = noise_buf + (noisez * nly + noisey) * nlx;
+			const float *const rows[4] = {
+				row, row + nlx, row + nly * nlx, row + nly * nlx + nlx
+			};
+			noise_interp_row_3d(simd_level, out, sx, rows,
+				xindex_buf, xt_buf, eased ? easeCurve(v) : v, zt);
+
+			v += step_y;
+			if (v >= 1.0) {
+				v -= 1.0;
+				noisey++;
+			}
+		}
+
+		w += step_z;
+		if (w >= 1.0) {
+			w -= 1.0;
+			noisez++;
+		}
+	}
+}
+
+
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 {
 	float f = 1.0, g = 1.0;
@@ -784,6 +902,12 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 void Noise::updateResults(float g, float *gmap,
 	const float *persistence_map, size_t bufsize)
 {
+	if (simd_level != NOISE_SIMD_NONE) {
+		noise_update_results(simd_level, result, gradient_buf, g, gmap,
+			persistence_map, bufsize, np.flags & NOISE_FLAG_ABSVALUE);
+		return;
+	}
+
 	// This looks very ugly, but it is 50-70% faster than having
 	// conditional statements inside the loop
 	if (np.flags & NOISE_FLAG_ABSVALUE) {
@@ -134,6 +134,15 @@ struct NoiseParams {
 	}
 };
 
+enum NoiseSimdLevel {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+// Best instruction set the Noise map kernels can use on this CPU
+NoiseSimdLevel noise_get_simd_support();
+
 class Noise {
 public:
 	NoiseParams np;
@@ -146,6 +155,9 @@ class Noise {
 	float *persist_buf = nullptr;
 	float *result = nullptr;
 
+	// All levels give bit-identical results; can be lowered for testing
+	NoiseSimdLevel simd_level = noise_get_simd_support();
+
 	Noise(NoiseParams *np, s32 seed, u32 sx, u32 sy, u32 sz=1);
 	~Noise();
 
@@ -185,8 +197,21 @@ class Noise {
 	}
 
 private:
+	// Per map column: lattice X index and interpolation factor
+	u32 *xindex_buf = nullptr;
+	float *xt_buf = nullptr;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	void fillXInterpolation(float u, float step_x, bool eased);
+	void gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed);
+	void gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
@@ -0,0 +1,453 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_simd.h"
+#include <cmath>
+
+// SSE2 is part of x86-64, AVX2 is detected at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+	#define NOISE_SIMD_X86 1
+	#include <immintrin.h>
+#else
+	#define NOISE_SIMD_X86 0
+#endif
+
+// Only AVX2 itself: with FMA enabled, the compiler could fuse the multiply
+// and add of an interpolation, which changes the rounding
+#if defined(__GNUC__)
+	#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define NOISE_TARGET_AVX2
+#endif
+
+NoiseSimdLevel noise_get_simd_support()
+{
+#if NOISE_SIMD_X86
+#if defined(__GNUC__)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+		return NOISE_SIMD_AVX2;
+#endif
+	return NOISE_SIMD_SSE2;
+#else
+	return NOISE_SIMD_NONE;
+#endif
+}
+
+////
+//// Scalar
+////
+
+static inline float lerp(float v0, float v1, float t)
+{
+	return v0 + (v1 - v0) * t;
+}
+
+static void lattice_2d_scalar(float *out, s32 x0, s32 y0,
+		u32 nlx, u32 nly, s32 seed)
+{
+	for (u32 j = 0; j != nly; j++)
+	for (u32 i = 0; i != nlx; i++)
+		*out++ = noise2d(x0 + i, y0 + j, seed);
+}
+
+static void lattice_3d_scalar(float *out, s32 x0, s32 y0, s32 z0,
+		u32 nlx, u32 nly, u32 nlz, s32 seed)
+{
+	for (u32 k = 0; k != nlz; k++)
+	for (u32 j = 0; j != nly; j++)
+	for (u32 i = 0; i != nlx; i++)
+		*out++ = noise3d(x0 + i, y0 + j, z0 + k, seed);
+}
+
+static void interp_row_2d_scalar(float *out, u32 start, u32 count,
+		const float *row0, const float *row1,
+		const u32 *xindex, const float *xt, float yt)
+{
+	for (u32 i = start; i < count; i++) {
+		u32 x = xindex[i];
+		float u = lerp(row0[x], row0[x + 1], xt[i]);
+		float v = lerp(row1[x], row1[x + 1], xt[i]);
+		out[i] = lerp(u, v, yt);
+	}
+}
+
+static void interp_row_3d_scalar(float *out, u32 start, u32 count,
+		const float *const rows[4],
+		const u32 *xindex, const float *xt, float yt, float zt)
+{
+	for (u32 i = start; i < count; i++) {
+		u32 x = xindex[i];
+		float u = lerp(
+			lerp(rows[0][x], rows[0][x + 1], xt[i]),
+			lerp(rows[1][x], rows[1][x + 1], xt[i]), yt);
+		float v = lerp(
+			lerp(rows[2][x], rows[2][x + 1], xt[i]),
+			lerp(rows[3][x], rows[3][x + 1], xt[i]), yt);
+		out[i] = lerp(u, v, zt);
+	}
+}
+
+static void update_results_scalar(float *result, size_t start, size_t count,
+		const float *gradient, float g, float *gmap,
+		const float *persistence_map, bool absvalue)
+{
+	for (size_t i = start; i < count; i++) {
+		float grad = absvalue ? std::fabs(gradient[i]) : gradient[i];
+		if (persistence_map) {
+			result[i] += gmap[i] * grad;
+			gmap[i] *= persistence_map[i];
+		} else {
+			result[i] += g * grad;
+		}
+	}
+}
+
+#if NOISE_SIMD_X86
+
+////
+//// SSE2
+////
+
+// SSE2 has no 32-bit multiply keeping the low halves, build it from two
+// 32x32->64 multiplies of the even and odd lanes
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// The hash of noise2d()/noise3d(), given the weighted coordinate sum
+static inline __m128 noise_hash_sse2(__m128i n)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i t = mullo_epi32_sse2(mullo_epi32_sse2(n, n), _mm_set1_epi32(60493));
+	t = _mm_add_epi32(t, _mm_set1_epi32(19990303));
+	t = _mm_add_epi32(mullo_epi32_sse2(n, t), _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(t, mask);
+	return _mm_sub_ps(_mm_set1_ps(1.f),
+		_mm_div_ps(_mm_cvtepi32_ps(n), _mm_set1_ps((float)0x40000000)));
+}
+
+static inline __m128 lerp_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+// Loads row[xindex[i]] for four consecutive i
+static inline __m128 gather_sse2(const float *row, const u32 *xindex)
+{
+	return _mm_set_ps(row[xindex[3]], row[xindex[2]], row[xindex[1]], row[xindex[0]]);
+}
+
+static void lattice_row_sse2(float *out, s32 x0, u32 nlx, u32 sum_yz)
+{
+	const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+	const __m128i magic_x = _mm_set1_epi32(NOISE_MAGIC_X);
+	u32 i = 0;
+	for (; i + 4 <= nlx; i += 4) {
+		__m128i x = _mm_add_epi32(_mm_set1_epi32(x0 + i), lane);
+		__m128i n = _mm_add_epi32(mullo_epi32_sse2(x, magic_x),
+			_mm_set1_epi32(sum_yz));
+		_mm_storeu_ps(out + i, noise_hash_sse2(n));
+	}
+	for (; i < nlx; i++) {
+		__m128i n = _mm_cvtsi32_si128(NOISE_MAGIC_X * (u32)(x0 + i) + sum_yz);
+		out[i] = _mm_cvtss_f32(noise_hash_sse2(n));
+	}
+}
+
+static void lattice_2d_sse2(float *out, s32 x0, s32 y0,
+		u32 nlx, u32 nly, s32 seed)
+{
+	for (u32 j = 0; j != nly; j++, out += nlx) {
+		lattice_row_sse2(out, x0, nlx,
+			NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_SEED * (u32)seed);
+	}
+}
+
+static void lattice_3d_sse2(float *out, s32 x0, s32 y0, s32 z0,
+		u32 nlx, u32 nly, u32 nlz, s32 seed)
+{
+	for (u32 k = 0; k != nlz; k++)
+	for (u32 j = 0; j != nly; j++, out += nlx) {
+		lattice_row_sse2(out, x0, nlx,
+			NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_Z * (u32)(z0 + k) +
+			NOISE_MAGIC_SEED * (u32)seed);
+	}
+}
+
+static void interp_row_2d_sse2(float *out, u32 count,
+		const float *row0, const float *row1,
+		const u32 *xindex, const float *xt, float yt)
+{
+	const __m128 ty = _mm_set1_ps(yt);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 tx = _mm_loadu_ps(xt + i);
+		__m128 u = lerp_sse2(gather_sse2(row0, xindex + i),
+			gather_sse2(row0 + 1, xindex + i), tx);
+		__m128 v = lerp_sse2(gather_sse2(row1, xindex + i),
+			gather_sse2(row1 + 1, xindex + i), tx);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, ty));
+	}
+	interp_row_2d_scalar(out, i, count, row0, row1, xindex, xt, yt);
+}
+
+static void interp_row_3d_sse2(float *out, u32 count,
+		const float *const rows[4],
+		const u32 *xindex, const float *xt, float yt, float zt)
+{
+	const __m128 ty = _mm_set1_ps(yt);
+	const __m128 tz = _mm_set1_ps(zt);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 tx = _mm_loadu_ps(xt + i);
+		__m128 u = lerp_sse2(
+			lerp_sse2(gather_sse2(rows[0], xindex + i),
+				gather_sse2(rows[0] + 1, xindex + i), tx),
+			lerp_sse2(gather_sse2(rows[1], xindex + i),
+				gather_sse2(rows[1] + 1, xindex + i), tx), ty);
+		__m128 v = lerp_sse2(
+			lerp_sse2(gather_sse2(rows[2], xindex + i),
+				gather_sse2(rows[2] + 1, xindex + i), tx),
+			lerp_sse2(gather_sse2(rows[3], xindex + i),
+				gather_sse2(rows[3] + 1, xindex + i), tx), ty);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, tz));
+	}
+	interp_row_3d_scalar(out, i, count, rows, xindex, xt, yt, zt);
+}
+
+static void update_results_sse2(float *result, const float *gradient,
+		float g, float *gmap, const float *persistence_map, size_t count,
+		bool absvalue)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 gv = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 grad = _mm_loadu_ps(gradient + i);
+		if (absvalue)
+			grad = _mm_and_ps(grad, abs_mask);
+		__m128 res = _mm_loadu_ps(result + i);
+		if (persistence_map) {
+			__m128 gm = _mm_loadu_ps(gmap + i);
+			_mm_storeu_ps(result + i, _mm_add_ps(res, _mm_mul_ps(gm, grad)));
+			_mm_storeu_ps(gmap + i,
+				_mm_mul_ps(gm, _mm_loadu_ps(persistence_map + i)));
+		} else {
+			_mm_storeu_ps(result + i, _mm_add_ps(res, _mm_mul_ps(gv, grad)));
+		}
+	}
+	update_results_scalar(result, i, count, gradient, g, gmap,
+		persistence_map, absvalue);
+}
+
+////
+//// AVX2
+////
+
+NOISE_TARGET_AVX2
+static inline __m256 noise_hash_avx2(__m256i n)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i t = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n),
+		_mm256_set1_epi32(60493));
+	t = _mm256_add_epi32(t, _mm256_set1_epi32(19990303));
+	t = _mm256_add_epi32(_mm256_mullo_epi32(n, t),
+		_mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(t, mask);
+	return _mm256_sub_ps(_mm256_set1_ps(1.f),
+		_mm256_div_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps((float)0x40000000)));
+}
+
+// Loads row[xindex[i]] for eight consecutive i. Plain loads are faster
+// than _mm256_i32gather_ps on many CPUs.
+NOISE_TARGET_AVX2
+static inline __m256 gather_avx2(const float *row, const u32 *xindex)
+{
+	return _mm256_set_ps(row[xindex[7]], row[xindex[6]], row[xindex[5]], row[xindex[4]],
+		row[xindex[3]], row[xindex[2]], row[xindex[1]], row[xindex[0]]);
+}
+
+NOISE_TARGET_AVX2
+static inline __m256 lerp_avx2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+NOISE_TARGET_AVX2
+static void lattice_row_avx2(float *out, s32 x0, u32 nlx, u32 sum_yz)
+{
+	const __m256i lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	const __m256i magic_x = _mm256_set1_epi32(NOISE_MAGIC_X);
+	u32 i = 0;
+	for (; i + 8 <= nlx; i += 8) {
+		__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0 + i), lane);
+		__m256i n = _mm256_add_epi32(_mm256_mullo_epi32(x, magic_x),
+			_mm256_set1_epi32(sum_yz));
+		_mm256_storeu_ps(out + i, noise_hash_avx2(n));
+	}
+	if (i < nlx)
+		lattice_row_sse2(out + i, x0 + i, nlx - i, sum_yz);
+}
+
+NOISE_TARGET_AVX2
+static void lattice_2d_avx2(float *out, s32 x0, s32 y0,
+		u32 nlx, u32 nly, s32 seed)
+{
+	for (u32 j = 0; j != nly; j++, out += nlx) {
+		lattice_row_avx2(out, x0, nlx,
+			NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_SEED * (u32)seed);
+	}
+}
+
+NOISE_TARGET_AVX2
+static void lattice_3d_avx2(float *out, s32 x0, s32 y0, s32 z0,
+		u32 nlx, u32 nly, u32 nlz, s32 seed)
+{
+	for (u32 k = 0; k != nlz; k++)
+	for (u32 j = 0; j != nly; j++, out += nlx) {
+		lattice_row_avx2(out, x0, nlx,
+			NOISE_MAGIC_Y * (u32)(y0 + j) + NOISE_MAGIC_Z * (u32)(z0 + k) +
+			NOISE_MAGIC_SEED * (u32)seed);
+	}
+}
+
+NOISE_TARGET_AVX2
+static void interp_row_2d_avx2(float *out, u32 count,
+		const float *row0, const float *row1,
+		const u32 *xindex, const float *xt, float yt)
+{
+	const __m256 ty = _mm256_set1_ps(yt);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 tx = _mm256_loadu_ps(xt + i);
+		__m256 u = lerp_avx2(gather_avx2(row0, xindex + i),
+			gather_avx2(row0 + 1, xindex + i), tx);
+		__m256 v = lerp_avx2(gather_avx2(row1, xindex + i),
+			gather_avx2(row1 + 1, xindex + i), tx);
+		_mm256_storeu_ps(out + i, lerp_avx2(u, v, ty));
+	}
+	interp_row_2d_scalar(out, i, count, row0, row1, xindex, xt, yt);
+}
+
+NOISE_TARGET_AVX2
+static void update_results_avx2(float *result, const float *gradient,
+		float g, float *gmap, const float *persistence_map, size_t count,
+		bool absvalue)
+{
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 gv = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 grad = _mm256_loadu_ps(gradient + i);
+		if (absvalue)
+			grad = _mm256_and_ps(grad, abs_mask);
+		__m256 res = _mm256_loadu_ps(result + i);
+		if (persistence_map) {
+			__m256 gm = _mm256_loadu_ps(gmap + i);
+			_mm256_storeu_ps(result + i, _mm256_add_ps(res, _mm256_mul_ps(gm, grad)));
+			_mm256_storeu_ps(gmap + i,
+				_mm256_mul_ps(gm, _mm256_loadu_ps(persistence_map + i)));
+		} else {
+			_mm256_storeu_ps(result + i, _mm256_add_ps(res, _mm256_mul_ps(gv, grad)));
+		}
+	}
+	update_results_scalar(result, i, count, gradient, g, gmap,
+		persistence_map, absvalue);
+}
+
+#endif // NOISE_SIMD_X86
+
+////
+//// Dispatch
+////
+
+void noise_lattice_2d(NoiseSimdLevel level, float *out,
+		s32 x0, s32 y0, u32 nlx, u32 nly, s32 seed)
+{
+#if NOISE_SIMD_X86
+	if (level == NOISE_SIMD_AVX2)
+		return lattice_2d_avx2(out, x0, y0, nlx, nly, seed);
+	if (level == NOISE_SIMD_SSE2)
+		return lattice_2d_sse2(out, x0, y0, nlx, nly, seed);
+#endif
+	lattice_2d_scalar(out, x0, y0, nlx, nly, seed);
+}
+
+void noise_lattice_3d(NoiseSimdLevel level, float *out,
+		s32 x0, s32 y0, s32 z0, u32 nlx, u32 nly, u32 nlz, s32 seed)
+{
+#if NOISE_SIMD_X86
+	if (level == NOISE_SIMD_AVX2)
+		return lattice_3d_avx2(out, x0, y0, z0, nlx, nly, nlz, seed);
+	if (level == NOISE_SIMD_SSE2)
+		return lattice_3d_sse2(out, x0, y0, z0, nlx, nly, nlz, seed);
+#endif
+	lattice_3d_scalar(out, x0, y0, z0, nlx, nly, nlz, seed);
+}
+
+void noise_interp_row_2d(NoiseSimdLevel level, float *out, u32 count,
+		const float *row0, const float *row1,
+		const u32 *xindex, const float *xt, float yt)
+{
+#if NOISE_SIMD_X86
+	if (level == NOISE_SIMD_AVX2)
+		return interp_row_2d_avx2(out, count, row0, row1, xindex, xt, yt);
+	if (level == NOISE_SIMD_SSE2)
+		return interp_row_2d_sse2(out, count, row0, row1, xindex, xt, yt);
+#endif
+	interp_row_2d_scalar(out, 0, count, row0, row1, xindex, xt, yt);
+}
+
+void noise_interp_row_3d(NoiseSimdLevel level, float *out, u32 count,
+		const float *const rows[4],
+		const u32 *xindex, const float *xt, float yt, float zt)
+{
+#if NOISE_SIMD_X86
+	// With eight loads per element, 8-wide vectors measured no faster here
+	if (level == NOISE_SIMD_AVX2 || level == NOISE_SIMD_SSE2)
+		return interp_row_3d_sse2(out, count, rows, xindex, xt, yt, zt);
+#endif
+	interp_row_3d_scalar(out, 0, count, rows, xindex, xt, yt, zt);
+}
+
+void noise_update_results(NoiseSimdLevel level, float *result,
+		const float *gradient, float g, float *gmap,
+		const float *persistence_map, size_t count, bool absvalue)
+{
+#if NOISE_SIMD_X86
+	if (level == NOISE_SIMD_AVX2)
+		return update_results_avx2(result, gradient, g, gmap,
+			persistence_map, count, absvalue);
+	if (level == NOISE_SIMD_SSE2)
+		return update_results_sse2(result, gradient, g, gmap,
+			persistence_map, count, absvalue);
+#endif
+	update_results_scalar(result, 0, count, gradient, g, gmap,
+		persistence_map, absvalue);
+}
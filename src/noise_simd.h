@@ -0,0 +1,58 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include "noise.h"
+
+/*
+	Vectorized kernels of the Noise class.
+
+	Every level computes exactly the same float operations in the same order
+	as the scalar code in noise.cpp (no FMA, no reordering), so the results
+	are bit-identical whichever level is used.
+*/
+
+#define NOISE_MAGIC_X    1619
+#define NOISE_MAGIC_Y    31337
+#define NOISE_MAGIC_Z    52591
+#define NOISE_MAGIC_SEED 1013
+
+// Fills the lattice with noise2d()/noise3d() values, X changing fastest
+void noise_lattice_2d(NoiseSimdLevel level, float *out,
+		s32 x0, s32 y0, u32 nlx, u32 nly, s32 seed);
+void noise_lattice_3d(NoiseSimdLevel level, float *out,
+		s32 x0, s32 y0, s32 z0, u32 nlx, u32 nly, u32 nlz, s32 seed);
+
+// Interpolates one row of a gradient map. Output i lies between lattice
+// points xindex[i] and xindex[i] + 1 of the given lattice rows, at the
+// (possibly eased) fractions xt[i] along X and yt/zt along Y and Z.
+// rows are {y z, y+1 z, y z+1, y+1 z+1}.
+void noise_interp_row_2d(NoiseSimdLevel level, float *out, u32 count,
+		const float *row0, const float *row1,
+		const u32 *xindex, const float *xt, float yt);
+void noise_interp_row_3d(NoiseSimdLevel level, float *out, u32 count,
+		const float *const rows[4],
+		const u32 *xindex, const float *xt, float yt, float zt);
+
+// Adds one octave to the result, see Noise::updateResults()
+void noise_update_results(NoiseSimdLevel level, float *result,
+		const float *gradient, float g, float *gmap,
+		const float *persistence_map, size_t count, bool absvalue);
@@ -23,7 +23,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 
 #include "pathfinder.h"
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <set>
 #include "map.h"
+#include "mapblock.h"
 #include "nodedef.h"
 
 //#define PATHFINDER_DEBUG
@@ -59,6 +64,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PATHFINDER_MAX_WAYPOINTS 700
 
+/** mapblocks the PathfinderCache keeps data of before dropping the oldest */
+#define PATHFINDER_CACHE_MAX_BLOCKS 4096
+
 /******************************************************************************/
 /* Class definitions                                                          */
 /******************************************************************************/
@@ -180,7 +188,7 @@ class Pathfinder {
 
 public:
 	Pathfinder() = delete;
-	Pathfinder(Map *map, const NodeDefManager *ndef) : m_map(map), m_ndef(ndef) {}
+	Pathfinder(PathfinderCache *cache) : m_cache(cache) {}
 
 	~Pathfinder();
 
@@ -282,6 +290,37 @@ class Pathfinder {
 	 */
 	bool          updateCostHeuristic(v3s16 isource, v3s16 idestination);
 
+	/**
+	 * (re)create the search area and mark start and end position
+	 * @param isource start position (index pos)
+	 * @param idestination end position (index pos)
+	 * @return true/false start and end position are valid
+	 */
+	bool          initSearch(v3s16 isource, v3s16 idestination);
+
+	/** result of a search for a route of mapblocks */
+	enum BlockRoute {
+		ROUTE_FOUND,         /**< route found, m_corridor is set            */
+		ROUTE_NONE,          /**< there is no path at all                   */
+		ROUTE_UNKNOWN        /**< not searched, search the whole area       */
+	};
+
+	/**
+	 * search a route through the surface regions of the mapblocks, and set
+	 * the mapblocks around it as the area to search the path in
+	 * @param source start position
+	 * @param destination end position
+	 * @return result of the search
+	 */
+	BlockRoute    findBlockRoute(v3s16 source, v3s16 destination);
+
+	/**
+	 * check if a position may be part of the path
+	 * @param pos real world position
+	 * @return true/false position is in the mapblocks of the route
+	 */
+	bool          isInCorridor(v3s16 pos);
+
 	/**
 	 * build a vector containing all nodes from destination to source;
 	 * to be called after the node costs have been processed
@@ -319,16 +358,18 @@ class Pathfinder {
 
 	core::aabbox3d<s16> m_limits; /**< position limits in real map coordinates  */
 
+	/** mapblocks a path is searched in; the whole search area if empty */
+	std::set<v3s16> m_corridor;
+
 	/** contains all map data already collected and analyzed.
 		Access it via the getIndexElement/getIdxElem methods. */
 	friend class GridNodeContainer;
 	GridNodeContainer *m_nodes_container = nullptr;
 
-	Map *m_map = nullptr;
-
-	const NodeDefManager *m_ndef = nullptr;
+	PathfinderCache *m_cache = nullptr;
 
 	friend class PathfinderCompareHeuristic;
+	friend class PathfinderCache;
 
 #ifdef PATHFINDER_DEBUG
 
@@ -408,7 +449,7 @@ class PathfinderCompareHeuristic
 /* implementation                                                             */
 /******************************************************************************/
 
-std::vector<v3s16> get_path(Map* map, const NodeDefManager *ndef,
+std::vector<v3s16> get_path(PathfinderCache *cache,
 		v3s16 source,
 		v3s16 destination,
 		unsigned int searchdistance,
@@ -416,7 +457,8 @@ std::vector<v3s16> get_path(Map* map, const NodeDefManager *ndef,
 		unsigned int max_drop,
 		PathAlgorithm algo)
 {
-	return Pathfinder(map, ndef).getPath(source, destination,
+	cache->beginQuery();
+	return Pathfinder(cache).getPath(source, destination,
 				searchdistance, max_jump, max_drop, algo);
 }
 
@@ -516,20 +558,19 @@ void PathGridnode::setCost(v3s16 dir, const PathCost &cost)
 
 void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 {
-	const NodeDefManager *ndef = m_pathf->m_ndef;
+	PathfinderCache *cache = m_pathf->m_cache;
 	PathGridnode &elem = *p_node;
 
 	v3s16 realpos = m_pathf->getRealPos(ipos);
 
-	MapNode current = m_pathf->m_map->getNode(realpos);
-	MapNode below   = m_pathf->m_map->getNode(realpos + v3s16(0, -1, 0));
+	PathNodeState current = cache->getNodeState(realpos);
+	PathNodeState below   = cache->getNodeState(realpos + v3s16(0, -1, 0));
 
 
-	if ((current.param0 == CONTENT_IGNORE) ||
-			(below.param0 == CONTENT_IGNORE)) {
+	if ((current == PNS_IGNORE) || (below == PNS_IGNORE)) {
 		DEBUG_OUT("Pathfinder: " << PP(realpos) <<
 			" current or below is invalid element" << std::endl);
-		if (current.param0 == CONTENT_IGNORE) {
+		if (current == PNS_IGNORE) {
 			elem.type = 'i';
 			DEBUG_OUT(PP(ipos) << ": " << 'i' << std::endl);
 		}
@@ -537,10 +578,10 @@ void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 	}
 
 	//don't add anything if it isn't an air node
-	if (ndef->get(current).walkable || !ndef->get(below).walkable) {
+	if ((current == PNS_WALKABLE) || (below != PNS_WALKABLE)) {
 			DEBUG_OUT("Pathfinder: " << PP(realpos)
 				<< " not on surface" << std::endl);
-			if (ndef->get(current).walkable) {
+			if (current == PNS_WALKABLE) {
 				elem.type = 's';
 				DEBUG_OUT(PP(ipos) << ": " << 's' << std::endl);
 			} else {
@@ -655,27 +696,13 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	m_max_index_y = diff.Y;
 	m_max_index_z = diff.Z;
 
-	delete m_nodes_container;
-	if (diff.getLength() > 5) {
-		m_nodes_container = new MapGridNodeContainer(this);
-	} else {
-		m_nodes_container = new ArrayGridNodeContainer(this, diff);
-	}
-#ifdef PATHFINDER_DEBUG
-	printType();
-	printCost();
-	printYdir();
-#endif
-
 	//fail if source or destination is walkable
-	MapNode node_at_pos = m_map->getNode(destination);
-	if (m_ndef->get(node_at_pos).walkable) {
+	if (m_cache->getNodeState(destination) == PNS_WALKABLE) {
 		VERBOSE_TARGET << "Destination is walkable. " <<
 				"Pos: " << PP(destination) << std::endl;
 		return retval;
 	}
-	node_at_pos = m_map->getNode(source);
-	if (m_ndef->get(node_at_pos).walkable) {
+	if (m_cache->getNodeState(source) == PNS_WALKABLE) {
 		VERBOSE_TARGET << "Source is walkable. " <<
 				"Pos: " << PP(source) << std::endl;
 		return retval;
@@ -700,40 +727,49 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	v3s16 StartIndex  = getIndexPos(source);
 	v3s16 EndIndex    = getIndexPos(destination);
 
-	PathGridnode &startpos = getIndexElement(StartIndex);
-	PathGridnode &endpos   = getIndexElement(EndIndex);
+	if (!initSearch(StartIndex, EndIndex))
+		return retval;
+#ifdef PATHFINDER_DEBUG
+	printType();
+	printCost();
+	printYdir();
+#endif
 
-	if (!startpos.valid) {
-		VERBOSE_TARGET << "Invalid startpos " <<
-				"Index: " << PP(StartIndex) <<
-				"Realpos: " << PP(getRealPos(StartIndex)) << std::endl;
+	bool update_cost_retval = false;
+
+	//long paths are searched close to a route of mapblocks first
+	BlockRoute route = ROUTE_UNKNOWN;
+	if (algo == PA_PLAIN_NP)
+		route = findBlockRoute(source, destination);
+
+	if (route == ROUTE_NONE) {
+		INFO_TARGET << "No path found" << std::endl;
 		return retval;
 	}
-	if (!endpos.valid) {
-		VERBOSE_TARGET << "Invalid stoppos " <<
-				"Index: " << PP(EndIndex) <<
-				"Realpos: " << PP(getRealPos(EndIndex)) << std::endl;
-		return retval;
+	if (route == ROUTE_FOUND) {
+		update_cost_retval = updateCostHeuristic(StartIndex, EndIndex);
+		if (!update_cost_retval) {
+			VERBOSE_TARGET << "No path along mapblock route, "
+					"searching whole area" << std::endl;
+			m_corridor.clear();
+			initSearch(StartIndex, EndIndex);
+		}
 	}
 
-	endpos.target      = true;
-	startpos.source    = true;
-	startpos.totalcost = 0;
-
-	bool update_cost_retval = false;
-
 	//calculate node costs
-	switch (algo) {
-		case PA_DIJKSTRA:
-			update_cost_retval = updateAllCosts(StartIndex, v3s16(0, 0, 0), 0, 0);
-			break;
-		case PA_PLAIN_NP:
-		case PA_PLAIN:
-			update_cost_retval = updateCostHeuristic(StartIndex, EndIndex);
-			break;
-		default:
-			ERROR_TARGET << "Missing PathAlgorithm" << std::endl;
-			break;
+	if (!update_cost_retval) {
+		switch (algo) {
+			case PA_DIJKSTRA:
+				update_cost_retval = updateAllCosts(StartIndex, v3s16(0, 0, 0), 0, 0);
+				break;
+			case PA_PLAIN_NP:
+			case PA_PLAIN:
+				update_cost_retval = updateCostHeuristic(StartIndex, EndIndex);
+				break;
+			default:
+				ERROR_TARGET << "Missing PathAlgorithm" << std::endl;
+				break;
+		}
 	}
 
 	if (update_cost_retval) {
@@ -820,6 +856,41 @@ Pathfinder::~Pathfinder()
 {
 	delete m_nodes_container;
 }
+
+/******************************************************************************/
+bool Pathfinder::initSearch(v3s16 isource, v3s16 idestination)
+{
+	v3s16 diff = m_limits.MaxEdge - m_limits.MinEdge;
+
+	delete m_nodes_container;
+	if (diff.getLength() > 5) {
+		m_nodes_container = new MapGridNodeContainer(this);
+	} else {
+		m_nodes_container = new ArrayGridNodeContainer(this, diff);
+	}
+
+	PathGridnode &startpos = getIndexElement(isource);
+	PathGridnode &endpos   = getIndexElement(idestination);
+
+	if (!startpos.valid) {
+		VERBOSE_TARGET << "Invalid startpos " <<
+				"Index: " << PP(isource) <<
+				"Realpos: " << PP(getRealPos(isource)) << std::endl;
+		return false;
+	}
+	if (!endpos.valid) {
+		VERBOSE_TARGET << "Invalid stoppos " <<
+				"Index: " << PP(idestination) <<
+				"Realpos: " << PP(getRealPos(idestination)) << std::endl;
+		return false;
+	}
+
+	endpos.target      = true;
+	startpos.source    = true;
+	startpos.totalcost = 0;
+	return true;
+}
+
 /******************************************************************************/
 v3s16 Pathfinder::getRealPos(v3s16 ipos)
 {
@@ -842,28 +913,28 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 		return retval;
 	}
 
-	MapNode node_at_pos2 = m_map->getNode(pos2);
+	PathNodeState node_at_pos2 = m_cache->getNodeState(pos2);
 
 	//did we get information about node?
-	if (node_at_pos2.param0 == CONTENT_IGNORE ) {
+	if (node_at_pos2 == PNS_IGNORE) {
 			VERBOSE_TARGET << "Pathfinder: (1) area at pos: "
 					<< PP(pos2) << " not loaded";
 			return retval;
 	}
 
-	if (!m_ndef->get(node_at_pos2).walkable) {
-		MapNode node_below_pos2 =
-			m_map->getNode(pos2 + v3s16(0, -1, 0));
+	if (node_at_pos2 != PNS_WALKABLE) {
+		PathNodeState node_below_pos2 =
+			m_cache->getNodeState(pos2 + v3s16(0, -1, 0));
 
 		//did we get information about node?
-		if (node_below_pos2.param0 == CONTENT_IGNORE ) {
+		if (node_below_pos2 == PNS_IGNORE) {
 				VERBOSE_TARGET << "Pathfinder: (2) area at pos: "
 					<< PP((pos2 + v3s16(0, -1, 0))) << " not loaded";
 				return retval;
 		}
 
 		//test if the same-height neighbor is suitable
-		if (m_ndef->get(node_below_pos2).walkable) {
+		if (node_below_pos2 == PNS_WALKABLE) {
 			//SUCCESS!
 			retval.valid = true;
 			retval.value = 1;
@@ -872,21 +943,21 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 					<< " cost same height found" << std::endl);
 		}
 		else {
-			//test if we can fall a couple of nodes (m_maxdrop)
+			//test if we can fall a couple of nodes (m_maxdrop),
+			//there is no need to look further down
 			v3s16 testpos = pos2 + v3s16(0, -1, 0);
-			MapNode node_at_pos = m_map->getNode(testpos);
+			PathNodeState node_at_pos = m_cache->getNodeState(testpos);
 
-			while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-					(!m_ndef->get(node_at_pos).walkable) &&
-					(testpos.Y > m_limits.MinEdge.Y)) {
+			while ((node_at_pos == PNS_OPEN) &&
+					(testpos.Y > m_limits.MinEdge.Y) &&
+					(pos2.Y - testpos.Y - 1 < m_maxdrop)) {
 				testpos += v3s16(0, -1, 0);
-				node_at_pos = m_map->getNode(testpos);
+				node_at_pos = m_cache->getNodeState(testpos);
 			}
 
 			//did we find surface?
 			if ((testpos.Y >= m_limits.MinEdge.Y) &&
-					(node_at_pos.param0 != CONTENT_IGNORE) &&
-					(m_ndef->get(node_at_pos).walkable)) {
+					(node_at_pos == PNS_WALKABLE)) {
 				if ((pos2.Y - testpos.Y - 1) <= m_maxdrop) {
 					//SUCCESS!
 					retval.valid = true;
@@ -912,34 +983,33 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 
 		v3s16 targetpos = pos2; // position for jump target
 		v3s16 jumppos = pos; // position for checking if jumping space is free
-		MapNode node_target = m_map->getNode(targetpos);
-		MapNode node_jump = m_map->getNode(jumppos);
+		PathNodeState node_target = m_cache->getNodeState(targetpos);
+		PathNodeState node_jump = m_cache->getNodeState(jumppos);
 		bool headbanger = false; // true if anything blocks jumppath
 
-		while ((node_target.param0 != CONTENT_IGNORE) &&
-				(m_ndef->get(node_target).walkable) &&
-				(targetpos.Y < m_limits.MaxEdge.Y)) {
+		//there is no need to look higher than m_maxjump
+		while ((node_target == PNS_WALKABLE) &&
+				(targetpos.Y < m_limits.MaxEdge.Y) &&
+				(targetpos.Y - pos2.Y < m_maxjump)) {
 			//if the jump would hit any solid node, discard
-			if ((node_jump.param0 == CONTENT_IGNORE) ||
-					(m_ndef->get(node_jump).walkable)) {
+			if (node_jump != PNS_OPEN) {
 					headbanger = true;
 				break;
 			}
 			targetpos += v3s16(0, 1, 0);
 			jumppos   += v3s16(0, 1, 0);
-			node_target = m_map->getNode(targetpos);
-			node_jump   = m_map->getNode(jumppos);
+			node_target = m_cache->getNodeState(targetpos);
+			node_jump   = m_cache->getNodeState(jumppos);
 
 		}
 		//check headbanger one last time
-		if ((node_jump.param0 == CONTENT_IGNORE) ||
-			(m_ndef->get(node_jump).walkable)) {
+		if (node_jump != PNS_OPEN) {
 			headbanger = true;
 		}
 
 		//did we find surface without banging our head?
 		if ((!headbanger) && (targetpos.Y <= m_limits.MaxEdge.Y) &&
-				(!m_ndef->get(node_target).walkable)) {
+				(node_target != PNS_WALKABLE)) {
 
 			if (targetpos.Y - pos2.Y <= m_maxjump) {
 				//SUCCESS!
@@ -1183,6 +1253,8 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 
 			// get position of true neighbor
 			v3s16 neighbor = current_pos + direction_3d;
+			if (!isInCorridor(neighbor))
+				continue;
 			v3s16 ineighbor = getIndexPos(neighbor);
 			PathGridnode &n_pos = getIndexElement(ineighbor);
 
@@ -1239,20 +1311,18 @@ v3s16 Pathfinder::walkDownwards(v3s16 pos, unsigned int max_down) {
 	if (max_down == 0)
 		return pos;
 	v3s16 testpos = v3s16(pos);
-	MapNode node_at_pos = m_map->getNode(testpos);
+	PathNodeState node_at_pos = m_cache->getNodeState(testpos);
 	unsigned int down = 0;
-	while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-			(!m_ndef->get(node_at_pos).walkable) &&
+	while ((node_at_pos == PNS_OPEN) &&
 			(testpos.Y > m_limits.MinEdge.Y) &&
 			(down <= max_down)) {
 		testpos += v3s16(0, -1, 0);
 		down++;
-		node_at_pos = m_map->getNode(testpos);
+		node_at_pos = m_cache->getNodeState(testpos);
 	}
 	//did we find surface?
 	if ((testpos.Y >= m_limits.MinEdge.Y) &&
-			(node_at_pos.param0 != CONTENT_IGNORE) &&
-			(m_ndef->get(node_at_pos).walkable)) {
+			(node_at_pos == PNS_WALKABLE)) {
 		if (down == 0) {
 			pos = testpos;
 		} else if ((down - 1) <= max_down) {
@@ -1271,6 +1341,343 @@ v3s16 Pathfinder::walkDownwards(v3s16 pos, unsigned int max_down) {
 	return pos;
 }
 
+/******************************************************************************/
+bool Pathfinder::isInCorridor(v3s16 pos)
+{
+	return m_corridor.empty() ||
+			m_corridor.find(getNodeBlockPos(pos)) != m_corridor.end();
+}
+
+/******************************************************************************/
+Pathfinder::BlockRoute Pathfinder::findBlockRoute(v3s16 source,
+		v3s16 destination)
+{
+	m_corridor.clear();
+
+	//regions are made for moves reaching no further than the next mapblock,
+	//a drop scan goes one node below the drop
+	if ((m_maxjump >= MAP_BLOCKSIZE) || (m_maxdrop >= MAP_BLOCKSIZE))
+		return ROUTE_UNKNOWN;
+
+	v3s16 start_block = getNodeBlockPos(source);
+	v3s16 end_block = getNodeBlockPos(destination);
+
+	//short paths are found fast enough without
+	if ((abs(start_block.X - end_block.X) < 2) &&
+			(abs(start_block.Z - end_block.Z) < 2))
+		return ROUTE_UNKNOWN;
+
+	const PathBlockRegions *start_regions =
+		m_cache->getRegions(start_block, m_maxjump, m_maxdrop);
+	const PathBlockRegions *end_regions =
+		m_cache->getRegions(end_block, m_maxjump, m_maxdrop);
+	if (!start_regions || !end_regions)
+		return ROUTE_UNKNOWN;
+
+	v3s16 relpos = source - start_block * MAP_BLOCKSIZE;
+	u8 start_region = start_regions->node_region[relpos.Z * MAP_BLOCKSIZE *
+		MAP_BLOCKSIZE + relpos.Y * MAP_BLOCKSIZE + relpos.X];
+	relpos = destination - end_block * MAP_BLOCKSIZE;
+	u8 end_region = end_regions->node_region[relpos.Z * MAP_BLOCKSIZE *
+		MAP_BLOCKSIZE + relpos.Y * MAP_BLOCKSIZE + relpos.X];
+	if ((start_region == 0) || (end_region == 0))
+		return ROUTE_UNKNOWN;
+
+	v3s16 min_block = getNodeBlockPos(m_limits.MinEdge);
+	v3s16 max_block = getNodeBlockPos(m_limits.MaxEdge);
+
+	//A* over the regions, every move into another mapblock costs 1
+	typedef std::pair<v3s16, u8> RouteKey;
+	struct RouteNode {
+		int cost;
+		RouteKey parent;
+		bool closed;
+	};
+	std::map<RouteKey, RouteNode> nodes;
+	typedef std::pair<int, RouteKey> OpenEntry;
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>,
+		std::greater<OpenEntry>> open_list;
+
+	RouteKey start(start_block, start_region);
+	RouteKey goal(end_block, end_region);
+	nodes[start] = {0, start, false};
+	open_list.push(OpenEntry(0, start));
+
+	bool found = false;
+	while (!open_list.empty()) {
+		RouteKey key = open_list.top().second;
+		open_list.pop();
+
+		RouteNode &node = nodes[key];
+		if (node.closed)
+			continue;
+		node.closed = true;
+		if (key == goal) {
+			found = true;
+			break;
+		}
+
+		const PathBlockRegions *regions =
+			m_cache->getRegions(key.first, m_maxjump, m_maxdrop);
+		if (!regions)
+			continue;
+
+		int cost = node.cost + 1;
+		for (const auto &link : regions->links) {
+			if (link.first != key.second)
+				continue;
+
+			v3s16 to_block = getNodeBlockPos(link.second);
+			if ((to_block.X < min_block.X) || (to_block.X > max_block.X) ||
+					(to_block.Y < min_block.Y) || (to_block.Y > max_block.Y) ||
+					(to_block.Z < min_block.Z) || (to_block.Z > max_block.Z))
+				continue;
+
+			const PathBlockRegions *to_regions =
+				m_cache->getRegions(to_block, m_maxjump, m_maxdrop);
+			if (!to_regions)
+				continue;
+			relpos = link.second - to_block * MAP_BLOCKSIZE;
+			u8 to_region = to_regions->node_region[relpos.Z * MAP_BLOCKSIZE *
+				MAP_BLOCKSIZE + relpos.Y * MAP_BLOCKSIZE + relpos.X];
+			if (to_region == 0)
+				continue;
+
+			RouteKey to(to_block, to_region);
+			auto it = nodes.find(to);
+			if ((it != nodes.end()) &&
+					(it->second.closed || (it->second.cost <= cost)))
+				continue;
+			nodes[to] = {cost, key, false};
+			open_list.push(OpenEntry(cost +
+				abs(to_block.X - end_block.X) + abs(to_block.Z - end_block.Z),
+				to));
+		}
+	}
+
+	//every move of a path is part of the regions, so there is none
+	if (!found) {
+		DEBUG_OUT("Pathfinder: no mapblock route" << std::endl);
+		return ROUTE_NONE;
+	}
+
+	//search the path in the mapblocks of the route and next to them
+	for (RouteKey key = goal; ; key = nodes[key].parent) {
+		for (s16 z = -1; z <= 1; z++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 x = -1; x <= 1; x++)
+			m_corridor.insert(key.first + v3s16(x, y, z));
+		if (key == start)
+			break;
+	}
+	return ROUTE_FOUND;
+}
+
+/******************************************************************************/
+void PathfinderCache::beginQuery()
+{
+	m_query++;
+	m_last_valid = false;
+
+	if (m_blocks.size() <= PATHFINDER_CACHE_MAX_BLOCKS)
+		return;
+
+	//drop the half of the mapblocks that was used longest ago
+	std::vector<std::pair<u32, v3s16>> used;
+	used.reserve(m_blocks.size());
+	for (const auto &block : m_blocks)
+		used.emplace_back(block.second.checked_query, block.first);
+	std::sort(used.begin(), used.end());
+	for (size_t i = 0; i < used.size() / 2; i++)
+		m_blocks.erase(used[i].second);
+}
+
+/******************************************************************************/
+PathNodeState PathfinderCache::getNodeState(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	if (!m_last_valid || (blockpos != m_last_blockpos)) {
+		m_last_block = getBlockData(blockpos);
+		m_last_blockpos = blockpos;
+		m_last_valid = true;
+	}
+	if (!m_last_block)
+		return PNS_IGNORE;
+
+	v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+	u32 i = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+		relpos.Y * MAP_BLOCKSIZE + relpos.X;
+	if (m_last_block->ignore[i])
+		return PNS_IGNORE;
+	return m_last_block->walkable[i] ? PNS_WALKABLE : PNS_OPEN;
+}
+
+/******************************************************************************/
+PathBlockData *PathfinderCache::getBlockData(v3s16 blockpos)
+{
+	auto it = m_blocks.find(blockpos);
+	if ((it != m_blocks.end()) && (it->second.checked_query == m_query))
+		return &it->second;
+
+	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+	if (!block || block->isDummy()) {
+		if (it != m_blocks.end()) {
+			if (m_last_block == &it->second)
+				m_last_valid = false;
+			m_blocks.erase(it);
+		}
+		return nullptr;
+	}
+
+	if (it == m_blocks.end())
+		it = m_blocks.emplace(blockpos, PathBlockData()).first;
+	PathBlockData &data = it->second;
+	data.checked_query = m_query;
+
+	//no map event tells about every change (e.g. generation or liquids),
+	//so the change id of the mapblock is compared instead
+	if (data.change_id == block->getChangeId())
+		return &data;
+
+	data.change_id = block->getChangeId();
+	data.regions.clear();
+	const MapNode *nodes = block->getData();
+	for (u32 i = 0; i < PATH_BLOCK_VOLUME; i++) {
+		data.ignore[i] = nodes[i].getContent() == CONTENT_IGNORE;
+		data.walkable[i] = m_ndef->get(nodes[i]).walkable;
+	}
+	return &data;
+}
+
+/******************************************************************************/
+const PathBlockRegions *PathfinderCache::getRegions(v3s16 blockpos,
+		unsigned int max_jump, unsigned int max_drop)
+{
+	PathBlockData *data = getBlockData(blockpos);
+	if (!data)
+		return nullptr;
+
+	PathBlockRegions &regions = data->regions[(max_jump << 8) | max_drop];
+	if (regions.checked_query == m_query)
+		return &regions;
+
+	//moves reach into the neighbors, so they have to be unchanged too
+	if (!regions.node_region.empty()) {
+		bool changed = false;
+		u32 k = 0;
+		for (s16 z = -1; z <= 1; z++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 x = -1; x <= 1; x++) {
+			PathBlockData *neighbor = getBlockData(blockpos + v3s16(x, y, z));
+			if (regions.change_ids[k++] !=
+					(neighbor ? neighbor->change_id : MapBlockChangeId()))
+				changed = true;
+		}
+		if (!changed) {
+			regions.checked_query = m_query;
+			return &regions;
+		}
+	}
+
+	makeRegions(blockpos, max_jump, max_drop, regions);
+	regions.checked_query = m_query;
+	return &regions;
+}
+
+/******************************************************************************/
+void PathfinderCache::makeRegions(v3s16 blockpos, unsigned int max_jump,
+		unsigned int max_drop, PathBlockRegions &regions)
+{
+	u32 k = 0;
+	for (s16 z = -1; z <= 1; z++)
+	for (s16 y = -1; y <= 1; y++)
+	for (s16 x = -1; x <= 1; x++) {
+		PathBlockData *neighbor = getBlockData(blockpos + v3s16(x, y, z));
+		regions.change_ids[k++] = neighbor ? neighbor->change_id : MapBlockChangeId();
+	}
+
+	//moves are checked the way the pathfinder does, limited to the
+	//mapblock and the nodes jumps and drops may reach
+	Pathfinder pathf(this);
+	pathf.m_maxjump = max_jump;
+	pathf.m_maxdrop = max_drop;
+	v3s16 block_min = blockpos * MAP_BLOCKSIZE;
+	v3s16 reach(MAP_BLOCKSIZE + 2, MAP_BLOCKSIZE + 2, MAP_BLOCKSIZE + 2);
+	pathf.m_limits.MinEdge = block_min - reach;
+	pathf.m_limits.MaxEdge = block_min + (MAP_BLOCKSIZE - 1) + reach;
+
+	const v3s16 directions[4] = {
+		v3s16(1, 0, 0), v3s16(-1, 0, 0), v3s16(0, 0, 1), v3s16(0, 0, -1)
+	};
+
+	//union-find of the surface nodes connected by moves inside the block
+	std::vector<u16> parent(PATH_BLOCK_VOLUME);
+	std::iota(parent.begin(), parent.end(), 0);
+	auto find_root = [&parent] (u16 i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	};
+
+	std::vector<bool> surface(PATH_BLOCK_VOLUME, false);
+	std::vector<std::pair<u16, v3s16>> leaving;
+	v3s16 relpos;
+	for (relpos.Z = 0; relpos.Z < MAP_BLOCKSIZE; relpos.Z++)
+	for (relpos.Y = 0; relpos.Y < MAP_BLOCKSIZE; relpos.Y++)
+	for (relpos.X = 0; relpos.X < MAP_BLOCKSIZE; relpos.X++) {
+		v3s16 p = block_min + relpos;
+		if ((getNodeState(p) != PNS_OPEN) ||
+				(getNodeState(p + v3s16(0, -1, 0)) != PNS_WALKABLE))
+			continue;
+
+		u16 i = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+			relpos.Y * MAP_BLOCKSIZE + relpos.X;
+		surface[i] = true;
+		for (v3s16 dir : directions) {
+			PathCost cost = pathf.calcCost(p, dir);
+			if (!cost.valid)
+				continue;
+			v3s16 target = p + dir + v3s16(0, cost.y_change, 0);
+			v3s16 reltarget = target - block_min;
+			if ((reltarget.X < 0) || (reltarget.X >= MAP_BLOCKSIZE) ||
+					(reltarget.Y < 0) || (reltarget.Y >= MAP_BLOCKSIZE) ||
+					(reltarget.Z < 0) || (reltarget.Z >= MAP_BLOCKSIZE)) {
+				leaving.emplace_back(i, target);
+				continue;
+			}
+			u16 root = find_root(i);
+			u16 target_root = find_root(reltarget.Z * MAP_BLOCKSIZE *
+				MAP_BLOCKSIZE + reltarget.Y * MAP_BLOCKSIZE + reltarget.X);
+			parent[target_root] = root;
+		}
+	}
+
+	//number the regions, the last number is shared if there are too many
+	regions.node_region.assign(PATH_BLOCK_VOLUME, 0);
+	std::vector<u8> root_region(PATH_BLOCK_VOLUME, 0);
+	u16 next_region = 1;
+	for (u32 i = 0; i < PATH_BLOCK_VOLUME; i++) {
+		if (!surface[i])
+			continue;
+		u16 root = find_root(i);
+		if (root_region[root] == 0) {
+			root_region[root] = next_region;
+			if (next_region < 255)
+				next_region++;
+		}
+		regions.node_region[i] = root_region[root];
+	}
+
+	regions.links.clear();
+	for (const auto &move : leaving)
+		regions.links.emplace_back(regions.node_region[move.first], move.second);
+	std::sort(regions.links.begin(), regions.links.end());
+	regions.links.erase(std::unique(regions.links.begin(), regions.links.end()),
+		regions.links.end());
+}
+
 #ifdef PATHFINDER_DEBUG
 
 /******************************************************************************/
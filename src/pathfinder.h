@@ -22,8 +22,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 /* Includes                                                                   */
 /******************************************************************************/
+#include <bitset>
+#include <map>
 #include <vector>
 #include "irr_v3d.h"
+#include "constants.h"
+#include "mapblock.h"
 
 /******************************************************************************/
 /* Forward declarations                                                       */
@@ -31,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 class NodeDefManager;
 class Map;
+class PathfinderCache;
 
 /******************************************************************************/
 /* Typedefs and macros                                                        */
@@ -43,6 +48,13 @@ typedef enum {
 	DIR_ZM
 } PathDirections;
 
+/** How the pathfinder sees a node */
+typedef enum {
+	PNS_IGNORE,            /**< not loaded                                   */
+	PNS_OPEN,              /**< not walkable, can be moved through           */
+	PNS_WALKABLE           /**< walkable, can be stood on                    */
+} PathNodeState;
+
 /** List of supported algorithms */
 typedef enum {
 	PA_DIJKSTRA,           /**< Dijkstra shortest path algorithm             */
@@ -54,8 +66,90 @@ typedef enum {
 /* declarations                                                               */
 /******************************************************************************/
 
+#define PATH_BLOCK_VOLUME (MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE)
+
+/** surface regions of a mapblock for one set of jump and drop limits */
+struct PathBlockRegions {
+	/** region of each node of the block, 0 if it is no surface node.
+	 * Nodes of a region are connected by moves inside the block. */
+	std::vector<u8> node_region;
+	/** moves leaving the block: region they start in and where they end */
+	std::vector<std::pair<u8, v3s16>> links;
+	/** change ids of the block and its neighbors the regions are made of */
+	MapBlockChangeId change_ids[27];
+	/** query the change ids were last checked in */
+	u32 checked_query = 0;
+};
+
+/** navigation data of a mapblock, as long as the mapblock is unchanged */
+struct PathBlockData {
+	MapBlockChangeId change_id;           /**< change id of the mapblock     */
+	u32 checked_query = 0;                /**< query the change id was checked in */
+	std::bitset<PATH_BLOCK_VOLUME> walkable;
+	std::bitset<PATH_BLOCK_VOLUME> ignore;
+	/** regions by max_jump << 8 | max_drop */
+	std::map<u16, PathBlockRegions> regions;
+};
+
+/** Navigation data of the map kept between pathfinder calls.
+ *  Data of a mapblock is made again once the mapblock has changed. */
+class PathfinderCache {
+public:
+	PathfinderCache(Map *map, const NodeDefManager *ndef) :
+		m_map(map), m_ndef(ndef) {}
+
+	Map *getMap() { return m_map; }
+	const NodeDefManager *getNodeDefManager() { return m_ndef; }
+
+	/**
+	 * start a pathfinder call; the map may have changed since the last one
+	 */
+	void beginQuery();
+
+	/**
+	 * get the state of a node
+	 * @param p position of the node
+	 */
+	PathNodeState getNodeState(v3s16 p);
+
+	/**
+	 * get the navigation data of a mapblock
+	 * @param blockpos position of the mapblock
+	 * @return data or nullptr if the mapblock is not loaded
+	 */
+	PathBlockData *getBlockData(v3s16 blockpos);
+
+	/**
+	 * get the surface regions of a mapblock
+	 * @param blockpos position of the mapblock
+	 * @param max_jump maximum number of nodes a move may jump up
+	 * @param max_drop maximum number of nodes a move may drop
+	 * @return regions or nullptr if the mapblock is not loaded
+	 */
+	const PathBlockRegions *getRegions(v3s16 blockpos,
+			unsigned int max_jump, unsigned int max_drop);
+
+	/** number of mapblocks with cached data */
+	size_t size() const { return m_blocks.size(); }
+
+private:
+	void makeRegions(v3s16 blockpos, unsigned int max_jump,
+			unsigned int max_drop, PathBlockRegions &regions);
+
+	Map *m_map;
+	const NodeDefManager *m_ndef;
+
+	std::map<v3s16, PathBlockData> m_blocks;
+	u32 m_query = 0;
+
+	/** the mapblock getNodeState() looked at last, if m_last_valid */
+	bool m_last_valid = false;
+	v3s16 m_last_blockpos;
+	PathBlockData *m_last_block = nullptr;
+};
+
 /** c wrapper function to use from scriptapi */
-std::vector<v3s16> get_path(Map *map, const NodeDefManager *ndef,
+std::vector<v3s16> get_path(PathfinderCache *cache,
 		v3s16 source,
 		v3s16 destination,
 		unsigned int searchdistance,
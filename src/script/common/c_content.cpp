@@ -1146,6 +1146,47 @@ MapNode readnode(lua_State *L, int index, const NodeDefManager *ndef)
 	return {id, param1, param2};
 }
 
+/******************************************************************************/
+content_t read_content_id(lua_State *L, int index, const NodeDefManager *ndef)
+{
+	if (lua_type(L, index) == LUA_TNUMBER) {
+		lua_Integer id = lua_tointeger(L, index);
+		if (id < 0 || id > U16_MAX)
+			throw LuaError("Invalid content id " + itos(id));
+		return id;
+	}
+
+	std::string name = luaL_checkstring(L, index);
+	content_t id = CONTENT_IGNORE;
+	if (!ndef->getId(name, id))
+		throw LuaError("\"" + name + "\" is not a registered node!");
+	return id;
+}
+
+/******************************************************************************/
+void read_content_mapping(lua_State *L, int index, const NodeDefManager *ndef,
+		std::vector<content_t> &mapping)
+{
+	if (index < 0)
+		index = lua_gettop(L) + 1 + index;
+
+	mapping.clear();
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		// key at index -2 and value at index -1
+		content_t from = read_content_id(L, -2, ndef);
+		content_t to = read_content_id(L, -1, ndef);
+		if (from >= mapping.size()) {
+			size_t old_size = mapping.size();
+			mapping.resize(from + 1);
+			for (size_t i = old_size; i < mapping.size(); i++)
+				mapping[i] = i;
+		}
+		mapping[from] = to;
+		lua_pop(L, 1);
+	}
+}
+
 /******************************************************************************/
 void pushnode(lua_State *L, const MapNode &n, const NodeDefManager *ndef)
 {
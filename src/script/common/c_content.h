@@ -38,6 +38,7 @@ extern "C" {
 #include "util/string.h"
 #include "itemgroup.h"
 #include "itemdef.h"
+#include "mapnode.h"
 #include "c_types.h"
 #include "hud.h"
 
@@ -128,6 +129,14 @@ MapNode            readnode                  (lua_State *L, int index,
                                               const NodeDefManager *ndef);
 void               pushnode                  (lua_State *L, const MapNode &n,
                                               const NodeDefManager *ndef);
+// Content id given as number or node name
+content_t          read_content_id           (lua_State *L, int index,
+                                              const NodeDefManager *ndef);
+// Table of {[from] = to} content ids or node names, as a mapping indexed
+// by the from id that maps the other ids to themselves
+void               read_content_mapping      (lua_State *L, int index,
+                                              const NodeDefManager *ndef,
+                                              std::vector<content_t> &mapping);
 
 
 void               read_groups               (lua_State *L, int index,
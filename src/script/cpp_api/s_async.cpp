@@ -31,6 +31,7 @@ extern "C" {
 #include "log.h"
 #include "filesys.h"
 #include "porting.h"
+#include "settings.h"
 #include "common/c_internal.h"
 
 /******************************************************************************/
@@ -71,6 +72,21 @@ void AsyncEngine::registerStateInitializer(StateInitializer func)
 	stateInitializers.push_back(func);
 }
 
+/******************************************************************************/
+void AsyncEngine::setGameDef(IGameDef *gamedef)
+{
+	sanity_check(!initDone);
+	this->gamedef = gamedef;
+}
+
+/******************************************************************************/
+void AsyncEngine::registerInitFile(const std::string &mod_name,
+		const std::string &path)
+{
+	sanity_check(!initDone);
+	initFiles.emplace_back(mod_name, path);
+}
+
 /******************************************************************************/
 void AsyncEngine::initialize(unsigned int numEngines)
 {
@@ -86,13 +102,14 @@ void AsyncEngine::initialize(unsigned int numEngines)
 
 /******************************************************************************/
 unsigned int AsyncEngine::queueAsyncJob(const std::string &func,
-		const std::string &params)
+		const std::string &params, const std::string &mod_origin)
 {
 	jobQueueMutex.lock();
 	LuaJobInfo toAdd;
 	toAdd.id = jobIdCounter++;
 	toAdd.serializedFunction = func;
 	toAdd.serializedParams = params;
+	toAdd.modOrigin = mod_origin;
 
 	jobQueue.push_back(toAdd);
 
@@ -132,12 +149,19 @@ void AsyncEngine::putJobResult(const LuaJobInfo &result)
 /******************************************************************************/
 void AsyncEngine::step(lua_State *L)
 {
+	// Take the results first, the handlers may raise errors and the
+	// workers must not wait for them
+	std::deque<LuaJobInfo> results;
+	{
+		MutexAutoLock l(resultQueueMutex);
+		results.swap(resultQueue);
+	}
+
 	int error_handler = PUSH_ERROR_HANDLER(L);
 	lua_getglobal(L, "core");
-	resultQueueMutex.lock();
-	while (!resultQueue.empty()) {
-		LuaJobInfo jobDone = resultQueue.front();
-		resultQueue.pop_front();
+	while (!results.empty()) {
+		LuaJobInfo jobDone = results.front();
+		results.pop_front();
 
 		lua_getfield(L, -1, "async_event_handler");
 
@@ -153,7 +177,6 @@ void AsyncEngine::step(lua_State *L)
 
 		PCALL_RESL(L, lua_pcall(L, 2, 0, error_handler));
 	}
-	resultQueueMutex.unlock();
 	lua_pop(L, 2); // Pop core and error handler
 }
 
@@ -197,18 +220,26 @@ void AsyncEngine::prepareEnvironment(lua_State* L, int top)
 /******************************************************************************/
 AsyncWorkerThread::AsyncWorkerThread(AsyncEngine* jobDispatcher,
 		const std::string &name) :
-	Thread(name),
 	ScriptApiBase(ScriptingType::Async),
+	Thread(name),
 	jobDispatcher(jobDispatcher)
 {
 	lua_State *L = getStack();
 
+	// Game environments are subject to the same security as the mods
+	// that queue jobs in them
+	if (jobDispatcher->gamedef) {
+		setGameDef(jobDispatcher->gamedef);
+		if (g_settings->getBool("secure.enable_security"))
+			initializeSecurity();
+	}
+
 	// Prepare job lua environment
 	lua_getglobal(L, "core");
 	int top = lua_gettop(L);
 
 	// Push builtin initialization type
-	lua_pushstring(L, "async");
+	lua_pushstring(L, jobDispatcher->gamedef ? "async_game" : "async");
 	lua_setglobal(L, "INIT");
 
 	jobDispatcher->prepareEnvironment(L, top);
@@ -227,13 +258,22 @@ void* AsyncWorkerThread::run()
 
 	std::string script = getServer()->getBuiltinLuaPath() + DIR_DELIM + "init.lua";
 	try {
-		loadScript(script);
+		loadMod(script, BUILTIN_MOD_NAME);
 	} catch (const ModError &e) {
 		errorstream << "Execution of async base environment failed: "
 			<< e.what() << std::endl;
 		FATAL_ERROR("Execution of async base environment failed");
 	}
 
+	for (const auto &init_file : jobDispatcher->initFiles) {
+		try {
+			loadMod(init_file.second, init_file.first);
+		} catch (const ModError &e) {
+			errorstream << "Failed to run " << init_file.second
+				<< " in async environment: " << e.what() << std::endl;
+		}
+	}
+
 	int error_handler = PUSH_ERROR_HANDLER(L);
 
 	lua_getglobal(L, "core");
@@ -250,6 +290,7 @@ void* AsyncWorkerThread::run()
 			continue;
 		}
 
+		int top = lua_gettop(L);
 		lua_getfield(L, -1, "job_processor");
 		if (lua_isnil(L, -1)) {
 			FATAL_ERROR("Unable to get async job processor!");
@@ -257,29 +298,59 @@ void* AsyncWorkerThread::run()
 
 		luaL_checktype(L, -1, LUA_TFUNCTION);
 
-		// Call it
-		lua_pushlstring(L,
+		// Load the function here rather than from Lua, as the secure
+		// loadstring() refuses bytecode. The bytecode was dumped from a
+		// function by the engine so it can be trusted.
+		int result = luaL_loadbuffer(L,
 				toProcess.serializedFunction.data(),
-				toProcess.serializedFunction.size());
-		lua_pushlstring(L,
-				toProcess.serializedParams.data(),
-				toProcess.serializedParams.size());
-
-		int result = lua_pcall(L, 2, 1, error_handler);
-		if (result) {
-			PCALL_RES(result);
-			toProcess.serializedResult = "";
-		} else {
+				toProcess.serializedFunction.size(), "=(async)");
+
+		// Call it
+		bool broken = false;
+		if (!result) {
+			lua_pushlstring(L,
+					toProcess.serializedParams.data(),
+					toProcess.serializedParams.size());
+
+			setOriginDirect(toProcess.modOrigin.c_str());
+			try {
+				result = lua_pcall(L, 2, 1, error_handler);
+			} catch (const LuaError &e) {
+				// Only happens without LuaJIT, where exceptions thrown by
+				// API functions unwind through the VM and leave it unusable
+				errorstream << "Async job failed: " << e.what() << std::endl;
+				broken = true;
+			}
+		}
+
+		toProcess.serializedResult = "";
+		if (broken) {
+			// Nothing can be popped from a broken state
+		} else if (result) {
+			// A failing job must not take the worker thread down
+			try {
+				PCALL_RES(result);
+			} catch (const LuaError &e) {
+				errorstream << "Async job failed: " << e.what() << std::endl;
+			}
+		} else if (lua_isstring(L, -1)) {
 			// Fetch result
 			size_t length;
 			const char *retval = lua_tolstring(L, -1, &length);
 			toProcess.serializedResult = std::string(retval, length);
 		}
 
-		lua_pop(L, 1);  // Pop retval
+		if (!broken)
+			lua_settop(L, top);  // Pop retval
 
 		// Put job result
 		jobDispatcher->putJobResult(toProcess);
+
+		if (broken) {
+			errorstream << "Async worker stopped after an unrecoverable error"
+				<< std::endl;
+			return 0;
+		}
 	}
 
 	lua_pop(L, 2);  // Pop core and error handler
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/thread.h"
 #include "lua.h"
 #include "cpp_api/s_base.h"
+#include "cpp_api/s_security.h"
 
 // Forward declarations
 class AsyncEngine;
@@ -43,6 +44,8 @@ struct LuaJobInfo
 	std::string serializedFunction = "";
 	// Parameter to be passed to function
 	std::string serializedParams = "";
+	// Mod that queued the job, used for error messages
+	std::string modOrigin = "";
 	// Result of function call
 	std::string serializedResult = "";
 	// JobID used to identify a job and match it to callback
@@ -52,7 +55,9 @@ struct LuaJobInfo
 };
 
 // Asynchronous working environment
-class AsyncWorkerThread : public Thread, public ScriptApiBase {
+class AsyncWorkerThread : public Thread,
+		virtual public ScriptApiBase,
+		public ScriptApiSecurity {
 public:
 	AsyncWorkerThread(AsyncEngine* jobDispatcher, const std::string &name);
 	virtual ~AsyncWorkerThread();
@@ -83,13 +88,35 @@ class AsyncEngine {
 	 */
 	void initialize(unsigned int numEngines);
 
+	/**
+	 * Make the workers an asynchronous environment of the game: they get
+	 * the server as gamedef, mod security if it is enabled and run the
+	 * registered init files after builtin. Has to be called before initialize.
+	 * @param gamedef The server
+	 */
+	void setGameDef(IGameDef *gamedef);
+
+	/**
+	 * Register a file to be run in every new game state
+	 * @param mod_name Mod the file belongs to
+	 * @param path Path of the Lua file
+	 */
+	void registerInitFile(const std::string &mod_name, const std::string &path);
+
+	/**
+	 * Check if the worker threads have been started
+	 */
+	bool isInitialized() const { return initDone; }
+
 	/**
 	 * Queue an async job
 	 * @param func Serialized lua function
 	 * @param params Serialized parameters
+	 * @param mod_origin Mod queueing the job
 	 * @return jobid The job is queued
 	 */
-	unsigned int queueAsyncJob(const std::string &func, const std::string &params);
+	unsigned int queueAsyncJob(const std::string &func, const std::string &params,
+			const std::string &mod_origin = "");
 
 	/**
 	 * Engine step to process finished jobs
@@ -134,6 +161,12 @@ class AsyncEngine {
 	// Internal store for registred state initializers
 	std::vector<StateInitializer> stateInitializers;
 
+	// Server of game environments, nullptr for the main menu
+	IGameDef *gamedef = nullptr;
+
+	// Mod name and path of the files run in game environments
+	std::vector<std::pair<std::string, std::string>> initFiles;
+
 	// Internal counter to create job IDs
 	unsigned int jobIdCounter = 0;
 
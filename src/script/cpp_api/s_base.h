@@ -61,6 +61,7 @@ extern "C" {
 enum class ScriptingType: u8 {
 	Async,
 	Client,
+	Emerge,
 	MainMenu,
 	Server
 };
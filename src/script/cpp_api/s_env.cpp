@@ -151,12 +151,25 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 		bool simple_catch_up = true;
 		getboolfield(L, current_abm, "catch_up", simple_catch_up);
 
-		lua_getfield(L, current_abm, "action");
-		luaL_checktype(L, current_abm + 1, LUA_TFUNCTION);
+		bool bulk_node_data = false;
+		getboolfield(L, current_abm, "bulk_node_data", bulk_node_data);
+
+		// bulk_action takes precedence over action
+		lua_getfield(L, current_abm, "bulk_action");
+		bool bulk = !lua_isnil(L, -1);
+		if (bulk)
+			luaL_checktype(L, current_abm + 1, LUA_TFUNCTION);
 		lua_pop(L, 1);
 
+		if (!bulk) {
+			lua_getfield(L, current_abm, "action");
+			luaL_checktype(L, current_abm + 1, LUA_TFUNCTION);
+			lua_pop(L, 1);
+		}
+
 		LuaABM *abm = new LuaABM(L, id, trigger_contents, required_neighbors,
-			trigger_interval, trigger_chance, simple_catch_up);
+			trigger_interval, trigger_chance, simple_catch_up,
+			bulk, bulk_node_data);
 
 		env->addActiveBlockModifier(abm);
 
@@ -34,6 +34,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "daynightratio.h"
 #include "util/pointedthing.h"
 #include "mapgen/treegen.h"
+#include "voxelalgorithms.h"
 #include "emerge.h"
 #include "pathfinder.h"
 #include "face_position_cache.h"
@@ -100,6 +101,70 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 	lua_pop(L, 1); // Pop error handler
 }
 
+void LuaABM::triggerBulk(ServerEnvironment *env,
+		const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes,
+		u32 active_object_count, u32 active_object_count_wider)
+{
+	ServerScripting *scriptIface = env->getScriptIface();
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	// Get registered_abms
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_abms");
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_remove(L, -2); // Remove core
+
+	// Get registered_abms[m_id]
+	lua_pushinteger(L, m_id);
+	lua_gettable(L, -2);
+	if(lua_isnil(L, -1))
+		FATAL_ERROR("");
+	lua_remove(L, -2); // Remove registered_abms
+
+	scriptIface->setOriginFromTable(-1);
+
+	// Call bulk_action
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_getfield(L, -1, "bulk_action");
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+	lua_remove(L, -2); // Remove registered_abms[m_id]
+
+	lua_createtable(L, positions.size(), 0);
+	for (size_t i = 0; i < positions.size(); i++) {
+		push_v3s16(L, positions[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_pushnumber(L, active_object_count);
+	lua_pushnumber(L, active_object_count_wider);
+
+	int nargs = 3;
+	if (m_bulk_node_data) {
+		lua_createtable(L, nodes.size(), 0);
+		for (size_t i = 0; i < nodes.size(); i++) {
+			lua_pushinteger(L, nodes[i].getContent());
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_createtable(L, nodes.size(), 0);
+		for (size_t i = 0; i < nodes.size(); i++) {
+			lua_pushinteger(L, nodes[i].getParam2());
+			lua_rawseti(L, -2, i + 1);
+		}
+		nargs += 2;
+	}
+
+	int result = lua_pcall(L, nargs, 0, error_handler);
+	if (result)
+		scriptIface->scriptError(result, "LuaABM::triggerBulk");
+
+	lua_pop(L, 1); // Pop error handler
+}
+
 void LuaLBM::trigger(ServerEnvironment *env, v3s16 p, MapNode n)
 {
 	ServerScripting *scriptIface = env->getScriptIface();
@@ -743,6 +808,31 @@ int ModApiEnvMod::l_get_objects_inside_radius(lua_State *L)
 	return 1;
 }
 
+// get_objects_in_area(minp, maxp)
+int ModApiEnvMod::l_get_objects_in_area(lua_State *L)
+{
+	GET_ENV_PTR;
+	ScriptApiBase *script = getScriptApiBase(L);
+
+	v3f minp = checkFloatPos(L, 1);
+	v3f maxp = checkFloatPos(L, 2);
+	aabb3f box(minp, maxp);
+	box.repair();
+	std::vector<ServerActiveObject *> objs;
+
+	auto include_obj_cb = [](ServerActiveObject *obj){ return !obj->isGone(); };
+	env->getObjectsInArea(objs, box, include_obj_cb);
+
+	int i = 0;
+	lua_createtable(L, objs.size(), 0);
+	for (const auto obj : objs) {
+		// Insert object reference into table
+		script->objectrefGetOrCreate(L, obj);
+		lua_rawseti(L, -2, ++i);
+	}
+	return 1;
+}
+
 // set_timeofday(val)
 // val = 0...1
 int ModApiEnvMod::l_set_timeofday(lua_State *L)
@@ -1137,6 +1227,201 @@ int ModApiEnvMod::l_fix_light(lua_State *L)
 	return 1;
 }
 
+// Volume limit of the region functions, the same as for find_nodes_in_area
+#define REGION_MAX_VOLUME 4096000
+
+// Throws unless the area is inside the map, so that the mapblocks around
+// it can be addressed without overflowing
+static void check_region_limits(const v3s32 &minp, const v3s32 &maxp,
+		const char *func)
+{
+	const s32 limit = MAX_MAP_GENERATION_LIMIT;
+	if (minp.X < -limit || minp.Y < -limit || minp.Z < -limit ||
+			maxp.X > limit || maxp.Y > limit || maxp.Z > limit)
+		throw LuaError(std::string(func) + "(): area exceeds the map limits");
+}
+
+// Reads the area given by the positions at index and index + 1
+static VoxelArea read_region(lua_State *L, int index, const char *func)
+{
+	v3s16 minp = check_v3s16(L, index);
+	v3s16 maxp = check_v3s16(L, index + 1);
+	sortBoxVerticies(minp, maxp);
+	check_region_limits(v3s32(minp.X, minp.Y, minp.Z),
+		v3s32(maxp.X, maxp.Y, maxp.Z), func);
+
+	// The s32 volume of VoxelArea overflows for large areas
+	if ((u64)((s32)maxp.X - minp.X + 1) * (u64)((s32)maxp.Y - minp.Y + 1) *
+			(u64)((s32)maxp.Z - minp.Z + 1) > REGION_MAX_VOLUME)
+		throw LuaError(std::string(func) + "(): area volume exceeds "
+			"allowed value of " + itos(REGION_MAX_VOLUME));
+	return VoxelArea(minp, maxp);
+}
+
+// Loads the mapblocks containing the area into the VoxelManip, without
+// generating missing ones
+static void read_region_blocks(MMVManip *vm, const VoxelArea &area)
+{
+	vm->initialEmerge(getNodeBlockPos(area.MinEdge),
+		getNodeBlockPos(area.MaxEdge), false);
+}
+
+// Writes the VoxelManips back with one lighting update each, and sends a
+// single event for all modified blocks
+static void write_region_blocks(ServerMap *map,
+		std::initializer_list<MMVManip *> vms)
+{
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (MMVManip *vm : vms)
+		voxalgo::blit_back_with_light(map, vm, &modified_blocks);
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for (const auto &modified_block : modified_blocks)
+		event.modified_blocks.insert(modified_block.first);
+
+	map->dispatchEvent(event);
+}
+
+// fill_area(pos1, pos2, node)
+int ModApiEnvMod::l_fill_area(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	const NodeDefManager *ndef = env->getGameDef()->ndef();
+	VoxelArea area = read_region(L, 1, "fill_area");
+	MapNode n = readnode(L, 3, ndef);
+
+	ServerMap *map = &env->getServerMap();
+	MMVManip vm(map);
+	read_region_blocks(&vm, area);
+
+	u32 count = vm.fillContent(area, n.getContent(), n.getParam2());
+	if (count > 0)
+		write_region_blocks(map, {&vm});
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+// replace_in_area(pos1, pos2, {[from] = to, ...})
+int ModApiEnvMod::l_replace_in_area(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	const NodeDefManager *ndef = env->getGameDef()->ndef();
+	VoxelArea area = read_region(L, 1, "replace_in_area");
+	luaL_checktype(L, 3, LUA_TTABLE);
+
+	std::vector<content_t> mapping;
+	read_content_mapping(L, 3, ndef, mapping);
+
+	ServerMap *map = &env->getServerMap();
+	MMVManip vm(map);
+	read_region_blocks(&vm, area);
+
+	u32 count = vm.replaceContent(area, mapping);
+	if (count > 0)
+		write_region_blocks(map, {&vm});
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+// count_nodes_in_area(pos1, pos2, [nodenames])
+int ModApiEnvMod::l_count_nodes_in_area(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	const NodeDefManager *ndef = env->getGameDef()->ndef();
+	VoxelArea area = read_region(L, 1, "count_nodes_in_area");
+
+	std::vector<content_t> filter;
+	bool filtered = !lua_isnoneornil(L, 3);
+	if (filtered)
+		collectNodeIds(L, 3, ndef, filter);
+
+	MMVManip vm(&env->getServerMap());
+	read_region_blocks(&vm, area);
+
+	std::vector<u32> counts;
+	vm.countContent(area, counts);
+
+	if (filtered) {
+		lua_createtable(L, 0, filter.size());
+		for (content_t c : filter) {
+			lua_pushinteger(L, c < counts.size() ? counts[c] : 0);
+			lua_setfield(L, -2, ndef->get(c).name.c_str());
+		}
+	} else {
+		lua_newtable(L);
+		for (size_t c = 0; c < counts.size(); c++) {
+			if (counts[c] == 0)
+				continue;
+			lua_pushinteger(L, counts[c]);
+			lua_setfield(L, -2, ndef->get(c).name.c_str());
+		}
+	}
+	return 1;
+}
+
+// copy_area(pos1, pos2, dst_pos, [move])
+int ModApiEnvMod::l_copy_area(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	VoxelArea src_area = read_region(L, 1, "copy_area");
+	v3s16 dst_pos = check_v3s16(L, 3);
+	bool move = readParam<bool>(L, 4, false);
+	// In s32, the end of the destination may be past the s16 range
+	v3s16 extent = src_area.getExtent();
+	check_region_limits(v3s32(dst_pos.X, dst_pos.Y, dst_pos.Z),
+		v3s32((s32)dst_pos.X + extent.X - 1, (s32)dst_pos.Y + extent.Y - 1,
+			(s32)dst_pos.Z + extent.Z - 1), "copy_area");
+	VoxelArea dst_area(dst_pos, dst_pos + extent - v3s16(1, 1, 1));
+
+	ServerMap *map = &env->getServerMap();
+	MMVManip src_vm(map);
+	MMVManip dst_vm(map);
+	MMVManip *dst = &dst_vm;
+
+	// Areas sharing mapblocks have to use the same VoxelManip, otherwise
+	// writing back one would undo the changes of the other
+	v3s16 src_bmin = getNodeBlockPos(src_area.MinEdge);
+	v3s16 src_bmax = getNodeBlockPos(src_area.MaxEdge);
+	v3s16 dst_bmin = getNodeBlockPos(dst_area.MinEdge);
+	v3s16 dst_bmax = getNodeBlockPos(dst_area.MaxEdge);
+	if (src_bmin.X <= dst_bmax.X && dst_bmin.X <= src_bmax.X &&
+			src_bmin.Y <= dst_bmax.Y && dst_bmin.Y <= src_bmax.Y &&
+			src_bmin.Z <= dst_bmax.Z && dst_bmin.Z <= src_bmax.Z) {
+		VoxelArea both = src_area;
+		both.addArea(dst_area);
+		read_region_blocks(&src_vm, both);
+		dst = &src_vm;
+	} else {
+		read_region_blocks(&src_vm, src_area);
+		read_region_blocks(&dst_vm, dst_area);
+	}
+
+	// Moving clears the source nodes that were copied, so nodes that
+	// could not be written to the destination are kept
+	u32 count = move ?
+		dst->moveArea(src_vm, src_area, dst_pos, MapNode(CONTENT_AIR)) :
+		dst->copyArea(src_vm, src_area, dst_pos);
+	if (count > 0) {
+		// The source is only changed when moving
+		if (dst == &src_vm)
+			write_region_blocks(map, {&src_vm});
+		else if (move)
+			write_region_blocks(map, {&src_vm, &dst_vm});
+		else
+			write_region_blocks(map, {&dst_vm});
+	}
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
 int ModApiEnvMod::l_raycast(lua_State *L)
 {
 	return LuaRaycast::create_object(L);
@@ -1266,7 +1551,7 @@ int ModApiEnvMod::l_find_path(lua_State *L)
 			algo = PA_DIJKSTRA;
 	}
 
-	std::vector<v3s16> path = get_path(&env->getServerMap(), env->getGameDef()->ndef(), pos1, pos2,
+	std::vector<v3s16> path = get_path(env->getPathfinderCache(), pos1, pos2,
 		searchdistance, max_jump, max_drop, algo);
 
 	if (!path.empty()) {
@@ -1414,6 +1699,7 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(get_connected_players);
 	API_FCT(get_player_by_name);
 	API_FCT(get_objects_inside_radius);
+	API_FCT(get_objects_in_area);
 	API_FCT(set_timeofday);
 	API_FCT(get_timeofday);
 	API_FCT(get_gametime);
@@ -1422,6 +1708,10 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(find_nodes_in_area);
 	API_FCT(find_nodes_in_area_under_air);
 	API_FCT(fix_light);
+	API_FCT(fill_area);
+	API_FCT(replace_in_area);
+	API_FCT(count_nodes_in_area);
+	API_FCT(copy_area);
 	API_FCT(load_area);
 	API_FCT(emerge_area);
 	API_FCT(delete_area);
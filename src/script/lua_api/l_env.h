@@ -115,6 +115,9 @@ class ModApiEnvMod : public ModApiBase {
 	// get_objects_inside_radius(pos, radius)
 	static int l_get_objects_inside_radius(lua_State *L);
 
+	// get_objects_in_area(minp, maxp)
+	static int l_get_objects_in_area(lua_State *L);
+
 	// set_timeofday(val)
 	// val = 0...1
 	static int l_set_timeofday(lua_State *L);
@@ -143,6 +146,18 @@ class ModApiEnvMod : public ModApiBase {
 	// fix_light(p1, p2) -> true/false
 	static int l_fix_light(lua_State *L);
 
+	// fill_area(pos1, pos2, node) -> count
+	static int l_fill_area(lua_State *L);
+
+	// replace_in_area(pos1, pos2, {[from] = to, ...}) -> count
+	static int l_replace_in_area(lua_State *L);
+
+	// count_nodes_in_area(pos1, pos2, [nodenames]) -> {[name] = count, ...}
+	static int l_count_nodes_in_area(lua_State *L);
+
+	// copy_area(pos1, pos2, dst_pos, [move]) -> count
+	static int l_copy_area(lua_State *L);
+
 	// load_area(p1)
 	static int l_load_area(lua_State *L);
 
@@ -216,17 +231,22 @@ class LuaABM : public ActiveBlockModifier {
 	float m_trigger_interval;
 	u32 m_trigger_chance;
 	bool m_simple_catch_up;
+	bool m_bulk;
+	bool m_bulk_node_data;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::vector<std::string> &trigger_contents,
 			const std::vector<std::string> &required_neighbors,
-			float trigger_interval, u32 trigger_chance, bool simple_catch_up):
+			float trigger_interval, u32 trigger_chance, bool simple_catch_up,
+			bool bulk, bool bulk_node_data):
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
 		m_trigger_interval(trigger_interval),
 		m_trigger_chance(trigger_chance),
-		m_simple_catch_up(simple_catch_up)
+		m_simple_catch_up(simple_catch_up),
+		m_bulk(bulk),
+		m_bulk_node_data(bulk_node_data)
 	{
 	}
 	virtual const std::vector<std::string> &getTriggerContents() const
@@ -249,8 +269,15 @@ class LuaABM : public ActiveBlockModifier {
 	{
 		return m_simple_catch_up;
 	}
+	virtual bool getBulkTrigger()
+	{
+		return m_bulk;
+	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider);
+	virtual void triggerBulk(ServerEnvironment *env,
+			const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes,
+			u32 active_object_count, u32 active_object_count_wider);
 };
 
 class LuaLBM : public LoadingBlockModifierDef
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/c_content.h"
 #include "cpp_api/s_security.h"
 #include "util/serialize.h"
+#include "scripting_emerge.h"
 #include "server.h"
 #include "environment.h"
 #include "emerge.h"
@@ -1512,7 +1513,11 @@ int ModApiMapgen::l_generate_ores(lua_State *L)
 
 	u32 blockseed = Mapgen::getBlockSeed(pmin, mg.seed);
 
-	emerge->oremgr->placeAllOres(&mg, blockseed, pmin, pmax);
+	OreManager *oremgr = emerge->oremgr;
+	if (EmergeParams *params = getEmergeParams(L))
+		oremgr = params->oremgr;
+
+	oremgr->placeAllOres(&mg, blockseed, pmin, pmax);
 
 	return 0;
 }
@@ -1538,7 +1543,11 @@ int ModApiMapgen::l_generate_decorations(lua_State *L)
 
 	u32 blockseed = Mapgen::getBlockSeed(pmin, mg.seed);
 
-	emerge->decomgr->placeAllDecos(&mg, blockseed, pmin, pmax);
+	DecorationManager *decomgr = emerge->decomgr;
+	if (EmergeParams *params = getEmergeParams(L))
+		decomgr = params->decomgr;
+
+	decomgr->placeAllDecos(&mg, blockseed, pmin, pmax);
 
 	return 0;
 }
@@ -1664,6 +1673,8 @@ int ModApiMapgen::l_place_schematic_on_vmanip(lua_State *L)
 	NO_MAP_LOCK_REQUIRED;
 
 	SchematicManager *schemmgr = getServer(L)->getEmergeManager()->schemmgr;
+	if (EmergeParams *params = getEmergeParams(L))
+		schemmgr = params->schemmgr;
 
 	//// Read VoxelManip object
 	MMVManip *vm = LuaVoxelManip::checkobject(L, 1)->vm;
@@ -1836,6 +1847,35 @@ int ModApiMapgen::l_read_schematic(lua_State *L)
 }
 
 
+// register_mapgen_script(path)
+int ModApiMapgen::l_register_mapgen_script(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::string path = readParam<std::string>(L, 1);
+	CHECK_SECURE_PATH(L, path.c_str(), false);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_CURRENT_MOD_NAME);
+	std::string mod_name = readParam<std::string>(L, -1, "");
+	lua_pop(L, 1);
+	if (mod_name.empty())
+		throw LuaError("register_mapgen_script() can only be called at load time");
+
+	getServer(L)->getEmergeManager()->addMapgenScript(mod_name, path);
+
+	return 0;
+}
+
+
+EmergeParams *ModApiMapgen::getEmergeParams(lua_State *L)
+{
+	if (getScriptApiBase(L)->getType() != ScriptingType::Emerge)
+		return nullptr;
+
+	return getScriptApi<EmergeScripting>(L)->getEmergeParams();
+}
+
+
 void ModApiMapgen::Initialize(lua_State *L, int top)
 {
 	API_FCT(get_biome_id);
@@ -1875,4 +1915,26 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(place_schematic_on_vmanip);
 	API_FCT(serialize_schematic);
 	API_FCT(read_schematic);
+
+	API_FCT(register_mapgen_script);
+}
+
+
+void ModApiMapgen::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_biome_id);
+	API_FCT(get_biome_name);
+	API_FCT(get_heat);
+	API_FCT(get_humidity);
+	API_FCT(get_biome_data);
+	API_FCT(get_mapgen_object);
+
+	API_FCT(get_mapgen_setting);
+	API_FCT(get_mapgen_setting_noiseparams);
+	API_FCT(get_noiseparams);
+	API_FCT(get_decoration_id);
+
+	API_FCT(generate_ores);
+	API_FCT(generate_decorations);
+	API_FCT(place_schematic_on_vmanip);
 }
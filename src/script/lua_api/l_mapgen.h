@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "lua_api/l_base.h"
 
+class EmergeParams;
+
 typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
 
 class ModApiMapgen : public ModApiBase
@@ -136,8 +138,16 @@ class ModApiMapgen : public ModApiBase
 	// read_schematic(schematic, options={...})
 	static int l_read_schematic(lua_State *L);
 
+	// register_mapgen_script(path)
+	static int l_register_mapgen_script(lua_State *L);
+
+	// Clones of the mapgen managers owned by the mapgen environment,
+	// nullptr in other environments
+	static EmergeParams *getEmergeParams(lua_State *L);
+
 public:
 	static void Initialize(lua_State *L, int top);
+	static void InitializeEmerge(lua_State *L, int top);
 
 	static struct EnumString es_BiomeTerrainType[];
 	static struct EnumString es_DecorationType[];
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/c_content.h"
 #include "cpp_api/s_base.h"
 #include "cpp_api/s_security.h"
+#include "scripting_server.h"
 #include "server.h"
 #include "environment.h"
 #include "remoteplayer.h"
@@ -533,6 +534,62 @@ int ModApiServer::l_set_last_run_mod(lua_State *L)
 	return 0;
 }
 
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	((std::string *)ud)->append((const char *)p, sz);
+	return 0;
+}
+
+// do_async_callback(func, serialized_args) -> jobid
+int ModApiServer::l_do_async_callback(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	std::string serialized_args = readParam<std::string>(L, 2);
+
+	// Dump the function here so that no handcrafted bytecode
+	// can reach the async environment
+	std::string serialized_func;
+	lua_pushvalue(L, 1);
+	int result = lua_dump(L, dump_writer, &serialized_func);
+	lua_pop(L, 1);
+	if (result != 0 || serialized_func.empty())
+		throw LuaError("Unable to dump function for the async environment");
+
+	ServerScripting *script = getScriptApi<ServerScripting>(L);
+	lua_pushinteger(L, script->queueAsync(serialized_func, serialized_args,
+			script->getOrigin()));
+	return 1;
+}
+
+// register_async_dofile(path)
+int ModApiServer::l_register_async_dofile(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	std::string path = readParam<std::string>(L, 1);
+	CHECK_SECURE_PATH(L, path.c_str(), false);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_CURRENT_MOD_NAME);
+	std::string mod_name = readParam<std::string>(L, -1, "");
+	lua_pop(L, 1);
+
+	ServerScripting *script = getScriptApi<ServerScripting>(L);
+	if (mod_name.empty() || script->isAsyncEnabled())
+		throw LuaError("register_async_dofile() can only be called at load time");
+
+	// Report errors to the mod rather than from every worker
+	bool ok = ScriptApiSecurity::isSecure(L) ?
+		ScriptApiSecurity::safeLoadFile(L, path.c_str()) :
+		!luaL_loadfile(L, path.c_str());
+	if (!ok)
+		throw LuaError(readParam<std::string>(L, -1));
+	lua_pop(L, 1);
+
+	script->registerAsyncInitFile(mod_name, path);
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 void ModApiServer::Initialize(lua_State *L, int top)
 {
 	API_FCT(request_shutdown);
@@ -568,4 +625,20 @@ void ModApiServer::Initialize(lua_State *L, int top)
 
 	API_FCT(get_last_run_mod);
 	API_FCT(set_last_run_mod);
+
+	API_FCT(do_async_callback);
+	API_FCT(register_async_dofile);
+}
+
+void ModApiServer::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_worldpath);
+	API_FCT(is_singleplayer);
+
+	API_FCT(get_current_modname);
+	API_FCT(get_modpath);
+	API_FCT(get_modnames);
+
+	API_FCT(get_last_run_mod);
+	API_FCT(set_last_run_mod);
 }
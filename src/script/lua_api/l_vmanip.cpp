@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "lua_api/l_internal.h"
 #include "common/c_content.h"
 #include "common/c_converter.h"
+#include "cpp_api/s_base.h"
 #include "emerge.h"
 #include "environment.h"
 #include "map.h"
@@ -46,6 +47,11 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
+	// The mapgen environment runs without the environment lock
+	if (getScriptApiBase(L)->getType() == ScriptingType::Emerge)
+		throw LuaError("VoxelManip:read_from_map is not available in the "
+			"mapgen environment");
+
 	v3s16 bp1 = getNodeBlockPos(check_v3s16(L, 2));
 	v3s16 bp2 = getNodeBlockPos(check_v3s16(L, 3));
 	sortBoxVerticies(bp1, bp2);
@@ -373,6 +379,105 @@ int LuaVoxelManip::l_get_emerged_area(lua_State *L)
 	return 2;
 }
 
+VoxelArea LuaVoxelManip::readArea(lua_State *L, int index)
+{
+	v3s16 pmin = lua_istable(L, index) ? check_v3s16(L, index) :
+		vm->m_area.MinEdge;
+	v3s16 pmax = lua_istable(L, index + 1) ? check_v3s16(L, index + 1) :
+		vm->m_area.MaxEdge;
+
+	sortBoxVerticies(pmin, pmax);
+	VoxelArea area(pmin, pmax);
+	if (vm->m_area.hasEmptyExtent() || !vm->m_area.contains(area))
+		throw LuaError("Specified voxel area out of VoxelManipulator bounds");
+	return area;
+}
+
+int LuaVoxelManip::l_get_data_view(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	checkobject(L, 1);
+	std::string field = luaL_optstring(L, 2, "content");
+
+	LuaVoxelManipView::Field f;
+	if (field == "content")
+		f = LuaVoxelManipView::FIELD_CONTENT;
+	else if (field == "light")
+		f = LuaVoxelManipView::FIELD_LIGHT;
+	else if (field == "param2")
+		f = LuaVoxelManipView::FIELD_PARAM2;
+	else
+		throw LuaError("VoxelManip:get_data_view: invalid field \"" +
+			field + "\"");
+
+	LuaVoxelManipView::create(L, 1, f);
+	return 1;
+}
+
+int LuaVoxelManip::l_fill(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkobject(L, 1);
+	const NodeDefManager *ndef = getServer(L)->getNodeDefManager();
+
+	VoxelArea area = o->readArea(L, 2);
+	content_t c = read_content_id(L, 4, ndef);
+	s16 param2 = -1;
+	if (!lua_isnoneornil(L, 5))
+		param2 = luaL_checkinteger(L, 5) & 0xFF;
+
+	u32 count = o->vm->fillContent(area, c, param2);
+	if (count > 0)
+		o->vm->m_is_dirty = true;
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+int LuaVoxelManip::l_replace(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkobject(L, 1);
+	const NodeDefManager *ndef = getServer(L)->getNodeDefManager();
+
+	VoxelArea area = o->readArea(L, 2);
+	luaL_checktype(L, 4, LUA_TTABLE);
+
+	std::vector<content_t> mapping;
+	read_content_mapping(L, 4, ndef, mapping);
+
+	u32 count = o->vm->replaceContent(area, mapping);
+	if (count > 0)
+		o->vm->m_is_dirty = true;
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+int LuaVoxelManip::l_copy_from(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkobject(L, 1);
+	LuaVoxelManip *src = checkobject(L, 2);
+
+	VoxelArea src_area = src->readArea(L, 3);
+	v3s16 dst_pos = check_v3s16(L, 5);
+	VoxelArea dst_area(dst_pos, dst_pos + src_area.getExtent() - v3s16(1, 1, 1));
+	if (!o->vm->m_area.contains(dst_area))
+		throw LuaError("Specified voxel area out of VoxelManipulator bounds");
+
+	u32 count = o->vm->copyArea(*src->vm, src_area, dst_pos);
+	if (count > 0)
+		o->vm->m_is_dirty = true;
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
 LuaVoxelManip::LuaVoxelManip(MMVManip *mmvm, bool is_mg_vm) :
 	is_mapgen_vm(is_mg_vm),
 	vm(mmvm)
@@ -455,6 +560,8 @@ void LuaVoxelManip::Register(lua_State *L)
 
 	// Can be created from Lua (VoxelManip())
 	lua_register(L, className, create_object);
+
+	LuaVoxelManipView::Register(L);
 }
 
 const char LuaVoxelManip::className[] = "VoxelManip";
@@ -475,5 +582,139 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, set_param2_data),
 	luamethod(LuaVoxelManip, was_modified),
 	luamethod(LuaVoxelManip, get_emerged_area),
+	luamethod(LuaVoxelManip, get_data_view),
+	luamethod(LuaVoxelManip, fill),
+	luamethod(LuaVoxelManip, replace),
+	luamethod(LuaVoxelManip, copy_from),
 	{0,0}
 };
+
+/*
+	LuaVoxelManipView
+*/
+
+// garbage collector
+int LuaVoxelManipView::gc_object(lua_State *L)
+{
+	LuaVoxelManipView *o = *(LuaVoxelManipView **)(lua_touserdata(L, 1));
+	delete o;
+
+	return 0;
+}
+
+int LuaVoxelManipView::mt_index(lua_State *L)
+{
+	LuaVoxelManipView *o = *(LuaVoxelManipView **)
+		luaL_checkudata(L, 1, className);
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	// The VoxelManip may have been read again since the view was made
+	MMVManip *vm = o->m_vm->vm;
+	lua_Integer i = lua_tointeger(L, 2);
+	if (i < 1 || i > (lua_Integer)vm->m_area.getVolume()) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	const MapNode &n = vm->m_data[i - 1];
+	switch (o->m_field) {
+	case FIELD_CONTENT:
+		lua_pushinteger(L, n.getContent());
+		break;
+	case FIELD_LIGHT:
+		lua_pushinteger(L, n.param1);
+		break;
+	case FIELD_PARAM2:
+		lua_pushinteger(L, n.param2);
+		break;
+	}
+	return 1;
+}
+
+int LuaVoxelManipView::mt_newindex(lua_State *L)
+{
+	LuaVoxelManipView *o = *(LuaVoxelManipView **)
+		luaL_checkudata(L, 1, className);
+
+	MMVManip *vm = o->m_vm->vm;
+	lua_Integer i = luaL_checkinteger(L, 2);
+	if (i < 1 || i > (lua_Integer)vm->m_area.getVolume())
+		throw LuaError("VoxelManip data view index " + itos(i) +
+			" out of range");
+
+	MapNode &n = vm->m_data[i - 1];
+	switch (o->m_field) {
+	case FIELD_CONTENT:
+		n.setContent(read_content_id(L, 3,
+			getServer(L)->getNodeDefManager()));
+		break;
+	case FIELD_LIGHT:
+		n.param1 = luaL_checkinteger(L, 3);
+		break;
+	case FIELD_PARAM2:
+		n.param2 = luaL_checkinteger(L, 3);
+		break;
+	}
+	vm->m_is_dirty = true;
+	return 0;
+}
+
+int LuaVoxelManipView::mt_len(lua_State *L)
+{
+	LuaVoxelManipView *o = *(LuaVoxelManipView **)
+		luaL_checkudata(L, 1, className);
+
+	lua_pushinteger(L, o->m_vm->vm->m_area.getVolume());
+	return 1;
+}
+
+void LuaVoxelManipView::create(lua_State *L, int vm_index, Field field)
+{
+	if (vm_index < 0)
+		vm_index = lua_gettop(L) + vm_index + 1;
+	LuaVoxelManip *vm = LuaVoxelManip::checkobject(L, vm_index);
+
+	*(void **)(lua_newuserdata(L, sizeof(void *))) =
+		new LuaVoxelManipView(vm, field);
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+
+	// Keep the VoxelManip alive as long as the view
+	lua_newtable(L);
+	lua_pushvalue(L, vm_index);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+}
+
+void LuaVoxelManipView::Register(lua_State *L)
+{
+	luaL_newmetatable(L, className);
+	int metatable = lua_gettop(L);
+
+	lua_pushliteral(L, "__metatable");
+	lua_pushstring(L, className);
+	lua_settable(L, metatable);  // hide metatable from Lua getmetatable()
+
+	lua_pushliteral(L, "__index");
+	lua_pushcfunction(L, mt_index);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__newindex");
+	lua_pushcfunction(L, mt_newindex);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__len");
+	lua_pushcfunction(L, mt_len);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__gc");
+	lua_pushcfunction(L, gc_object);
+	lua_settable(L, metatable);
+
+	lua_pop(L, 1);  // drop metatable
+}
+
+const char LuaVoxelManipView::className[] = "VoxelManipView";
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <map>
 #include "irr_v3d.h"
+#include "voxel.h"
 #include "lua_api/l_base.h"
 
 class Map;
@@ -63,6 +64,15 @@ class LuaVoxelManip : public ModApiBase
 	static int l_was_modified(lua_State *L);
 	static int l_get_emerged_area(lua_State *L);
 
+	static int l_get_data_view(lua_State *L);
+	static int l_fill(lua_State *L);
+	static int l_replace(lua_State *L);
+	static int l_copy_from(lua_State *L);
+
+	// Reads an area given by the arguments at index and index + 1,
+	// defaulting to the whole VoxelManip, which has to contain it
+	VoxelArea readArea(lua_State *L, int index);
+
 public:
 	MMVManip *vm = nullptr;
 
@@ -79,3 +89,41 @@ class LuaVoxelManip : public ModApiBase
 
 	static void Register(lua_State *L);
 };
+
+/*
+  VoxelManipView: flat array access to one field of the nodes of a
+  VoxelManip without copying them into a table
+ */
+class LuaVoxelManipView : public ModApiBase
+{
+public:
+	enum Field : u8 {
+		FIELD_CONTENT,
+		FIELD_LIGHT,
+		FIELD_PARAM2,
+	};
+
+private:
+	LuaVoxelManip *m_vm;
+	Field m_field;
+
+	static const char className[];
+
+	static int gc_object(lua_State *L);
+
+	// view[i]
+	static int mt_index(lua_State *L);
+	// view[i] = value
+	static int mt_newindex(lua_State *L);
+	// #view
+	static int mt_len(lua_State *L);
+
+public:
+	LuaVoxelManipView(LuaVoxelManip *vm, Field field) : m_vm(vm), m_field(field) {}
+
+	// Creates a view of the VoxelManip at vm_index and leaves it on top of
+	// stack. The view keeps the VoxelManip alive.
+	static void create(lua_State *L, int vm_index, Field field);
+
+	static void Register(lua_State *L);
+};
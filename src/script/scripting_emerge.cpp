@@ -0,0 +1,119 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "scripting_emerge.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "server.h"
+#include "log.h"
+#include "settings.h"
+#include "voxel.h"
+#include "cpp_api/s_internal.h"
+#include "common/c_converter.h"
+#include "lua_api/l_areastore.h"
+#include "lua_api/l_base.h"
+#include "lua_api/l_item.h"
+#include "lua_api/l_mapgen.h"
+#include "lua_api/l_noise.h"
+#include "lua_api/l_server.h"
+#include "lua_api/l_settings.h"
+#include "lua_api/l_util.h"
+#include "lua_api/l_vmanip.h"
+
+EmergeScripting::EmergeScripting(Server *server, EmergeParams *emerge_params):
+		ScriptApiBase(ScriptingType::Emerge),
+		m_emerge_params(emerge_params)
+{
+	setGameDef(server);
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	if (g_settings->getBool("secure.enable_security"))
+		initializeSecurity();
+
+	lua_getglobal(L, "core");
+	int top = lua_gettop(L);
+
+	// Initialize our lua_api modules
+	InitializeModApi(L, top);
+	lua_pop(L, 1);
+
+	// Push builtin initialization type
+	lua_pushstring(L, "emerge");
+	lua_setglobal(L, "INIT");
+}
+
+EmergeScripting::~EmergeScripting()
+{
+	delete m_emerge_params;
+}
+
+void EmergeScripting::InitializeModApi(lua_State *L, int top)
+{
+	// Register reference classes (userdata)
+	LuaAreaStore::Register(L);
+	LuaPerlinNoise::Register(L);
+	LuaPerlinNoiseMap::Register(L);
+	LuaPseudoRandom::Register(L);
+	LuaPcgRandom::Register(L);
+	LuaSecureRandom::Register(L);
+	LuaSettings::Register(L);
+	LuaVoxelManip::Register(L);
+
+	// Initialize mod api modules
+	ModApiItemMod::InitializeEmerge(L, top);
+	ModApiMapgen::InitializeEmerge(L, top);
+	ModApiServer::InitializeEmerge(L, top);
+	ModApiUtil::InitializeAsync(L, top);
+}
+
+void EmergeScripting::loadScripts(
+		const std::vector<std::pair<std::string, std::string>> &scripts)
+{
+	loadMod(getServer()->getBuiltinLuaPath() + DIR_DELIM "init.lua",
+			BUILTIN_MOD_NAME);
+
+	for (const auto &script : scripts)
+		loadMod(script.second, script.first);
+}
+
+void EmergeScripting::on_generated(BlockMakeData *bmdata, u32 blockseed)
+{
+	SCRIPTAPI_PRECHECKHEADER
+
+	v3s16 minp = bmdata->blockpos_min * MAP_BLOCKSIZE;
+	v3s16 maxp = bmdata->blockpos_max * MAP_BLOCKSIZE +
+			v3s16(1, 1, 1) * (MAP_BLOCKSIZE - 1);
+
+	// Get core.registered_on_generateds
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_on_generateds");
+
+	// The VoxelManip of the mapgen, changes to it end up in the map
+	LuaVoxelManip *o = new LuaVoxelManip(bmdata->vmanip, true);
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, "VoxelManip");
+	lua_setmetatable(L, -2);
+
+	// Call callbacks
+	push_v3s16(L, minp);
+	push_v3s16(L, maxp);
+	lua_pushnumber(L, blockseed);
+	runCallbacks(4, RUN_CALLBACKS_MODE_FIRST);
+}
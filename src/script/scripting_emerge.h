@@ -0,0 +1,58 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+#include "cpp_api/s_base.h"
+#include "cpp_api/s_security.h"
+
+class EmergeParams;
+struct BlockMakeData;
+
+/*****************************************************************************/
+/* Scripting <-> Mapgen Interface                                            */
+/*****************************************************************************/
+
+/*
+	The Lua environment of an EmergeThread. Mods run their mapgen scripts in
+	it to modify chunks before they are put into the map, without holding the
+	environment lock. Only thread-safe APIs are available.
+*/
+class EmergeScripting:
+		virtual public ScriptApiBase,
+		public ScriptApiSecurity
+{
+public:
+	// Takes ownership of emerge_params
+	EmergeScripting(Server *server, EmergeParams *emerge_params);
+	~EmergeScripting();
+
+	// Runs builtin and the given (mod name, path) scripts, throws ModError
+	void loadScripts(const std::vector<std::pair<std::string, std::string>> &scripts);
+
+	// Runs core.registered_on_generateds on a chunk made by the mapgen
+	void on_generated(BlockMakeData *bmdata, u32 blockseed);
+
+	// Clones of the mapgen managers owned by this environment
+	EmergeParams *getEmergeParams() { return m_emerge_params; }
+
+private:
+	void InitializeModApi(lua_State *L, int top);
+
+	EmergeParams *m_emerge_params;
+};
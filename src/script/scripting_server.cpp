@@ -85,6 +85,9 @@ ServerScripting::ServerScripting(Server* server):
 	lua_pushstring(L, "game");
 	lua_setglobal(L, "INIT");
 
+	asyncEngine.setGameDef(server);
+	asyncEngine.registerStateInitializer(InitializeAsync);
+
 	infostream << "SCRIPTAPI: Initialized game modules" << std::endl;
 }
 
@@ -125,3 +128,60 @@ void ServerScripting::InitializeModApi(lua_State *L, int top)
 	ModApiStorage::Initialize(L, top);
 	ModApiChannels::Initialize(L, top);
 }
+
+void ServerScripting::InitializeAsync(lua_State *L, int top)
+{
+	// Only what is safe to use without the environment and the map
+	LuaAreaStore::Register(L);
+	LuaPerlinNoise::Register(L);
+	LuaPerlinNoiseMap::Register(L);
+	LuaPseudoRandom::Register(L);
+	LuaPcgRandom::Register(L);
+	LuaSecureRandom::Register(L);
+	LuaSettings::Register(L);
+
+	ModApiUtil::InitializeAsync(L, top);
+}
+
+void ServerScripting::stepAsync()
+{
+	if (asyncEngine.isInitialized())
+		asyncEngine.step(getStack());
+}
+
+unsigned int ServerScripting::queueAsync(const std::string &serialized_func,
+		const std::string &serialized_param, const std::string &mod_origin)
+{
+	// Jobs queued at load time wait for the init files of all mods
+	m_async_queued = true;
+	if (m_async_enabled && !asyncEngine.isInitialized())
+		startAsync();
+
+	return asyncEngine.queueAsyncJob(serialized_func, serialized_param,
+			mod_origin);
+}
+
+void ServerScripting::enableAsync()
+{
+	m_async_enabled = true;
+	if (m_async_queued)
+		startAsync();
+}
+
+void ServerScripting::startAsync()
+{
+	s16 threads = g_settings->getS16("num_async_threads");
+	if (threads <= 0)
+		threads = Thread::getNumberOfProcessors() - 2;
+	threads = MYMAX(threads, 1);
+
+	infostream << "SCRIPTAPI: Starting " << threads
+		<< " async environment threads" << std::endl;
+	asyncEngine.initialize(threads);
+}
+
+void ServerScripting::registerAsyncInitFile(const std::string &mod_name,
+		const std::string &path)
+{
+	asyncEngine.registerInitFile(mod_name, path);
+}
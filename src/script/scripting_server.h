@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 #include "cpp_api/s_base.h"
+#include "cpp_api/s_async.h"
 #include "cpp_api/s_entity.h"
 #include "cpp_api/s_env.h"
 #include "cpp_api/s_inventory.h"
@@ -48,6 +49,27 @@ class ServerScripting:
 
 	// use ScriptApiBase::loadMod() to load mods
 
+	// Pass finished async jobs back to their callbacks
+	void stepAsync();
+
+	// Queue a job in the async environment. It is started on first use
+	// once all mods are loaded.
+	unsigned int queueAsync(const std::string &serialized_func,
+			const std::string &serialized_param, const std::string &mod_origin);
+
+	// Register a file to be run by every async environment at startup
+	void registerAsyncInitFile(const std::string &mod_name, const std::string &path);
+	// Called when all mods are loaded, no init files can be added after this
+	void enableAsync();
+	bool isAsyncEnabled() const { return m_async_enabled; }
+
 private:
 	void InitializeModApi(lua_State *L, int top);
+	static void InitializeAsync(lua_State *L, int top);
+
+	void startAsync();
+
+	AsyncEngine asyncEngine;
+	bool m_async_enabled = false;
+	bool m_async_queued = false;
 };
@@ -22,6 +22,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 
 #include "zlib.h"
+#if USE_ZSTD
+#include <zstd.h>
+#include <memory>
+#endif
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -197,8 +201,171 @@ void decompressZlib(std::istream &is, std::ostream &os, size_t limit)
 	inflateEnd(&z);
 }
 
+#if USE_ZSTD
+
+struct ZstdDeleter {
+	void operator()(ZSTD_CCtx *ctx) { ZSTD_freeCCtx(ctx); }
+	void operator()(ZSTD_DCtx *ctx) { ZSTD_freeDCtx(ctx); }
+	void operator()(ZSTD_CDict *dict) { ZSTD_freeCDict(dict); }
+	void operator()(ZSTD_DDict *dict) { ZSTD_freeDDict(dict); }
+};
+
+// Map dictionary, read-only while the map is in use
+static std::unique_ptr<ZSTD_CDict, ZstdDeleter> g_zstd_cdict;
+static std::unique_ptr<ZSTD_DDict, ZstdDeleter> g_zstd_ddict;
+
+// Contexts are expensive to create, keep one per thread
+static ZSTD_CCtx *getZstdCCtx()
+{
+	thread_local std::unique_ptr<ZSTD_CCtx, ZstdDeleter> ctx(ZSTD_createCCtx());
+	if (!ctx)
+		throw SerializationError("compressZstd: ZSTD_createCCtx failed");
+	return ctx.get();
+}
+
+static ZSTD_DCtx *getZstdDCtx()
+{
+	thread_local std::unique_ptr<ZSTD_DCtx, ZstdDeleter> ctx(ZSTD_createDCtx());
+	if (!ctx)
+		throw SerializationError("decompressZstd: ZSTD_createDCtx failed");
+	return ctx.get();
+}
+
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os,
+		int level, bool use_dictionary)
+{
+	ZSTD_CCtx *ctx = getZstdCCtx();
+	ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+	// A dictionary carries its own compression level
+	if (use_dictionary && g_zstd_cdict)
+		ZSTD_CCtx_refCDict(ctx, g_zstd_cdict.get());
+	else
+		ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+
+	std::string buf(ZSTD_compressBound(data_size), '\0');
+	size_t ret = ZSTD_compress2(ctx, &buf[0], buf.size(), data, data_size);
+	if (ZSTD_isError(ret))
+		throw SerializationError(std::string("compressZstd: ") +
+				ZSTD_getErrorName(ret));
+	os.write(buf.c_str(), ret);
+}
+
+void decompressZstd(std::istream &is, std::ostream &os, bool use_dictionary)
+{
+	ZSTD_DCtx *ctx = getZstdDCtx();
+	ZSTD_DCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+	if (use_dictionary && g_zstd_ddict)
+		ZSTD_DCtx_refDDict(ctx, g_zstd_ddict.get());
+
+	const size_t bufsize = 16384;
+	char input_buffer[bufsize];
+	char output_buffer[bufsize];
+	ZSTD_inBuffer input = {input_buffer, 0, 0};
+
+	for (;;) {
+		if (input.pos == input.size) {
+			is.read(input_buffer, bufsize);
+			input.size = is.gcount();
+			input.pos = 0;
+		}
+
+		ZSTD_outBuffer output = {output_buffer, bufsize, 0};
+		size_t ret = ZSTD_decompressStream(ctx, &output, &input);
+		if (ZSTD_isError(ret))
+			throw SerializationError(std::string("decompressZstd: ") +
+					ZSTD_getErrorName(ret));
+		os.write(output_buffer, output.pos);
+
+		// The frame is complete and flushed
+		if (ret == 0)
+			break;
+		if (input.size == 0 && output.pos == 0)
+			throw SerializationError("decompressZstd: stream ended halfway");
+	}
+
+	// Unget all the data that belongs to whatever follows the frame
+	is.clear(); // Just in case EOF is set
+	for (size_t i = input.pos; i < input.size; i++) {
+		is.unget();
+		if (is.fail() || is.bad())
+			throw SerializationError("decompressZstd: unget failed");
+	}
+}
+
+bool setZstdDictionary(const std::string &dict)
+{
+	g_zstd_cdict.reset();
+	g_zstd_ddict.reset();
+	if (dict.empty())
+		return true;
+
+	g_zstd_cdict.reset(ZSTD_createCDict(dict.c_str(), dict.size(),
+			ZSTD_CLEVEL_DEFAULT));
+	g_zstd_ddict.reset(ZSTD_createDDict(dict.c_str(), dict.size()));
+	if (!g_zstd_cdict || !g_zstd_ddict) {
+		g_zstd_cdict.reset();
+		g_zstd_ddict.reset();
+		return false;
+	}
+	return true;
+}
+
+#else
+
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os,
+		int level, bool use_dictionary)
+{
+	throw SerializationError("compressZstd: built without zstd support");
+}
+
+void decompressZstd(std::istream &is, std::ostream &os, bool use_dictionary)
+{
+	throw SerializationError("decompressZstd: built without zstd support");
+}
+
+bool setZstdDictionary(const std::string &dict)
+{
+	return dict.empty();
+}
+
+#endif
+
+void compressZstd(const std::string &data, std::ostream &os,
+		int level, bool use_dictionary)
+{
+	compressZstd((const u8 *)data.c_str(), data.size(), os, level,
+			use_dictionary);
+}
+
+void compress(const u8 *data, size_t data_size, std::ostream &os, u8 version,
+		bool use_dictionary)
+{
+	if (version >= SER_FMT_VER_ZSTD) {
+		compressZstd(data, data_size, os, 0, use_dictionary);
+		return;
+	}
+	if (version >= 11) {
+		compressZlib(data, data_size, os);
+		return;
+	}
+
+	compress(SharedBuffer<u8>(data, data_size), os, version);
+}
+
+void compress(const std::string &data, std::ostream &os, u8 version,
+		bool use_dictionary)
+{
+	compress((const u8 *)data.c_str(), data.size(), os, version,
+			use_dictionary);
+}
+
 void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version)
 {
+	if (version >= SER_FMT_VER_ZSTD) {
+		compressZstd(*data, data.getSize(), os);
+		return;
+	}
+
 	if(version >= 11)
 	{
 		compressZlib(*data ,data.getSize(), os);
@@ -240,8 +407,14 @@ void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version)
 	os.write((char*)&current_byte, 1);
 }
 
-void decompress(std::istream &is, std::ostream &os, u8 version)
+void decompress(std::istream &is, std::ostream &os, u8 version,
+		bool use_dictionary)
 {
+	if (version >= SER_FMT_VER_ZSTD) {
+		decompressZstd(is, os, use_dictionary);
+		return;
+	}
+
 	if(version >= 11)
 	{
 		decompressZlib(is, os);
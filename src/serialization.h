@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "irrlichttypes.h"
 #include "exceptions.h"
+#include "config.h"
 #include <iostream>
 #include "util/pointer.h"
 
@@ -63,13 +64,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	26: Never written; read the same as 25
 	27: Added light spreading flags to blocks
 	28: Added "private" flag to NodeMetadata
+	29: Node data and metadata compressed with zstd (only if built with it)
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
 // Highest supported serialization version
+#if USE_ZSTD
+#define SER_FMT_VER_HIGHEST_READ 29
+#else
 #define SER_FMT_VER_HIGHEST_READ 28
-// Saved on disk version
+#endif
+// Saved on disk version, unless map_compression selects zstd
 #define SER_FMT_VER_HIGHEST_WRITE 28
+// First version using zstd instead of zlib
+#define SER_FMT_VER_ZSTD 29
 // Lowest supported serialization version
 #define SER_FMT_VER_LOWEST_READ 0
 // Lowest serialization version for writing
@@ -89,7 +97,26 @@ void compressZlib(const u8 *data, size_t data_size, std::ostream &os, int level
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os, size_t limit = 0);
 
-// These choose between zlib and a self-made one according to version
+// These throw SerializationError when built without zstd.
+// use_dictionary selects the map dictionary set by setZstdDictionary(),
+// which is only meant for data that is stored on disk.
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os,
+		int level = 0, bool use_dictionary = false);
+void compressZstd(const std::string &data, std::ostream &os,
+		int level = 0, bool use_dictionary = false);
+void decompressZstd(std::istream &is, std::ostream &os,
+		bool use_dictionary = false);
+
+// Sets the dictionary used for map data on disk; an empty string removes it.
+// Must not be called while other threads (de)compress map data.
+// Returns false if the dictionary could not be loaded.
+bool setZstdDictionary(const std::string &dict);
+
+// These choose between zstd, zlib and a self-made one according to version
+void compress(const u8 *data, size_t data_size, std::ostream &os, u8 version,
+		bool use_dictionary = false);
 void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version);
-//void compress(const std::string &data, std::ostream &os, u8 version);
-void decompress(std::istream &is, std::ostream &os, u8 version);
+void compress(const std::string &data, std::ostream &os, u8 version,
+		bool use_dictionary = false);
+void decompress(std::istream &is, std::ostream &os, u8 version,
+		bool use_dictionary = false);
@@ -394,6 +394,17 @@ void Server::init()
 	//lock environment
 	MutexAutoLock envlock(m_env_mutex);
 
+	// Blocks written with a dictionary depend on it, so the world gets its
+	// own copy of the game's dictionary instead of following game updates
+	if (g_settings->get("map_compression") == "zstd") {
+		std::string world_dict = m_path_world + DIR_DELIM "zstd_dictionary";
+		std::string game_dict = m_gamespec.path + DIR_DELIM "zstd_dictionary";
+		if (!fs::PathExists(world_dict) && fs::PathExists(game_dict) &&
+				!fs::CopyFileContents(game_dict, world_dict))
+			warningstream << "Server: Failed to copy zstd_dictionary of the game"
+					<< std::endl;
+	}
+
 	// Create the Map (loads map_meta.txt, overriding configured mapgen params)
 	ServerMap *servermap = new ServerMap(m_path_world, this, m_emerge, m_metrics_backend.get());
 
@@ -598,6 +609,8 @@ void Server::AsyncRunStep(bool initial_step)
 		m_env->reportMaxLagEstimate(max_lag);
 		// Step environment
 		m_env->step(dtime);
+		// Run callbacks of finished async jobs
+		m_script->stepAsync();
 	}
 
 	static const float map_timer_and_unload_dtime = 2.92;
@@ -2333,10 +2346,8 @@ void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
 		Create a packet with the block in the right format
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os);
-	std::string s = os.str();
+	// Compressed once and shared by all clients until the block changes
+	const std::string &s = block->serializeNetwork(ver);
 
 	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + s.size(), peer_id);
 
@@ -2907,6 +2918,7 @@ void Server::DeleteClient(session_t peer_id, ClientDeletionReason reason)
 		{
 			MutexAutoLock env_lock(m_env_mutex);
 			m_clients.DeleteClient(peer_id);
+			m_emerge->removeViewpoint(peer_id);
 		}
 	}
 
@@ -17,27 +17,135 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
+#include <cmath>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
 #include "activeobjectmgr.h"
 
+// Edge length of the cells of the object position grid
+#define ACTIVEOBJECT_GRID_CELL_SIZE (2 * MAP_BLOCKSIZE * BS)
+
 namespace server
 {
 
+static inline s16 grid_coord(f32 v)
+{
+	f32 c = std::floor(v / ACTIVEOBJECT_GRID_CELL_SIZE);
+	// Written this way to also catch NaN
+	if (!(c > S16_MIN))
+		return S16_MIN;
+	return c < S16_MAX ? (s16)c : S16_MAX;
+}
+
+static inline u64 grid_key(s16 x, s16 y, s16 z)
+{
+	return ((u64)(u16)x << 32) | ((u64)(u16)y << 16) | (u64)(u16)z;
+}
+
+u64 ActiveObjectMgr::getCellKey(const v3f &pos)
+{
+	return grid_key(grid_coord(pos.X), grid_coord(pos.Y), grid_coord(pos.Z));
+}
+
+void ActiveObjectMgr::addToGrid(ServerActiveObject *obj)
+{
+	u64 key = getCellKey(obj->getBasePosition());
+	m_grid[key].push_back(obj);
+	m_object_cells[obj->getId()] = key;
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_objects.insert(obj);
+}
+
+// obj may already be deleted here, it is only compared against
+void ActiveObjectMgr::removeFromGrid(u16 id, ServerActiveObject *obj)
+{
+	auto cell_it = m_object_cells.find(id);
+	if (cell_it == m_object_cells.end())
+		return;
+
+	auto grid_it = m_grid.find(cell_it->second);
+	if (grid_it != m_grid.end()) {
+		std::vector<ServerActiveObject *> &cell = grid_it->second;
+		auto it = std::find(cell.begin(), cell.end(), obj);
+		if (it != cell.end()) {
+			*it = cell.back();
+			cell.pop_back();
+		}
+		if (cell.empty())
+			m_grid.erase(grid_it);
+	}
+	m_object_cells.erase(cell_it);
+	m_player_objects.erase(obj);
+}
+
+void ActiveObjectMgr::updateObjectPosition(ServerActiveObject *obj)
+{
+	// Objects that are not (yet) registered are not in the grid
+	auto cell_it = m_object_cells.find(obj->getId());
+	if (cell_it == m_object_cells.end() || getActiveObject(obj->getId()) != obj)
+		return;
+
+	u64 key = getCellKey(obj->getBasePosition());
+	if (key == cell_it->second)
+		return;
+
+	auto grid_it = m_grid.find(cell_it->second);
+	if (grid_it != m_grid.end()) {
+		std::vector<ServerActiveObject *> &cell = grid_it->second;
+		auto it = std::find(cell.begin(), cell.end(), obj);
+		if (it != cell.end()) {
+			*it = cell.back();
+			cell.pop_back();
+		}
+		if (cell.empty())
+			m_grid.erase(grid_it);
+	}
+	m_grid[key].push_back(obj);
+	cell_it->second = key;
+}
+
+void ActiveObjectMgr::forEachObjectNear(const v3f &minp, const v3f &maxp,
+		const std::function<void(ServerActiveObject *obj)> &cb)
+{
+	s16 x0 = grid_coord(minp.X), x1 = grid_coord(maxp.X);
+	s16 y0 = grid_coord(minp.Y), y1 = grid_coord(maxp.Y);
+	s16 z0 = grid_coord(minp.Z), z1 = grid_coord(maxp.Z);
+
+	// Looking at every object is cheaper than looking up many empty cells
+	u64 num_cells = (u64)(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+	if (num_cells > m_object_cells.size()) {
+		for (auto &it : m_active_objects)
+			cb(it.second);
+		return;
+	}
+
+	for (s32 z = z0; z <= z1; z++)
+	for (s32 y = y0; y <= y1; y++)
+	for (s32 x = x0; x <= x1; x++) {
+		auto grid_it = m_grid.find(grid_key(x, y, z));
+		if (grid_it == m_grid.end())
+			continue;
+		for (ServerActiveObject *obj : grid_it->second)
+			cb(obj);
+	}
+}
+
 void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)> &cb)
 {
-	std::vector<u16> objects_to_remove;
+	std::vector<std::pair<u16, ServerActiveObject *>> objects_to_remove;
 	for (auto &it : m_active_objects) {
 		if (cb(it.second, it.first)) {
 			// Id to be removed from m_active_objects
-			objects_to_remove.push_back(it.first);
+			objects_to_remove.emplace_back(it.first, it.second);
 		}
 	}
 
 	// Remove references from m_active_objects
-	for (u16 i : objects_to_remove) {
-		m_active_objects.erase(i);
+	for (const auto &it : objects_to_remove) {
+		removeFromGrid(it.first, it.second);
+		m_active_objects.erase(it.first);
 	}
 }
 
@@ -88,6 +196,7 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 	}
 
 	m_active_objects[obj->getId()] = obj;
+	addToGrid(obj);
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
@@ -106,6 +215,7 @@ void ActiveObjectMgr::removeObject(u16 id)
 		return;
 	}
 
+	removeFromGrid(id, obj);
 	m_active_objects.erase(id);
 	delete obj;
 }
@@ -116,15 +226,28 @@ void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	v3f extent(radius, radius, radius);
+	forEachObjectNear(pos - extent, pos + extent, [&] (ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
-			continue;
+			return;
 
 		if (!include_obj_cb || include_obj_cb(obj))
 			result.push_back(obj);
-	}
+	});
+}
+
+void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
+		std::vector<ServerActiveObject *> &result,
+		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
+{
+	forEachObjectNear(box.MinEdge, box.MaxEdge, [&] (ServerActiveObject *obj) {
+		if (!box.isPointInside(obj->getBasePosition()))
+			return;
+
+		if (!include_obj_cb || include_obj_cb(obj))
+			result.push_back(obj);
+	});
 }
 
 void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
@@ -132,38 +255,43 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player and all player objects,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second;
-		if (!object)
-			continue;
-
-		if (object->isGone())
-			continue;
+	auto check_object = [&] (ServerActiveObject *object) {
+		if (!object || object->isGone())
+			return;
 
 		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
 		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
 			// Discard if too far
 			if (distance_f > player_radius && player_radius != 0)
-				continue;
+				return;
 		} else if (distance_f > radius)
-			continue;
+			return;
 
 		// Discard if already on current_objects
+		u16 id = object->getId();
 		auto n = current_objects.find(id);
 		if (n != current_objects.end())
-			continue;
+			return;
 		// Add to added_objects
 		added_objects.push(id);
-	}
+	};
+
+	v3f extent(radius, radius, radius);
+	forEachObjectNear(player_pos - extent, player_pos + extent,
+		[&] (ServerActiveObject *object) {
+			// Players are handled below, their range may be unlimited
+			if (object && object->getType() != ACTIVEOBJECT_TYPE_PLAYER)
+				check_object(object);
+		});
+
+	for (ServerActiveObject *object : m_player_objects)
+		check_object(object);
 }
 
 } // namespace server
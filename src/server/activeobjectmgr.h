@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
@@ -35,12 +37,37 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(ServerActiveObject *obj) override;
 	void removeObject(u16 id) override;
 
+	// Must be called when the position of a registered object changes,
+	// see ServerActiveObject::setBasePosition()
+	void updateObjectPosition(ServerActiveObject *obj);
+
 	void getObjectsInsideRadius(const v3f &pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
+	void getObjectsInArea(const aabb3f &box,
+			std::vector<ServerActiveObject *> &result,
+			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
 
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+private:
+	/*
+		Uniform grid of the object positions, so that area queries only
+		look at the objects near the area instead of every object.
+		Player objects are also kept in their own list because they may be
+		sent regardless of their distance.
+	*/
+	static u64 getCellKey(const v3f &pos);
+	void addToGrid(ServerActiveObject *obj);
+	void removeFromGrid(u16 id, ServerActiveObject *obj);
+	// Calls cb for every object in the cells touching the box [minp, maxp]
+	void forEachObjectNear(const v3f &minp, const v3f &maxp,
+			const std::function<void(ServerActiveObject *obj)> &cb);
+
+	std::unordered_map<u64, std::vector<ServerActiveObject *>> m_grid;
+	std::unordered_map<u16, u64> m_object_cells;
+	std::unordered_set<ServerActiveObject *> m_player_objects;
 };
 } // namespace server
@@ -76,6 +76,9 @@ void ServerModManager::loadMods(ServerScripting *script)
 
 	// Run a callback when mods are loaded
 	script->on_mods_loaded();
+
+	// Only now all async init files are known
+	script->enableAsync();
 }
 
 // clang-format on
@@ -24,8 +24,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "nodedef.h"
 #include "nodemetadata.h"
+#include "noise.h"
 #include "gamedef.h"
 #include "map.h"
+#include "pathfinder.h"
 #include "porting.h"
 #include "profiler.h"
 #include "raycast.h"
@@ -35,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
+#include "util/workerpool.h"
 #include "threading/mutex_auto_lock.h"
 #include "filesys.h"
 #include "gameparams.h"
@@ -460,6 +463,11 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 
 	m_player_database = openPlayerDatabase(player_backend_name, path_world, conf);
 	m_auth_database = openAuthDatabase(auth_backend_name, path_world, conf);
+
+	s16 abm_threads = resolve_thread_count("num_abm_threads");
+	// The server thread takes part in the scan itself
+	if (abm_threads > 1)
+		m_abm_workers.reset(new WorkerPool("ABMScan", abm_threads - 1));
 }
 
 ServerEnvironment::~ServerEnvironment()
@@ -498,6 +506,13 @@ ServerMap & ServerEnvironment::getServerMap()
 	return *m_map;
 }
 
+PathfinderCache *ServerEnvironment::getPathfinderCache()
+{
+	if (!m_pathfinder_cache)
+		m_pathfinder_cache.reset(new PathfinderCache(m_map, m_server->ndef()));
+	return m_pathfinder_cache.get();
+}
+
 RemotePlayer *ServerEnvironment::getPlayer(const session_t peer_id)
 {
 	for (RemotePlayer *player : m_players) {
@@ -730,6 +745,45 @@ struct ActiveABM
 	int chance;
 	std::vector<content_t> required_neighbors;
 	bool check_required_neighbors; // false if required_neighbors is known to be empty
+	int bulk_index = -1; // Index into ABMHandler::m_bulk if the ABM is triggered in bulk
+};
+
+// Matches of one bulk-triggered ABM in the block being processed
+struct ABMBulkTriggers
+{
+	ActiveBlockModifier *abm;
+	std::vector<v3s16> positions;
+	std::vector<MapNode> nodes;
+};
+
+/*
+	A block whose ABM triggers are collected on a worker thread and then
+	run on the server thread, see ABMHandler::scan()
+*/
+struct ABMBlockJob
+{
+	struct Trigger
+	{
+		ActiveABM *aabm;
+		v3s16 p0; // Relative to the block
+		content_t c;
+	};
+
+	v3s16 pos;
+	MapBlock *block;
+	// The block and its neighbours, indexed by neighborIndex().
+	// Looked up on the server thread since the map itself is not thread-safe.
+	MapBlock *neighbors[27];
+	// Seed for the chance rolls, the global myrand() is not thread-safe
+	u64 seed;
+	std::vector<Trigger> triggers;
+	// Whether any trigger depends on the nodes of the neighbours
+	bool uses_neighbors;
+
+	static inline int neighborIndex(s16 x, s16 y, s16 z)
+	{
+		return (x + 1) * 9 + (y + 1) * 3 + (z + 1);
+	}
 };
 
 class ABMHandler
@@ -737,6 +791,7 @@ class ABMHandler
 private:
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	std::vector<ABMBulkTriggers> m_bulk;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
@@ -764,6 +819,11 @@ class ABMHandler
 				chance = 1;
 			ActiveABM aabm;
 			aabm.abm = abm;
+			if (abm->getBulkTrigger()) {
+				aabm.bulk_index = m_bulk.size();
+				m_bulk.emplace_back();
+				m_bulk.back().abm = abm;
+			}
 			if (abm->getSimpleCatchUp()) {
 				float intervals = actual_interval / trigger_interval;
 				if(intervals == 0)
@@ -833,32 +893,50 @@ class ABMHandler
 		return active_object_count;
 
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	// Check the content type cache first to see whether
+	// there are any ABMs to be run at all for this block.
+	bool needsScan(MapBlock *block, int &blocks_cached)
 	{
-		if(m_aabms.empty() || block->isDummy())
-			return;
+		if (m_aabms.empty() || block->isDummy())
+			return false;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (block->contents_cached) {
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
+		if (!block->contents_cached && !block->do_not_cache_contents)
+			block->updateContents();
+
+		if (!block->contents_cached)
+			return true;
+
+		blocks_cached++;
+		if (!hasTriggerContent(block))
+			return false;
+
+		// The trigger content may be gone by now, a rebuild is
+		// still much cheaper than scanning the block for nothing.
+		if (block->contents_may_be_stale) {
+			block->updateContents();
+			if (block->contents_cached && !hasTriggerContent(block))
+				return false;
+		}
+		return true;
+	}
+
+	bool hasTriggerContent(MapBlock *block)
+	{
+		for (content_t c : block->contents) {
+			if (c < m_aabms.size() && m_aabms[c])
+				return true;
 		}
+		return false;
+	}
+
+	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		if (!needsScan(block, blocks_cached))
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
+		v3s16 blockpos = block->getPos();
 
 		u32 active_object_count_wider;
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
@@ -871,15 +949,6 @@ class ABMHandler
 		{
 			const MapNode &n = block->getNodeUnsafe(p0);
 			content_t c = n.getContent();
-			// Cache content types as we go
-			if (!block->contents_cached && !block->do_not_cache_contents) {
-				block->contents.insert(c);
-				if (block->contents.size() > 64) {
-					// Too many different nodes... don't try to cache
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-				}
-			}
 
 			if (c >= m_aabms.size() || !m_aabms[c])
 				continue;
@@ -918,11 +987,24 @@ class ABMHandler
 				neighbor_found:
 
 				abms_run++;
+				if (aabm.bulk_index >= 0) {
+					ABMBulkTriggers &bulk = m_bulk[aabm.bulk_index];
+					bulk.positions.push_back(p);
+					bulk.nodes.push_back(n);
+					continue;
+				}
+
 				// Call all the trigger variations
 				aabm.abm->trigger(m_env, p, n);
 				aabm.abm->trigger(m_env, p, n,
 					active_object_count, active_object_count_wider);
 
+				// The callbacks may have unloaded or replaced the block
+				if (isBlockGone(blockpos, block)) {
+					clearBulk();
+					return;
+				}
+
 				// Count surrounding objects again if the abms added any
 				if(m_env->m_added_objects > 0) {
 					active_object_count = countObjects(block, map, active_object_count_wider);
@@ -930,7 +1012,207 @@ class ABMHandler
 				}
 			}
 		}
-		block->contents_cached = !block->do_not_cache_contents;
+
+		applyBulk(blockpos, block, active_object_count, active_object_count_wider);
+	}
+
+	// Calls the bulk-triggered ABMs with everything collected for a block
+	void applyBulk(v3s16 blockpos, MapBlock *block, u32 active_object_count,
+			u32 active_object_count_wider)
+	{
+		ServerMap *map = &m_env->getServerMap();
+
+		for (ABMBulkTriggers &bulk : m_bulk) {
+			if (bulk.positions.empty())
+				continue;
+
+			bulk.abm->triggerBulk(m_env, bulk.positions, bulk.nodes,
+				active_object_count, active_object_count_wider);
+			bulk.positions.clear();
+			bulk.nodes.clear();
+
+			if (isBlockGone(blockpos, block)) {
+				clearBulk();
+				return;
+			}
+
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+	}
+
+	// Fills in the neighbours of job.block, to be called on the server thread
+	void prepareScan(ABMBlockJob &job)
+	{
+		ServerMap *map = &m_env->getServerMap();
+		v3s16 pos = job.block->getPos();
+		job.pos = pos;
+		for (s16 x = -1; x <= 1; x++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 z = -1; z <= 1; z++) {
+			job.neighbors[ABMBlockJob::neighborIndex(x, y, z)] =
+				(x || y || z) ? map->getBlockNoCreateNoEx(pos + v3s16(x, y, z)) :
+				job.block;
+		}
+		job.seed = ((u64)myrand() << 32) | myrand();
+		job.triggers.clear();
+		job.uses_neighbors = false;
+	}
+
+	// Like the first half of apply(), but only collects the triggers.
+	// This does not access the map or the environment and can run
+	// concurrently for different blocks.
+	void scan(ABMBlockJob &job)
+	{
+		MapBlock *block = job.block;
+		PcgRandom rand(job.seed);
+
+		v3s16 p0;
+		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
+		{
+			content_t c = block->getNodeUnsafe(p0).getContent();
+
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+
+			for (ActiveABM &aabm : *m_aabms[c]) {
+				if (rand.next() % aabm.chance != 0)
+					continue;
+
+				if (aabm.check_required_neighbors) {
+					if (!hasRequiredNeighbor(job, p0, aabm))
+						continue;
+					job.uses_neighbors = true;
+				}
+
+				job.triggers.push_back({&aabm, p0, c});
+			}
+		}
+	}
+
+	// Runs the triggers collected by scan(), on the server thread
+	void applyScanned(ABMBlockJob &job, int &abms_run)
+	{
+		if (job.triggers.empty())
+			return;
+
+		MapBlock *block = job.block;
+		ServerMap *map = &m_env->getServerMap();
+
+		// The Lua callbacks of earlier jobs may have unloaded or replaced
+		// the blocks the triggers were collected from
+		if (!isJobCurrent(job))
+			return;
+
+		u32 active_object_count_wider;
+		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+		m_env->m_added_objects = 0;
+
+		for (const ABMBlockJob::Trigger &t : job.triggers) {
+			// An earlier trigger may have changed the node in the meantime
+			MapNode n = block->getNodeNoEx(t.p0);
+			if (n.getContent() != t.c)
+				continue;
+
+			v3s16 p = t.p0 + block->getPosRelative();
+
+			abms_run++;
+			if (t.aabm->bulk_index >= 0) {
+				ABMBulkTriggers &bulk = m_bulk[t.aabm->bulk_index];
+				bulk.positions.push_back(p);
+				bulk.nodes.push_back(n);
+				continue;
+			}
+
+			// Call all the trigger variations
+			t.aabm->abm->trigger(m_env, p, n);
+			t.aabm->abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
+
+			// So may the callbacks of this job
+			if (isBlockGone(job.pos, block)) {
+				clearBulk();
+				return;
+			}
+
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+
+		applyBulk(job.pos, block, active_object_count, active_object_count_wider);
+	}
+
+private:
+	// Lua callbacks may unload or replace blocks, after which the pointer
+	// must not be used anymore
+	bool isBlockGone(v3s16 blockpos, MapBlock *block)
+	{
+		return m_env->getServerMap().getBlockNoCreateNoEx(blockpos) != block;
+	}
+
+	void clearBulk()
+	{
+		for (ABMBulkTriggers &bulk : m_bulk) {
+			bulk.positions.clear();
+			bulk.nodes.clear();
+		}
+	}
+
+	// Whether the block, and the neighbours if needed, are still the ones
+	// the job was scanned with
+	bool isJobCurrent(const ABMBlockJob &job)
+	{
+		ServerMap *map = &m_env->getServerMap();
+		if (map->getBlockNoCreateNoEx(job.pos) != job.block)
+			return false;
+		if (!job.uses_neighbors)
+			return true;
+
+		for (s16 x = -1; x <= 1; x++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 z = -1; z <= 1; z++) {
+			if (!x && !y && !z)
+				continue;
+			if (map->getBlockNoCreateNoEx(job.pos + v3s16(x, y, z)) !=
+					job.neighbors[ABMBlockJob::neighborIndex(x, y, z)])
+				return false;
+		}
+		return true;
+	}
+
+	static bool hasRequiredNeighbor(const ABMBlockJob &job, v3s16 p0,
+			const ActiveABM &aabm)
+	{
+		v3s16 p1;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if(p1 == p0)
+				continue;
+			// Which of the neighbouring blocks p1 is in
+			s16 bx = p1.X < 0 ? -1 : (p1.X >= MAP_BLOCKSIZE ? 1 : 0);
+			s16 by = p1.Y < 0 ? -1 : (p1.Y >= MAP_BLOCKSIZE ? 1 : 0);
+			s16 bz = p1.Z < 0 ? -1 : (p1.Z >= MAP_BLOCKSIZE ? 1 : 0);
+			MapBlock *block = job.neighbors[ABMBlockJob::neighborIndex(bx, by, bz)];
+
+			// Unloaded neighbours read as CONTENT_IGNORE, like Map::getNode()
+			content_t c = CONTENT_IGNORE;
+			if (block && !block->isDummy()) {
+				c = block->getNodeUnsafe(p1.X - bx * MAP_BLOCKSIZE,
+					p1.Y - by * MAP_BLOCKSIZE, p1.Z - bz * MAP_BLOCKSIZE).getContent();
+			}
+			if (CONTAINS(aabm.required_neighbors, c))
+				return true;
+		}
+		return false;
 	}
 };
 
@@ -1441,26 +1723,69 @@ void ServerEnvironment::step(float dtime)
 		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
 
-			i++;
+		if (m_abm_workers) {
+			// Scan all blocks on the worker pool first, then run the
+			// collected triggers here in the shuffled order.
+			std::vector<ABMBlockJob> jobs;
+			jobs.reserve(output.size());
+			for (const v3s16 &p : output) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block)
+					continue;
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+				if (!abmhandler.needsScan(block, blocks_cached))
+					continue;
+
+				jobs.emplace_back();
+				jobs.back().block = block;
+				abmhandler.prepareScan(jobs.back());
+			}
+			blocks_scanned = jobs.size();
 
-			u32 time_ms = timer.getTimerTime();
+			m_abm_workers->run(jobs.size(), [&] (size_t j, unsigned int worker) {
+				abmhandler.scan(jobs[j]);
+			});
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
+			for (ABMBlockJob &job : jobs) {
+				i++;
+
+				abmhandler.applyScanned(job, abms_run);
+
+				u32 time_ms = timer.getTimerTime();
+
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << jobs.size() << " scanned active blocks)" << std::endl;
+					break;
+				}
+			}
+		} else {
+			for (const v3s16 &p : output) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block)
+					continue;
+
+				i++;
+
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+
+				/* Handle ActiveBlockModifiers */
+				abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+
+				u32 time_ms = timer.getTimerTime();
+
+				if (time_ms > max_time_ms) {
+					warningstream << "active block modifiers took "
+						  << time_ms << "ms (processed " << i << " of "
+						  << output.size() << " active blocks)" << std::endl;
+					break;
+				}
 			}
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
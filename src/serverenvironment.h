@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
 #include <set>
+#include <memory>
 #include <random>
 
 class IGameDef;
@@ -42,6 +43,8 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerPool;
+class PathfinderCache;
 
 /*
 	{Active, Loading} block modifier interface.
@@ -67,10 +70,17 @@ class ActiveBlockModifier
 	virtual u32 getTriggerChance() = 0;
 	// Whether to modify chance to simulate time lost by an unnattended block
 	virtual bool getSimpleCatchUp() = 0;
+	// Whether to call triggerBulk() once per block instead of trigger()
+	// for every node
+	virtual bool getBulkTrigger() { return false; }
 	// This is called usually at interval for 1/chance of the nodes
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 		u32 active_object_count, u32 active_object_count_wider){};
+	// Like trigger(), with all the positions selected within one block
+	virtual void triggerBulk(ServerEnvironment *env,
+		const std::vector<v3s16> &positions, const std::vector<MapNode> &nodes,
+		u32 active_object_count, u32 active_object_count_wider){};
 };
 
 struct ABMWithState
@@ -209,6 +219,9 @@ class ServerEnvironment : public Environment
 
 	ServerMap & getServerMap();
 
+	// Navigation data kept between find_path calls
+	PathfinderCache *getPathfinderCache();
+
 	//TODO find way to remove this fct!
 	ServerScripting* getScriptIface()
 	{ return m_script; }
@@ -332,6 +345,19 @@ class ServerEnvironment : public Environment
 		return m_ao_manager.getObjectsInsideRadius(pos, radius, objects, include_obj_cb);
 	}
 
+	// Find all active objects inside an area
+	void getObjectsInArea(std::vector<ServerActiveObject *> &objects, const aabb3f &box,
+			std::function<bool(ServerActiveObject *obj)> include_obj_cb)
+	{
+		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
+	}
+
+	// Called by ServerActiveObject::setBasePosition()
+	void updateActiveObjectPosition(ServerActiveObject *obj)
+	{
+		m_ao_manager.updateObjectPosition(obj);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -454,6 +480,10 @@ class ServerEnvironment : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Threads scanning active blocks for ABM triggers, NULL if disabled
+	std::unique_ptr<WorkerPool> m_abm_workers;
+	// Created on the first pathfinder call
+	std::unique_ptr<PathfinderCache> m_pathfinder_cache;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
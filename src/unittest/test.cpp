@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "itemdef.h"
 #include "gamedef.h"
+#include "mapblock.h"
+#include "mapsector.h"
 #include "modchannels.h"
 #include "content/mods.h"
 #include "util/numeric.h"
@@ -34,6 +36,7 @@ content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
+content_t t_CONTENT_WATER_FLOWING;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -183,6 +186,8 @@ void TestGameDef::defineSomeNodes()
 	f.alpha = 128;
 	f.liquid_type = LIQUID_SOURCE;
 	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
 	for (TileDef &tiledef : f.tiledef)
@@ -230,6 +235,27 @@ void TestGameDef::defineSomeNodes()
 	f.is_ground_content = true;
 	idef->registerItem(itemdef);
 	t_CONTENT_BRICK = ndef->set(f.name, f);
+
+	//// Flowing water
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	itemdef.description = "Flowing Water";
+	f = ContentFeatures();
+	f.name = itemdef.name;
+	f.alpha = 128;
+	f.liquid_type = LIQUID_FLOWING;
+	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.floodable = false;
+	for (TileDef &tiledef : f.tiledef)
+		tiledef.name = "default_water.png";
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
+
+	ndef->resolveCrossrefs();
 }
 
 bool TestGameDef::joinModChannel(const std::string &channel)
@@ -294,6 +320,31 @@ bool run_tests()
 	return num_modules_failed;
 }
 
+////
+//// TestMap
+////
+
+TestMap::TestMap(IGameDef *gamedef, v3s16 blockpos_min, v3s16 blockpos_max,
+		const BlockFiller &fill_block) :
+	Map(gamedef)
+{
+	for (s16 z = blockpos_min.Z; z <= blockpos_max.Z; z++)
+	for (s16 x = blockpos_min.X; x <= blockpos_max.X; x++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = new MapSector(this, p2d, gamedef);
+		m_sectors[p2d] = sector;
+		for (s16 y = blockpos_min.Y; y <= blockpos_max.Y; y++)
+			fill_block(sector->createBlankBlock(y));
+	}
+}
+
+void TestMap::fillStoneBelowZero(MapBlock *block)
+{
+	MapNode n(block->getPos().Y < 0 ? t_CONTENT_STONE : CONTENT_AIR);
+	for (u32 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+		block->getData()[i] = n;
+}
+
 ////
 //// TestBase
 ////
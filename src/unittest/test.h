@@ -20,11 +20,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <exception>
+#include <functional>
 #include <vector>
 
 #include "irrlichttypes_extrabloated.h"
 #include "porting.h"
 #include "filesys.h"
+#include "map.h"
 #include "mapnode.h"
 
 class TestFailedException : public std::exception {
@@ -138,5 +140,20 @@ extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
+extern content_t t_CONTENT_WATER_FLOWING;
+
+// A map made of the mapblocks from blockpos_min to blockpos_max, each of
+// them filled by fill_block
+class TestMap : public Map
+{
+public:
+	typedef std::function<void(MapBlock *block)> BlockFiller;
+
+	TestMap(IGameDef *gamedef, v3s16 blockpos_min, v3s16 blockpos_max,
+			const BlockFiller &fill_block = fillStoneBelowZero);
+
+	// Stone below y = 0 and air above
+	static void fillStoneBelowZero(MapBlock *block);
+};
 
 bool run_tests();
@@ -39,6 +39,8 @@ class TestCompression : public TestBase {
 	void testZlibLargeData();
 	void testZlibLimit();
 	void _testZlibLimit(u32 size, u32 limit);
+	void testZstdLargeData();
+	void testZstdDictionary();
 };
 
 static TestCompression g_test_instance;
@@ -49,6 +51,10 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
 	TEST(testZlibLimit);
+#if USE_ZSTD
+	TEST(testZstdLargeData);
+	TEST(testZstdDictionary);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -111,7 +117,7 @@ void TestCompression::testZlibCompression()
 	fromdata[3]=1;
 
 	std::ostringstream os(std::ios_base::binary);
-	compress(fromdata, os, SER_FMT_VER_HIGHEST_READ);
+	compress(fromdata, os, SER_FMT_VER_HIGHEST_WRITE);
 
 	std::string str_out = os.str();
 
@@ -124,7 +130,7 @@ void TestCompression::testZlibCompression()
 	std::istringstream is(str_out, std::ios_base::binary);
 	std::ostringstream os2(std::ios_base::binary);
 
-	decompress(is, os2, SER_FMT_VER_HIGHEST_READ);
+	decompress(is, os2, SER_FMT_VER_HIGHEST_WRITE);
 	std::string str_out2 = os2.str();
 
 	infostream << "decompress: ";
@@ -233,3 +239,62 @@ void TestCompression::_testZlibLimit(u32 size, u32 limit)
 	}
 }
 
+
+void TestCompression::testZstdLargeData()
+{
+	u32 size = 50000;
+	std::string data_in;
+	data_in.resize(size);
+	PseudoRandom pseudorandom(9420);
+	for (u32 i = 0; i < size; i++)
+		data_in[i] = pseudorandom.range(0, 255);
+
+	// Data following the frame must be left in the stream
+	std::ostringstream os_compressed(std::ios::binary);
+	compress(data_in, os_compressed, SER_FMT_VER_ZSTD);
+	os_compressed << "trailer";
+
+	std::istringstream is_compressed(os_compressed.str(), std::ios::binary);
+	std::ostringstream os_decompressed(std::ios::binary);
+	decompress(is_compressed, os_decompressed, SER_FMT_VER_ZSTD);
+	UASSERT(os_decompressed.str() == data_in);
+
+	std::string trailer;
+	is_compressed >> trailer;
+	UASSERT(trailer == "trailer");
+
+	// Truncated data
+	std::string truncated = os_compressed.str().substr(0, 100);
+	std::istringstream is_truncated(truncated, std::ios::binary);
+	std::ostringstream os_truncated(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError,
+			decompress(is_truncated, os_truncated, SER_FMT_VER_ZSTD));
+}
+
+void TestCompression::testZstdDictionary()
+{
+	std::string dict;
+	for (u32 i = 0; i < 4096; i++)
+		dict += "default:stone default:dirt ";
+	UASSERT(setZstdDictionary(dict));
+
+	std::string data_in = "default:dirt default:stone default:dirt";
+	std::ostringstream os_dict(std::ios::binary);
+	compressZstd(data_in, os_dict, 0, true);
+	std::ostringstream os_plain(std::ios::binary);
+	compressZstd(data_in, os_plain, 0, false);
+	UASSERT(os_dict.str().size() < os_plain.str().size());
+
+	std::istringstream is_dict(os_dict.str(), std::ios::binary);
+	std::ostringstream os_decompressed(std::ios::binary);
+	decompressZstd(is_dict, os_decompressed, true);
+	UASSERT(os_decompressed.str() == data_in);
+
+	// Data without a dictionary is readable with one loaded
+	std::istringstream is_plain(os_plain.str(), std::ios::binary);
+	std::ostringstream os_plain_out(std::ios::binary);
+	decompressZstd(is_plain, os_plain_out, true);
+	UASSERT(os_plain_out.str() == data_in);
+
+	UASSERT(setZstdDictionary(""));
+}
@@ -0,0 +1,156 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "porting.h"
+
+class TestLiquids : public TestBase
+{
+public:
+	TestLiquids() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLiquids"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testFloodParallel(IGameDef *gamedef);
+};
+
+static TestLiquids g_test_instance;
+
+void TestLiquids::runTests(IGameDef *gamedef)
+{
+	TEST(testFloodParallel, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Flood benchmark world: a stone floor covering 6x6 mapblocks with pillars
+	and walls on it, and water sources dropped onto it from above.
+	Everything is generated from the coordinates, so every run is the same.
+*/
+class FloodTestMap : public TestMap
+{
+public:
+	FloodTestMap(IGameDef *gamedef) :
+		TestMap(gamedef, v3s16(0, -1, 0), v3s16(5, 1, 5), fillBlock)
+	{
+		for (s16 z = 8; z < 96; z += 16)
+		for (s16 x = 8; x < 96; x += 16) {
+			v3s16 p(x, 30, z);
+			MapNode n(t_CONTENT_WATER);
+			setNode(p, n);
+			transforming_liquid_add(p);
+		}
+	}
+
+	size_t queueSize() { return m_transforming_liquid.size(); }
+
+	u32 countNodes(content_t c)
+	{
+		u32 count = 0;
+		for (s16 z = 0; z < 96; z++)
+		for (s16 y = 0; y < 32; y++)
+		for (s16 x = 0; x < 96; x++)
+			count += getNode(v3s16(x, y, z)).getContent() == c;
+		return count;
+	}
+
+	std::string dump()
+	{
+		std::string result;
+		for (auto &sector : m_sectors) {
+			MapBlockVect blocks;
+			sector.second->getBlocks(blocks);
+			for (MapBlock *block : blocks) {
+				for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+				for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+				for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+					bool is_valid;
+					MapNode n = block->getNodeNoCheck(x, y, z, &is_valid);
+					result.append((char *)&n.param0, sizeof(n.param0));
+					result.push_back(n.param2);
+				}
+			}
+		}
+		return result;
+	}
+
+private:
+	static void fillBlock(MapBlock *block)
+	{
+		v3s16 base = block->getPosRelative();
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			v3s16 p = base + v3s16(x, y, z);
+			content_t c = CONTENT_AIR;
+			if (p.Y < 0)
+				c = t_CONTENT_STONE;
+			else if (p.Y < 3 && (p.X % 11 == 0 || p.Z % 13 == 0))
+				c = t_CONTENT_BRICK;
+			else if (p.Y < 8 && p.X % 7 == 3 && p.Z % 5 == 2)
+				c = t_CONTENT_STONE;
+			MapNode n(c);
+			block->setNodeNoCheck(x, y, z, n);
+		}
+	}
+};
+
+void TestLiquids::testFloodParallel(IGameDef *gamedef)
+{
+	const u32 max_steps = 2000;
+	std::string serial_result, parallel_results[2];
+
+	for (int run = 0; run < 3; run++) {
+		FloodTestMap map(gamedef);
+		map.setLiquidThreads(run == 0 ? 1 : run * 2);
+
+		u64 t = porting::getTimeMs();
+		u32 steps = 0;
+		while (map.queueSize() != 0 && steps < max_steps) {
+			std::map<v3s16, MapBlock *> modified_blocks;
+			map.transformLiquids(modified_blocks, nullptr);
+			steps++;
+		}
+		t = porting::getTimeMs() - t;
+		infostream << "TestLiquids: " << (run == 0 ? 1 : run * 2)
+			<< " thread(s): " << steps << " steps in " << t << "ms" << std::endl;
+
+		// The flood must settle, after spreading over the floor
+		UASSERT(steps < max_steps);
+		u32 flowing = map.countNodes(t_CONTENT_WATER_FLOWING);
+		infostream << "TestLiquids: " << flowing << " flowing nodes" << std::endl;
+		UASSERT(flowing > 1000);
+		if (run == 0)
+			serial_result = map.dump();
+		else
+			parallel_results[run - 1] = map.dump();
+	}
+
+	// Same result whatever the number of threads
+	UASSERT(parallel_results[0] == parallel_results[1]);
+	// and the flood settles the same way as node by node
+	UASSERT(parallel_results[0] == serial_result);
+}
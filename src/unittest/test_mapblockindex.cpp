@@ -0,0 +1,122 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <map>
+#include <memory>
+#include "mapblock.h"
+#include "mapblockindex.h"
+#include "noise.h"
+
+class TestMapBlockIndex : public TestBase
+{
+public:
+	TestMapBlockIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlockIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testInsertErase();
+	void testRandomized();
+};
+
+static TestMapBlockIndex g_test_instance;
+
+void TestMapBlockIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testInsertErase);
+	TEST(testRandomized);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlockIndex::testInsertErase()
+{
+	MapBlockIndex index;
+	MapBlock a(nullptr, v3s16(0, 0, 0), nullptr, true);
+	MapBlock b(nullptr, v3s16(-1, 2, -3), nullptr, true);
+	MapBlock b2(nullptr, v3s16(-1, 2, -3), nullptr, true);
+
+	UASSERT(index.get(v3s16(0, 0, 0)) == nullptr);
+	index.insert(&a);
+	index.insert(&b);
+	UASSERTEQ(size_t, index.size(), 2);
+	UASSERT(index.get(v3s16(0, 0, 0)) == &a);
+	UASSERT(index.get(v3s16(-1, 2, -3)) == &b);
+	UASSERT(index.get(v3s16(1, 2, 3)) == nullptr);
+
+	// Same position replaces
+	index.insert(&b2);
+	UASSERTEQ(size_t, index.size(), 2);
+	UASSERT(index.get(v3s16(-1, 2, -3)) == &b2);
+
+	index.erase(v3s16(0, 0, 0));
+	index.erase(v3s16(5, 5, 5));
+	UASSERTEQ(size_t, index.size(), 1);
+	UASSERT(index.get(v3s16(0, 0, 0)) == nullptr);
+	UASSERT(index.get(v3s16(-1, 2, -3)) == &b2);
+
+	index.clear();
+	UASSERTEQ(size_t, index.size(), 0);
+	UASSERT(index.get(v3s16(-1, 2, -3)) == nullptr);
+}
+
+void TestMapBlockIndex::testRandomized()
+{
+	// Dense and sparse positions, enough to grow and shrink the table
+	MapBlockIndex index;
+	std::map<v3s16, std::unique_ptr<MapBlock>> reference;
+	PcgRandom pr(1234);
+
+	for (int round = 0; round < 3; round++) {
+		for (int i = 0; i < 20000; i++) {
+			s16 range = (i % 2) ? 10 : 2000;
+			v3s16 p(pr.range(-range, range), pr.range(-range, range),
+				pr.range(-range, range));
+			if (reference.count(p))
+				continue;
+			MapBlock *block = new MapBlock(nullptr, p, nullptr, true);
+			reference[p].reset(block);
+			index.insert(block);
+		}
+		UASSERTEQ(size_t, index.size(), reference.size());
+
+		// Erase most of them
+		for (auto it = reference.begin(); it != reference.end();) {
+			if (pr.range(0, 9) < 8) {
+				index.erase(it->first);
+				it = reference.erase(it);
+			} else {
+				++it;
+			}
+		}
+		UASSERTEQ(size_t, index.size(), reference.size());
+
+		for (const auto &it : reference)
+			UASSERT(index.get(it.first) == it.second.get());
+		for (int i = 0; i < 10000; i++) {
+			v3s16 p(pr.range(-2000, 2000), pr.range(-2000, 2000),
+				pr.range(-2000, 2000));
+			auto it = reference.find(p);
+			UASSERT(index.get(p) ==
+				(it == reference.end() ? nullptr : it->second.get()));
+		}
+	}
+}
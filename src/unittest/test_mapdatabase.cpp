@@ -0,0 +1,209 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#include "filesys.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+	void runTestsForCurrentDB();
+
+	void testSaveLoad();
+	void testLoadBlocks();
+	void testDelete();
+	void testList();
+	void testListInArea();
+	void testMortonKey();
+
+private:
+	MapDatabase *map_db;
+};
+
+static TestMapDatabase g_test_instance;
+
+static std::string blockData(const v3s16 &pos)
+{
+	return "block " + std::to_string(pos.X) + " " + std::to_string(pos.Y) +
+		" " + std::to_string(pos.Z);
+}
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	std::string test_dir = getTestTempDirectory();
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	infostream << "Testing Dummy map database" << std::endl;
+	map_db = new Database_Dummy();
+	runTestsForCurrentDB();
+	delete map_db;
+
+	infostream << "Testing SQLite3 map database" << std::endl;
+	map_db = new MapDatabaseSQLite3(test_dir);
+	runTestsForCurrentDB();
+	delete map_db;
+
+	// Uses another table in the same file
+	infostream << "Testing SQLite3 map database with Z-order keys" << std::endl;
+	map_db = new MapDatabaseSQLite3(test_dir, true);
+	runTestsForCurrentDB();
+	delete map_db;
+
+	TEST(testMortonKey);
+}
+
+void TestMapDatabase::runTestsForCurrentDB()
+{
+	TEST(testSaveLoad);
+	TEST(testLoadBlocks);
+	TEST(testDelete);
+	TEST(testList);
+	TEST(testListInArea);
+}
+
+// Blocks on a line through the world, including the extremes
+static std::vector<v3s16> testPositions()
+{
+	std::vector<v3s16> positions;
+	for (s16 i = -2048; i < 2048; i += 37)
+		positions.emplace_back(i, -i / 2, -1 - i);
+	positions.emplace_back(0, 0, 0);
+	positions.emplace_back(-2048, -2048, -2048);
+	positions.emplace_back(2047, 2047, 2047);
+	return positions;
+}
+
+void TestMapDatabase::testSaveLoad()
+{
+	map_db->beginSave();
+	for (const v3s16 &pos : testPositions())
+		UASSERT(map_db->saveBlock(pos, blockData(pos)));
+	map_db->endSave();
+
+	for (const v3s16 &pos : testPositions()) {
+		std::string data;
+		map_db->loadBlock(pos, &data);
+		UASSERTEQ(std::string, data, blockData(pos));
+	}
+
+	std::string data;
+	map_db->loadBlock(v3s16(1, 2, 3), &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testLoadBlocks()
+{
+	// More than one batch, with missing and repeated blocks
+	std::vector<v3s16> positions = testPositions();
+	positions.emplace_back(1, 2, 3);
+	positions.push_back(positions[0]);
+	positions.insert(positions.begin(), v3s16(3, 2, 1));
+
+	std::vector<std::string> blocks;
+	map_db->loadBlocks(positions, &blocks);
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+
+	UASSERT(blocks.front().empty());
+	UASSERT(blocks[blocks.size() - 2].empty());
+	UASSERTEQ(std::string, blocks.back(), blockData(positions.back()));
+	for (size_t i = 1; i < positions.size() - 2; i++)
+		UASSERTEQ(std::string, blocks[i], blockData(positions[i]));
+
+	map_db->loadBlocks({}, &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMapDatabase::testDelete()
+{
+	v3s16 pos = testPositions()[0];
+	UASSERT(map_db->deleteBlock(pos));
+
+	std::string data;
+	map_db->loadBlock(pos, &data);
+	UASSERT(data.empty());
+}
+
+void TestMapDatabase::testList()
+{
+	std::vector<v3s16> positions = testPositions();
+	std::vector<v3s16> listed;
+	map_db->listAllLoadableBlocks(listed);
+	UASSERTEQ(size_t, listed.size(), positions.size() - 1);
+	for (size_t i = 1; i < positions.size(); i++)
+		UASSERT(std::find(listed.begin(), listed.end(), positions[i]) != listed.end());
+}
+
+void TestMapDatabase::testListInArea()
+{
+	map_db->beginSave();
+	for (s16 z = -3; z <= 4; z++)
+	for (s16 y = -3; y <= 4; y++)
+	for (s16 x = -3; x <= 4; x++)
+		map_db->saveBlock(v3s16(x, y, z), blockData(v3s16(x, y, z)));
+	map_db->endSave();
+
+	std::vector<v3s16> all;
+	map_db->listAllLoadableBlocks(all);
+
+	const std::pair<v3s16, v3s16> areas[] = {
+		{v3s16(-2, -1, 0), v3s16(3, 4, 2)},
+		{v3s16(0, 0, 0), v3s16(0, 0, 0)},
+		{v3s16(-100, -100, -100), v3s16(-2, 100, -2)},
+		{v3s16(1000, -2048, -1000), v3s16(2047, -500, 2047)},
+		{v3s16(1, 1, 1), v3s16(0, 0, 0)},
+	};
+	for (const auto &area : areas) {
+		const v3s16 &min = area.first, &max = area.second;
+		std::vector<v3s16> expected;
+		for (const v3s16 &pos : all) {
+			if (pos.X >= min.X && pos.Y >= min.Y && pos.Z >= min.Z &&
+					pos.X <= max.X && pos.Y <= max.Y && pos.Z <= max.Z)
+				expected.push_back(pos);
+		}
+
+		std::vector<v3s16> listed;
+		map_db->listBlocksInArea(min, max, listed);
+		UASSERTEQ(size_t, listed.size(), expected.size());
+		for (const v3s16 &pos : expected)
+			UASSERT(std::find(listed.begin(), listed.end(), pos) != listed.end());
+	}
+}
+
+void TestMapDatabase::testMortonKey()
+{
+	for (const v3s16 &pos : testPositions()) {
+		UASSERT(MapDatabase::getMortonKeyAsBlock(
+			MapDatabase::getBlockAsMortonKey(pos)) == pos);
+	}
+
+	UASSERTEQ(s64, MapDatabase::getBlockAsMortonKey(v3s16(-2048, -2048, -2048)), 0);
+	UASSERTEQ(s64, MapDatabase::getBlockAsMortonKey(v3s16(-2047, -2048, -2048)), 1);
+	UASSERTEQ(s64, MapDatabase::getBlockAsMortonKey(v3s16(-2048, -2047, -2048)), 2);
+	UASSERTEQ(s64, MapDatabase::getBlockAsMortonKey(v3s16(-2048, -2048, -2047)), 4);
+	UASSERTEQ(s64, MapDatabase::getBlockAsMortonKey(v3s16(2047, 2047, 2047)),
+		((s64) 1 << 36) - 1);
+}
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
+#include <vector>
 #include "exceptions.h"
 #include "noise.h"
 
@@ -35,6 +37,7 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -49,6 +52,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -121,6 +125,55 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimd()
+{
+	// Odd sizes for the vector loop remainders, with and without easing,
+	// absvalue and persistence maps, across lattice and integer boundaries
+	const NoiseParams params[] = {
+		NoiseParams(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0),
+		NoiseParams(0, 1, v3f(37, 23, 83), -4242, 4, 0.7, 2.3,
+			NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE),
+		NoiseParams(-3, 7, v3f(250, 120, 250), 7331, 6, 0.45, 1.7, 0),
+		NoiseParams(1, 1, v3f(3, 3, 3), 0, 1, 1.0, 2.0, NOISE_FLAG_ABSVALUE),
+	};
+	const v3f origins[] = {
+		v3f(0, 0, 0), v3f(-31000, 77, -2), v3f(29999.5f, -31000, 12345.25f),
+	};
+	const u32 sizes[][3] = {{40, 40, 40}, {37, 5, 23}, {1, 19, 3}};
+
+	std::vector<float> persist(40 * 40 * 40);
+	for (size_t i = 0; i != persist.size(); i++)
+		persist[i] = 0.3f + (i % 11) * 0.05f;
+
+	for (int level = NOISE_SIMD_SSE2; level <= noise_get_simd_support(); level++)
+	for (const NoiseParams &np : params)
+	for (const v3f &p : origins)
+	for (const auto &size : sizes)
+	for (bool use_persist : {false, true}) {
+		float *pmap = use_persist ? persist.data() : nullptr;
+		u32 count2d = size[0] * size[1];
+		u32 count3d = count2d * size[2];
+
+		Noise scalar_2d(const_cast<NoiseParams *>(&np), 1337, size[0], size[1]);
+		Noise simd_2d(const_cast<NoiseParams *>(&np), 1337, size[0], size[1]);
+		scalar_2d.simd_level = NOISE_SIMD_NONE;
+		simd_2d.simd_level = (NoiseSimdLevel)level;
+
+		float *expected = scalar_2d.perlinMap2D(p.X, p.Z, pmap);
+		float *actual = simd_2d.perlinMap2D(p.X, p.Z, pmap);
+		UASSERT(memcmp(expected, actual, count2d * sizeof(float)) == 0);
+
+		Noise scalar_3d(const_cast<NoiseParams *>(&np), 1337, size[0], size[1], size[2]);
+		Noise simd_3d(const_cast<NoiseParams *>(&np), 1337, size[0], size[1], size[2]);
+		scalar_3d.simd_level = NOISE_SIMD_NONE;
+		simd_3d.simd_level = (NoiseSimdLevel)level;
+
+		expected = scalar_3d.perlinMap3D(p.X, p.Y, p.Z, pmap);
+		actual = simd_3d.perlinMap3D(p.X, p.Y, p.Z, pmap);
+		UASSERT(memcmp(expected, actual, count3d * sizeof(float)) == 0);
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
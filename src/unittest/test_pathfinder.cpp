@@ -0,0 +1,137 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "pathfinder.h"
+
+class TestPathfinder : public TestBase {
+public:
+	TestPathfinder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestPathfinder"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testLongPath(IGameDef *gamedef);
+	void testChangedMap(IGameDef *gamedef);
+};
+
+static TestPathfinder g_test_instance;
+
+void TestPathfinder::runTests(IGameDef *gamedef)
+{
+	TEST(testLongPath, gamedef);
+	TEST(testChangedMap, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// 6x3x6 mapblocks of stone below y = 0 and air above
+class PathfinderTestMap : public TestMap
+{
+public:
+	PathfinderTestMap(IGameDef *gamedef) :
+		TestMap(gamedef, v3s16(0, -1, 0), v3s16(5, 1, 5))
+	{
+	}
+
+	// A wall at x = 48 too high to jump on, open where z is in gaps
+	void buildWall(const std::vector<s16> &gaps)
+	{
+		for (s16 z = 0; z < 6 * MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < 3; y++) {
+			bool gap = std::find(gaps.begin(), gaps.end(), z) != gaps.end();
+			MapNode n(gap ? CONTENT_AIR : t_CONTENT_STONE);
+			setNode(v3s16(48, y, z), n);
+		}
+	}
+};
+
+// Checks that every step of the path is a move the pathfinder may do
+static bool is_connected(const std::vector<v3s16> &path)
+{
+	for (size_t i = 1; i < path.size(); i++) {
+		v3s16 d = path[i] - path[i - 1];
+		if (abs(d.X) + abs(d.Z) != 1 || abs(d.Y) > 1)
+			return false;
+	}
+	return true;
+}
+
+void TestPathfinder::testLongPath(IGameDef *gamedef)
+{
+	PathfinderTestMap map(gamedef);
+	PathfinderCache cache(&map, gamedef->ndef());
+
+	v3s16 source(1, 0, 1);
+	v3s16 destination(90, 0, 85);
+	std::vector<v3s16> path = get_path(&cache, source, destination,
+		16, 1, 1, PA_PLAIN_NP);
+	UASSERT(!path.empty());
+	UASSERT(path.front() == source);
+	UASSERT(path.back() == destination);
+	UASSERT(is_connected(path));
+	// There are no obstacles, so no detour either
+	UASSERTEQ(size_t, path.size(), 89 + 84 + 1);
+	// The mapblocks are kept for the next call
+	UASSERT(cache.size() > 0);
+
+	// The other algorithms do not use the mapblock route
+	std::vector<v3s16> path_plain = get_path(&cache, source, destination,
+		16, 1, 1, PA_PLAIN);
+	UASSERTEQ(size_t, path_plain.size(), path.size());
+}
+
+void TestPathfinder::testChangedMap(IGameDef *gamedef)
+{
+	PathfinderTestMap map(gamedef);
+	PathfinderCache cache(&map, gamedef->ndef());
+
+	v3s16 source(10, 0, 20);
+	v3s16 destination(80, 0, 20);
+	std::vector<v3s16> path = get_path(&cache, source, destination,
+		80, 1, 1, PA_PLAIN_NP);
+	UASSERTEQ(size_t, path.size(), 71);
+
+	// The map is changed without any event, the path has to go around
+	map.buildWall({90});
+	path = get_path(&cache, source, destination, 80, 1, 1, PA_PLAIN_NP);
+	UASSERT(!path.empty());
+	UASSERT(path.back() == destination);
+	UASSERT(is_connected(path));
+	for (v3s16 p : path)
+		UASSERT(p.X != 48 || p.Z == 90);
+	UASSERTEQ(size_t, path.size(), 71 + 2 * 70);
+
+	// No way through at all
+	map.buildWall({});
+	path = get_path(&cache, source, destination, 80, 1, 1, PA_PLAIN_NP);
+	UASSERT(path.empty());
+	path = get_path(&cache, source, destination, 80, 1, 1, PA_PLAIN);
+	UASSERT(path.empty());
+
+	// Taller jumps get over the wall
+	path = get_path(&cache, source, destination, 80, 3, 3, PA_PLAIN_NP);
+	UASSERT(!path.empty());
+	UASSERT(path.back() == destination);
+}
@@ -48,6 +48,8 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testGetObjectsInArea();
+	void testUpdateObjectPosition();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -59,6 +61,8 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testGetObjectsInArea);
+	TEST(testUpdateObjectPosition);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -198,3 +202,83 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(new TestServerActiveObject(p));
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(0, 0, 0, 10, 40, 10), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-200, -740, -304, 740, 100, 10), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 4);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-1e6, -1e6, -1e6, 1e6, 1e6, 1e6), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(20, 40, 10, 700, 40, 10), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::testUpdateObjectPosition()
+{
+	server::ActiveObjectMgr saomgr;
+	std::vector<ServerActiveObject *> objects;
+	// Enough objects for the queries to use the grid
+	for (int i = 0; i < 200; i++) {
+		auto tsao = new TestServerActiveObject(v3f(i * 100, 0, 0));
+		saomgr.registerObject(tsao);
+		objects.push_back(tsao);
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(-5000, 0, 0), 100, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	// There is no environment to notify the manager, do it here
+	for (int i = 0; i < 3; i++) {
+		objects[i]->setBasePosition(v3f(-5000, i * 10, 0));
+		saomgr.updateObjectPosition(objects[i]);
+	}
+
+	saomgr.getObjectsInsideRadius(v3f(-5000, 0, 0), 100, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 3);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(0, 0, 0), 250, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-5000, 0, 0, -5000, 20, 0), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 3);
+
+	saomgr.removeObject(objects[0]->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(-5000, 0, 0), 100, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 2);
+
+	std::queue<u16> added;
+	std::set<u16> cur_objects;
+	saomgr.getAddedActiveObjectsAroundPos(v3f(-5000, 0, 0), 100, 0,
+			cur_objects, added);
+	UASSERTCMP(int, ==, added.size(), 2);
+
+	clearSAOMgr(&saomgr);
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <atomic>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/workerpool.h"
 
 
 class TestThreading : public TestBase {
@@ -32,6 +33,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -40,6 +42,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -156,3 +159,34 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("TestPool", 3);
+	UASSERT(pool.getThreadCount() == 3);
+	UASSERT(pool.getWorkerCount() == 4);
+
+	const size_t count = 1000;
+	std::vector<std::atomic<u32>> visits(count);
+	std::atomic<u32> bad_worker(0);
+
+	// The pool must be reusable for consecutive jobs
+	for (u32 round = 1; round <= 3; round++) {
+		pool.run(count, [&] (size_t i, unsigned int worker) {
+			if (worker >= pool.getWorkerCount())
+				bad_worker++;
+			visits[i]++;
+		});
+
+		for (size_t i = 0; i != count; i++)
+			UASSERTEQ(u32, visits[i], round);
+	}
+	UASSERTEQ(u32, bad_worker, 0);
+
+	// Empty jobs do not call anything
+	pool.run(0, [&] (size_t i, unsigned int worker) {
+		bad_worker++;
+	});
+	UASSERTEQ(u32, bad_worker, 0);
+}
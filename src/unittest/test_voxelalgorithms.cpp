@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
 #include "voxelalgorithms.h"
 #include "util/numeric.h"
 
@@ -31,6 +34,7 @@ class TestVoxelAlgorithms : public TestBase {
 	void runTests(IGameDef *gamedef);
 
 	void testVoxelLineIterator(const NodeDefManager *ndef);
+	void testLightingBatchParallel(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -40,6 +44,7 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 	const NodeDefManager *ndef = gamedef->getNodeDefManager();
 
 	TEST(testVoxelLineIterator, ndef);
+	TEST(testLightingBatchParallel, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -99,3 +104,99 @@ void TestVoxelAlgorithms::testVoxelLineIterator(const NodeDefManager *ndef)
 		UASSERTEQ(int, actual_nodecount, nodecount);
 	}
 }
+
+// 4x3x4 mapblocks of stone below y = 0 and dark air above
+class LightingTestMap : public TestMap
+{
+public:
+	LightingTestMap(IGameDef *gamedef) :
+		TestMap(gamedef, v3s16(0, -1, 0), v3s16(3, 1, 3))
+	{
+	}
+
+	// Sets the nodes like Map::addNodeAndUpdate(), but updates the
+	// lighting once for all of them
+	void change(const std::vector<std::pair<v3s16, content_t>> &changes)
+	{
+		std::vector<std::pair<v3s16, MapNode>> oldnodes;
+		for (const auto &change : changes) {
+			oldnodes.emplace_back(change.first, getNode(change.first));
+			MapNode n(change.second);
+			setNode(change.first, n);
+		}
+		std::map<v3s16, MapBlock*> modified_blocks;
+		voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+	}
+
+	std::string dumpLight()
+	{
+		std::string result;
+		for (s16 z = 0; z < 64; z++)
+		for (s16 y = -16; y < 32; y++)
+		for (s16 x = 0; x < 64; x++)
+			result.push_back(getNode(v3s16(x, y, z)).param1);
+		return result;
+	}
+};
+
+void TestVoxelAlgorithms::testLightingBatchParallel(IGameDef *gamedef)
+{
+	// Let the sunlight in
+	std::vector<std::pair<v3s16, content_t>> sky;
+	for (s16 z = 0; z < 64; z++)
+	for (s16 x = 0; x < 64; x++)
+		sky.emplace_back(v3s16(x, 31, z), CONTENT_AIR);
+
+	// Torches under a few stone roofs, some of them placed twice or
+	// replaced again in the same batch
+	std::vector<std::pair<v3s16, content_t>> changes;
+	for (s16 z = 2; z < 60; z += 7)
+	for (s16 x = 3; x < 60; x += 6) {
+		v3s16 p(x, 1 + (x + z) % 13, z);
+		changes.emplace_back(p, t_CONTENT_TORCH);
+		for (s16 dz = -1; dz <= 1; dz++)
+		for (s16 dx = -1; dx <= 1; dx++) {
+			v3s16 roof = p + v3s16(dx, 2, dz);
+			changes.emplace_back(roof, t_CONTENT_STONE);
+		}
+		changes.emplace_back(p, (x + z) % 3 ? t_CONTENT_TORCH : t_CONTENT_STONE);
+	}
+	// Dig into the ground
+	for (s16 z = 20; z < 44; z++)
+	for (s16 x = 20; x < 44; x++) {
+		changes.emplace_back(v3s16(x, -1, z), CONTENT_AIR);
+	}
+
+	// The same changes without the duplicates, in order of first change
+	std::vector<std::pair<v3s16, content_t>> final_changes;
+	std::map<v3s16, size_t> first_change;
+	for (const auto &change : changes) {
+		auto it = first_change.find(change.first);
+		if (it == first_change.end()) {
+			first_change[change.first] = final_changes.size();
+			final_changes.push_back(change);
+		} else {
+			final_changes[it->second].second = change.second;
+		}
+	}
+
+	LightingTestMap serial(gamedef);
+	serial.change(sky);
+	UASSERTEQ(u8, serial.getNode(v3s16(10, 0, 10)).getLight(
+		LIGHTBANK_DAY, gamedef->ndef()), LIGHT_SUN);
+	serial.change(changes);
+
+	LightingTestMap parallel(gamedef);
+	parallel.setLightingThreads(3);
+	parallel.change(sky);
+	parallel.change(changes);
+
+	// Duplicate entries only count with the oldest node
+	LightingTestMap reference(gamedef);
+	reference.change(sky);
+	reference.change(final_changes);
+
+	std::string light = serial.dumpLight();
+	UASSERT(light == parallel.dumpLight());
+	UASSERT(light == reference.dumpLight());
+}
@@ -34,6 +34,7 @@ class TestVoxelManipulator : public TestBase {
 
 	void testVoxelArea();
 	void testVoxelManipulator(const NodeDefManager *nodedef);
+	void testBulkOperations();
 };
 
 static TestVoxelManipulator g_test_instance;
@@ -42,6 +43,7 @@ void TestVoxelManipulator::runTests(IGameDef *gamedef)
 {
 	TEST(testVoxelArea);
 	TEST(testVoxelManipulator, gamedef->getNodeDefManager());
+	TEST(testBulkOperations);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -106,3 +108,81 @@ void TestVoxelManipulator::testVoxelManipulator(const NodeDefManager *nodedef)
 	UASSERT(v.getNode(v3s16(-1,0,-1)).getContent() == t_CONTENT_GRASS);
 	EXCEPTION_CHECK(InvalidPositionException, v.getNode(v3s16(0,1,1)));
 }
+
+
+void TestVoxelManipulator::testBulkOperations()
+{
+	VoxelManipulator v;
+	VoxelArea area(v3s16(0,0,0), v3s16(5,1,1));
+	for (s16 z = 0; z <= 1; z++)
+	for (s16 y = 0; y <= 1; y++)
+	for (s16 x = 0; x <= 4; x++)
+		v.setNodeNoRef(v3s16(x,y,z), MapNode(t_CONTENT_STONE));
+	// x = 5 stays without data
+	v.addArea(area);
+
+	// Fill
+	UASSERTEQ(u32, v.fillContent(VoxelArea(v3s16(0,0,0), v3s16(5,0,0)),
+		t_CONTENT_GRASS, 3), 5);
+	UASSERT(v.getNode(v3s16(4,0,0)).getContent() == t_CONTENT_GRASS);
+	UASSERT(v.getNode(v3s16(4,0,0)).getParam2() == 3);
+	UASSERT(v.getNode(v3s16(0,1,0)).getContent() == t_CONTENT_STONE);
+	UASSERT(v.getFlagsRefUnsafe(v3s16(5,0,0)) & VOXELFLAG_NO_DATA);
+
+	// Replace
+	std::vector<content_t> mapping(t_CONTENT_STONE + 1);
+	for (size_t i = 0; i < mapping.size(); i++)
+		mapping[i] = i;
+	mapping[t_CONTENT_STONE] = t_CONTENT_BRICK;
+	UASSERTEQ(u32, v.replaceContent(area, mapping), 15);
+	UASSERT(v.getNode(v3s16(0,1,1)).getContent() == t_CONTENT_BRICK);
+	UASSERT(v.getNode(v3s16(0,0,0)).getContent() == t_CONTENT_GRASS);
+
+	// Count
+	std::vector<u32> counts;
+	v.countContent(area, counts);
+	UASSERTEQ(size_t, counts.size(),
+		std::max(t_CONTENT_GRASS, t_CONTENT_BRICK) + 1U);
+	UASSERTEQ(u32, counts[t_CONTENT_GRASS], 5);
+	UASSERTEQ(u32, counts[t_CONTENT_BRICK], 15);
+
+	// Overlapping copy, one node to the right
+	v.setNodeNoRef(v3s16(0,0,0), MapNode(t_CONTENT_TORCH));
+	v.setNodeNoRef(v3s16(1,0,0), MapNode(CONTENT_IGNORE));
+	UASSERTEQ(u32, v.copyArea(v, VoxelArea(v3s16(0,0,0), v3s16(3,0,0)),
+		v3s16(1,0,0)), 3);
+	UASSERT(v.getNode(v3s16(0,0,0)).getContent() == t_CONTENT_TORCH);
+	UASSERT(v.getNode(v3s16(1,0,0)).getContent() == t_CONTENT_TORCH);
+	// The ignore node was not copied over (2,0,0)
+	UASSERT(v.getNode(v3s16(2,0,0)).getContent() == t_CONTENT_GRASS);
+	UASSERT(v.getNode(v3s16(3,0,0)).getContent() == t_CONTENT_GRASS);
+	UASSERT(v.getNode(v3s16(4,0,0)).getContent() == t_CONTENT_GRASS);
+
+	// Copy from a partly unloaded source into another manipulator
+	VoxelManipulator dst;
+	for (s16 x = 10; x <= 15; x++)
+		dst.setNodeNoRef(v3s16(x,0,0), MapNode(t_CONTENT_WATER));
+	VoxelArea row(v3s16(0,0,0), v3s16(5,0,0));
+	UASSERTEQ(u32, dst.copyArea(v, row, v3s16(10,0,0)), 5);
+	UASSERT(dst.getNode(v3s16(10,0,0)).getContent() == t_CONTENT_TORCH);
+	UASSERT(dst.getNode(v3s16(14,0,0)).getContent() == t_CONTENT_GRASS);
+	// The node without data was not copied over (15,0,0)
+	UASSERT(dst.getNode(v3s16(15,0,0)).getContent() == t_CONTENT_WATER);
+
+	// Move into a partly unloaded destination
+	dst.addArea(VoxelArea(v3s16(10,0,0), v3s16(17,0,0)));
+	UASSERTEQ(u32, dst.moveArea(v, row + v3s16(0,1,0), v3s16(12,0,0),
+		MapNode(CONTENT_AIR)), 4);
+	UASSERT(dst.getNode(v3s16(15,0,0)).getContent() == t_CONTENT_BRICK);
+	UASSERT(dst.getFlagsRefUnsafe(v3s16(16,0,0)) & VOXELFLAG_NO_DATA);
+	// Only the copied source nodes were cleared
+	UASSERT(v.getNode(v3s16(3,1,0)).getContent() == CONTENT_AIR);
+	UASSERT(v.getNode(v3s16(4,1,0)).getContent() == t_CONTENT_BRICK);
+
+	// Overlapping move, one node to the left
+	UASSERTEQ(u32, v.moveArea(v, VoxelArea(v3s16(1,0,1), v3s16(4,0,1)),
+		v3s16(0,0,1), MapNode(CONTENT_AIR)), 4);
+	UASSERT(v.getNode(v3s16(0,0,1)).getContent() == t_CONTENT_BRICK);
+	UASSERT(v.getNode(v3s16(3,0,1)).getContent() == t_CONTENT_BRICK);
+	UASSERT(v.getNode(v3s16(4,0,1)).getContent() == CONTENT_AIR);
+}
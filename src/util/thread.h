@@ -63,6 +63,11 @@ class GetResult {
 	std::pair<Caller, CallerData> caller;
 };
 
+/*
+	Results are popped by whoever waits on the queue, so threads that may
+	wait at the same time need a queue each. Otherwise one of them can take
+	and drop the result another one is waiting for.
+*/
 template<typename Key, typename T, typename Caller, typename CallerData>
 class ResultQueue : public MutexedQueue<GetResult<Key, T, Caller, CallerData> > {
 };
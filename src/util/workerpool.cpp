@@ -0,0 +1,151 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "workerpool.h"
+#include "threading/thread.h"
+#include "debug.h"
+#include "log.h"
+#include "settings.h"
+
+class WorkerPool::WorkerThread : public Thread
+{
+public:
+	WorkerThread(WorkerPool *pool, const std::string &name, unsigned int worker) :
+		Thread(name),
+		m_pool(pool),
+		m_worker(worker)
+	{
+	}
+
+protected:
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		m_pool->work(m_worker);
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+	unsigned int m_worker;
+};
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int num_threads) :
+	m_next(0)
+{
+	for (unsigned int i = 0; i < num_threads; i++) {
+		WorkerThread *thread = new WorkerThread(this, name, i + 1);
+		if (!thread->start()) {
+			errorstream << "WorkerPool: failed to start thread "
+				<< name << " #" << (i + 1) << std::endl;
+			delete thread;
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start_cv.notify_all();
+
+	for (WorkerThread *thread : m_threads) {
+		thread->stop();
+		thread->wait();
+		delete thread;
+	}
+}
+
+void WorkerPool::run(size_t count, const Job &job)
+{
+	if (count == 0)
+		return;
+
+	// Not worth waking anybody up
+	if (m_threads.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			job(i, 0);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_next = 0;
+		m_busy = m_threads.size();
+		m_generation++;
+	}
+	m_start_cv.notify_all();
+
+	for (size_t i = m_next++; i < count; i = m_next++)
+		job(i, 0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this] { return m_busy == 0; });
+	m_job = nullptr;
+}
+
+void WorkerPool::work(unsigned int worker)
+{
+	u32 seen_generation = 0;
+
+	while (true) {
+		const Job *job;
+		size_t count;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start_cv.wait(lock, [this, seen_generation] {
+				return m_stop || m_generation != seen_generation;
+			});
+			if (m_stop)
+				return;
+			seen_generation = m_generation;
+			job = m_job;
+			count = m_count;
+		}
+
+		for (size_t i = m_next++; i < count; i = m_next++)
+			(*job)(i, worker);
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_busy--;
+		}
+		m_done_cv.notify_one();
+	}
+}
+
+s16 resolve_thread_count(const char *setting)
+{
+	s16 num_threads = g_settings->getS16(setting);
+	// If automatic, leave a proc for the emerge thread and one for
+	// some other misc thread
+	if (num_threads == 0)
+		num_threads = Thread::getNumberOfProcessors() - 2;
+	return num_threads;
+}
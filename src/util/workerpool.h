@@ -0,0 +1,79 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+
+/*
+	A fixed set of worker threads for data-parallel jobs.
+
+	run() splits a job into 'count' independent items and blocks until
+	all of them are done. The calling thread takes part in the work, so
+	a pool created with 0 threads simply runs everything inline.
+*/
+
+class WorkerPool
+{
+public:
+	// Called once per item, with the index of the executing worker
+	// (0 is the calling thread, 1..getThreadCount() the pool threads).
+	typedef std::function<void(size_t index, unsigned int worker)> Job;
+
+	WorkerPool(const std::string &name, unsigned int num_threads);
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	unsigned int getThreadCount() const { return m_threads.size(); }
+
+	// Number of distinct worker indices that may be passed to a Job
+	unsigned int getWorkerCount() const { return m_threads.size() + 1; }
+
+	// Runs job(i, worker) for every i in [0, count). Not reentrant.
+	void run(size_t count, const Job &job);
+
+private:
+	class WorkerThread;
+
+	void work(unsigned int worker);
+
+	std::vector<WorkerThread *> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_start_cv;
+	std::condition_variable m_done_cv;
+	bool m_stop = false;
+	u32 m_generation = 0;
+	unsigned int m_busy = 0;
+
+	const Job *m_job = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next;
+};
+
+// Number of threads set by a server thread count setting, including the
+// calling one. 0 in the setting picks one from the number of processors.
+s16 resolve_thread_count(const char *setting);
@@ -268,6 +268,136 @@ void VoxelManipulator::copyTo(MapNode *dst, const VoxelArea& dst_area,
 	}
 }
 
+u32 VoxelManipulator::fillContent(const VoxelArea &a, content_t c, s16 param2)
+{
+	assert(a.hasEmptyExtent() || m_area.contains(a));
+
+	u32 count = 0;
+	for (s32 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s32 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
+		u32 i = m_area.index(a.MinEdge.X, y, z);
+		for (s32 x = a.MinEdge.X; x <= a.MaxEdge.X; x++, i++) {
+			if (m_flags[i] & VOXELFLAG_NO_DATA)
+				continue;
+			m_data[i].setContent(c);
+			if (param2 >= 0)
+				m_data[i].setParam2(param2);
+			count++;
+		}
+	}
+	return count;
+}
+
+u32 VoxelManipulator::replaceContent(const VoxelArea &a,
+		const std::vector<content_t> &mapping)
+{
+	assert(a.hasEmptyExtent() || m_area.contains(a));
+
+	u32 count = 0;
+	for (s32 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s32 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
+		u32 i = m_area.index(a.MinEdge.X, y, z);
+		for (s32 x = a.MinEdge.X; x <= a.MaxEdge.X; x++, i++) {
+			content_t c = m_data[i].getContent();
+			if (c >= mapping.size() || mapping[c] == c ||
+					(m_flags[i] & VOXELFLAG_NO_DATA))
+				continue;
+			m_data[i].setContent(mapping[c]);
+			count++;
+		}
+	}
+	return count;
+}
+
+void VoxelManipulator::countContent(const VoxelArea &a,
+		std::vector<u32> &counts) const
+{
+	assert(a.hasEmptyExtent() || m_area.contains(a));
+
+	for (s32 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s32 y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
+		u32 i = m_area.index(a.MinEdge.X, y, z);
+		for (s32 x = a.MinEdge.X; x <= a.MaxEdge.X; x++, i++) {
+			if (m_flags[i] & VOXELFLAG_NO_DATA)
+				continue;
+			content_t c = m_data[i].getContent();
+			if (c >= counts.size())
+				counts.resize(c + 1);
+			counts[c]++;
+		}
+	}
+}
+
+u32 VoxelManipulator::copyArea(const VoxelManipulator &src,
+		const VoxelArea &src_area, v3s16 dst_pos, std::vector<bool> *copied)
+{
+	const v3s16 &size = src_area.getExtent();
+	if (src_area.hasEmptyExtent()) {
+		if (copied)
+			copied->clear();
+		return 0;
+	}
+	assert(src.m_area.contains(src_area));
+	assert(m_area.contains(VoxelArea(dst_pos, dst_pos + size - v3s16(1, 1, 1))));
+
+	// Gather the source first, the areas may overlap
+	std::vector<MapNode> nodes;
+	nodes.reserve(src_area.getVolume());
+	for (s32 z = src_area.MinEdge.Z; z <= src_area.MaxEdge.Z; z++)
+	for (s32 y = src_area.MinEdge.Y; y <= src_area.MaxEdge.Y; y++) {
+		u32 i = src.m_area.index(src_area.MinEdge.X, y, z);
+		for (s32 x = 0; x < size.X; x++, i++)
+			nodes.push_back((src.m_flags[i] & VOXELFLAG_NO_DATA) ?
+				ContentIgnoreNode : src.m_data[i]);
+	}
+	if (copied)
+		copied->assign(nodes.size(), false);
+
+	u32 count = 0;
+	u32 k = 0;
+	for (s32 z = 0; z < size.Z; z++)
+	for (s32 y = 0; y < size.Y; y++) {
+		u32 i = m_area.index(dst_pos.X, dst_pos.Y + y, dst_pos.Z + z);
+		for (s32 x = 0; x < size.X; x++, i++, k++) {
+			if (nodes[k].getContent() == CONTENT_IGNORE ||
+					(m_flags[i] & VOXELFLAG_NO_DATA))
+				continue;
+			m_data[i] = nodes[k];
+			if (copied)
+				(*copied)[k] = true;
+			count++;
+		}
+	}
+	return count;
+}
+
+u32 VoxelManipulator::moveArea(VoxelManipulator &src,
+		const VoxelArea &src_area, v3s16 dst_pos, MapNode clear)
+{
+	std::vector<bool> copied;
+	u32 count = copyArea(src, src_area, dst_pos, &copied);
+
+	// Clear the copied source nodes, except those overwritten by the copy
+	VoxelArea local(v3s16(0, 0, 0), src_area.getExtent() - v3s16(1, 1, 1));
+	VoxelArea dst_area = local + dst_pos;
+	u32 k = 0;
+	for (s32 z = src_area.MinEdge.Z; z <= src_area.MaxEdge.Z; z++)
+	for (s32 y = src_area.MinEdge.Y; y <= src_area.MaxEdge.Y; y++) {
+		u32 i = src.m_area.index(src_area.MinEdge.X, y, z);
+		for (s32 x = src_area.MinEdge.X; x <= src_area.MaxEdge.X;
+				x++, i++, k++) {
+			if (!copied[k])
+				continue;
+			v3s16 p(x, y, z);
+			if (&src == this && dst_area.contains(p) &&
+					copied[local.index(p - dst_pos)])
+				continue;
+			src.m_data[i] = clear;
+		}
+	}
+	return count;
+}
+
 /*
 	Algorithms
 	-----------------------------------------------------
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapnode.h"
 #include <set>
 #include <list>
+#include <vector>
 #include "util/basic_macros.h"
 
 class NodeDefManager;
@@ -476,6 +477,37 @@ class VoxelManipulator
 	void copyTo(MapNode *dst, const VoxelArea& dst_area,
 			v3s16 dst_pos, v3s16 from_pos, const v3s16 &size);
 
+	/*
+		Bulk operations on the nodes of an area, which has to be inside
+		m_area. Nodes without data are left alone.
+	*/
+
+	// Sets the content and, unless param2 is negative, the param2 of the
+	// nodes. Returns the number of nodes set.
+	u32 fillContent(const VoxelArea &a, content_t c, s16 param2 = -1);
+
+	// Replaces content c by mapping[c] for c < mapping.size(). Returns the
+	// number of nodes changed.
+	u32 replaceContent(const VoxelArea &a, const std::vector<content_t> &mapping);
+
+	// Adds the number of nodes of each content to counts[content],
+	// growing counts as needed
+	void countContent(const VoxelArea &a, std::vector<u32> &counts) const;
+
+	// Copies the nodes of src_area in src to the area of the same size at
+	// dst_pos. src may be this manipulator, with overlapping areas.
+	// CONTENT_IGNORE is not copied. Returns the number of nodes copied.
+	// If copied is given, it is set for each node of src_area in index
+	// order to whether the node was copied.
+	u32 copyArea(const VoxelManipulator &src, const VoxelArea &src_area,
+			v3s16 dst_pos, std::vector<bool> *copied = nullptr);
+
+	// Like copyArea, then sets the copied nodes of src_area to clear, except
+	// for those that were overwritten by the copy. Returns the number of
+	// nodes copied.
+	u32 moveArea(VoxelManipulator &src, const VoxelArea &src_area,
+			v3s16 dst_pos, MapNode clear);
+
 	/*
 		Algorithms
 	*/
@@ -21,6 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "map.h"
+#include "util/workerpool.h"
+#include <memory>
+#include <set>
 
 namespace voxalgo
 {
@@ -406,6 +409,182 @@ void spread_light(Map *map, const NodeDefManager *nodemgr, LightBank bank,
 	}
 }
 
+/*!
+ * Below this many starting nodes spreading is not worth distributing
+ * to the lighting worker threads.
+ */
+#define PARALLEL_SPREAD_MIN_LIGHTS 64
+
+/*!
+ * Spread state of one map block in spread_light_parallel().
+ */
+struct BlockLightSpread {
+	MapBlock *block;
+	mapblock_v3 block_position;
+	//! Nodes in this block whose light was already set.
+	LightQueue queue;
+	//! Light entering this block, not yet applied.
+	std::vector<std::pair<u8, ChangingLight>> incoming;
+	//! Light leaving this block, to be handed to the neighbor blocks.
+	std::vector<std::pair<u8, ChangingLight>> outgoing;
+	bool modified = false;
+
+	BlockLightSpread(MapBlock *b, const mapblock_v3 &pos) :
+		block(b), block_position(pos), queue(0)
+	{}
+};
+
+/*
+ * Spreads light inside the given block, see spread_light().
+ * Only accesses the given block, light reaching the neighbor
+ * blocks is collected in spread.outgoing.
+ */
+static void spread_light_in_block(Map *map, const NodeDefManager *nodemgr,
+	LightBank bank, BlockLightSpread &spread)
+{
+	bool is_valid_position;
+	MapBlock *block = spread.block;
+	// The queue was emptied in the previous round
+	spread.queue.max_light = LIGHT_SUN;
+
+	// Apply the light coming from the neighbor blocks
+	for (const auto &in : spread.incoming) {
+		const ChangingLight &cl = in.second;
+		MapNode n = block->getNodeNoCheck(cl.rel_position, &is_valid_position);
+		const ContentFeatures &f = nodemgr->get(n.getContent());
+		if (f.light_propagates && n.getLightRaw(bank, f) < in.first) {
+			n.setLight(bank, in.first, f);
+			block->setNodeNoCheck(cl.rel_position, n);
+			spread.queue.push(in.first, cl.rel_position, cl.block_position,
+				block, cl.source_direction);
+			spread.modified = true;
+		}
+	}
+	spread.incoming.clear();
+
+	u8 spreading_light;
+	ChangingLight current;
+	mapblock_v3 neighbor_block_pos;
+	relative_v3 neighbor_rel_pos;
+	while (spread.queue.next(spreading_light, current)) {
+		spreading_light--;
+		for (direction i = 0; i < 6; i++) {
+			// This node can't light up its light source
+			if (current.source_direction + i == 5) {
+				continue;
+			}
+			neighbor_rel_pos = current.rel_position;
+			neighbor_block_pos = current.block_position;
+			if (step_rel_block_pos(i, neighbor_rel_pos, neighbor_block_pos)) {
+				// The owner of the neighbor block continues from here
+				MapBlock *neighbor_block =
+					map->getBlockNoCreateNoEx(neighbor_block_pos);
+				if (neighbor_block == NULL) {
+					block->setLightingComplete(bank, i, false);
+					continue;
+				}
+				spread.outgoing.emplace_back(spreading_light, ChangingLight(
+					neighbor_rel_pos, neighbor_block_pos, neighbor_block, i));
+				continue;
+			}
+			MapNode neighbor = block->getNodeNoCheck(neighbor_rel_pos,
+				&is_valid_position);
+			const ContentFeatures &f = nodemgr->get(neighbor.getContent());
+			if (f.light_propagates) {
+				u8 neighbor_light = neighbor.getLightRaw(bank, f);
+				if (neighbor_light < spreading_light) {
+					neighbor.setLight(bank, spreading_light, f);
+					block->setNodeNoCheck(neighbor_rel_pos, neighbor);
+					spread.queue.push(spreading_light, neighbor_rel_pos,
+						neighbor_block_pos, block, i);
+					spread.modified = true;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Same as spread_light(), with the map blocks distributed to the
+ * worker pool.
+ *
+ * Every block spreads light inside itself, the light leaving it is
+ * applied by the neighbor block in the next round. Since spreading only
+ * raises light levels, up to the brightest reachable one, the order
+ * doesn't matter and the result is the same as spread_light()'s.
+ */
+static void spread_light_parallel(Map *map, const NodeDefManager *nodemgr,
+	LightBank bank, LightQueue &light_sources,
+	std::map<v3s16, MapBlock*> &modified_blocks, WorkerPool *pool)
+{
+	std::map<v3s16, std::unique_ptr<BlockLightSpread>> spreads;
+	auto get_spread = [&] (const mapblock_v3 &pos, MapBlock *block) ->
+			BlockLightSpread * {
+		std::unique_ptr<BlockLightSpread> &spread = spreads[pos];
+		if (!spread)
+			spread.reset(new BlockLightSpread(block, pos));
+		return spread.get();
+	};
+
+	std::vector<BlockLightSpread *> active;
+	for (u8 i = 0; i <= LIGHT_SUN; i++) {
+		for (const ChangingLight &cl : light_sources.lights[i]) {
+			BlockLightSpread *spread = get_spread(cl.block_position, cl.block);
+			spread->queue.push(i, cl.rel_position, cl.block_position,
+				cl.block, cl.source_direction);
+		}
+		light_sources.lights[i].clear();
+	}
+	for (auto &it : spreads)
+		active.push_back(it.second.get());
+
+	while (!active.empty()) {
+		pool->run(active.size(), [&] (size_t i, unsigned int worker) {
+			spread_light_in_block(map, nodemgr, bank, *active[i]);
+		});
+
+		// Hand over the light leaving the blocks
+		std::set<BlockLightSpread *> next;
+		for (BlockLightSpread *spread : active) {
+			for (const auto &out : spread->outgoing) {
+				BlockLightSpread *target = get_spread(
+					out.second.block_position, out.second.block);
+				target->incoming.push_back(out);
+				next.insert(target);
+			}
+			spread->outgoing.clear();
+		}
+		active.assign(next.begin(), next.end());
+	}
+
+	for (const auto &it : spreads) {
+		if (it.second->modified)
+			modified_blocks[it.first] = it.second->block;
+	}
+}
+
+/*
+ * Calls spread_light_parallel() if the map has lighting worker threads
+ * and there is enough to do, spread_light() otherwise.
+ */
+static void spread_light_auto(Map *map, const NodeDefManager *nodemgr,
+	LightBank bank, LightQueue &light_sources,
+	std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	WorkerPool *pool = map->getLightingWorkers();
+	if (pool) {
+		size_t count = 0;
+		for (const std::vector<ChangingLight> &lights : light_sources.lights)
+			count += lights.size();
+		if (count >= PARALLEL_SPREAD_MIN_LIGHTS) {
+			spread_light_parallel(map, nodemgr, bank, light_sources,
+				modified_blocks, pool);
+			return;
+		}
+	}
+	spread_light(map, nodemgr, bank, light_sources, modified_blocks);
+}
+
 struct SunlightPropagationUnit{
 	v2s16 relative_pos;
 	bool is_sunlit;
@@ -467,13 +646,27 @@ bool is_sunlight_above(Map *map, v3s16 pos, const NodeDefManager *ndef)
 static const LightBank banks[] = { LIGHTBANK_DAY, LIGHTBANK_NIGHT };
 
 void update_lighting_nodes(Map *map,
-	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+	std::vector<std::pair<v3s16, MapNode> > &all_oldnodes,
 	std::map<v3s16, MapBlock*> &modified_blocks)
 {
 	const NodeDefManager *ndef = map->getNodeDefManager();
 	// For node getter functions
 	bool is_valid_position;
 
+	// If a node was changed more than once, only its first old node
+	// was on the map before the changes.
+	std::vector<std::pair<v3s16, MapNode> > deduplicated;
+	if (all_oldnodes.size() > 1) {
+		std::set<v3s16> seen;
+		deduplicated.reserve(all_oldnodes.size());
+		for (const auto &oldnode : all_oldnodes) {
+			if (seen.insert(oldnode.first).second)
+				deduplicated.push_back(oldnode);
+		}
+	}
+	const std::vector<std::pair<v3s16, MapNode> > &oldnodes =
+		deduplicated.size() < all_oldnodes.size() ? deduplicated : all_oldnodes;
+
 	// Process each light bank separately
 	for (LightBank bank : banks) {
 		UnlightQueue disappearing_lights(256);
@@ -482,7 +675,7 @@ void update_lighting_nodes(Map *map,
 		// won't change, since they didn't get their light from a
 		// modified node.
 		u8 min_safe_light = 0;
-		for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
+		for (std::vector<std::pair<v3s16, MapNode> >::const_iterator it =
 				oldnodes.begin(); it < oldnodes.end(); ++it) {
 			u8 old_light = it->second.getLight(bank, ndef);
 			if (old_light > min_safe_light) {
@@ -495,7 +688,7 @@ void update_lighting_nodes(Map *map,
 			min_safe_light++;
 		}
 		// For each changed node process sunlight and initialize
-		for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
+		for (std::vector<std::pair<v3s16, MapNode> >::const_iterator it =
 				oldnodes.begin(); it < oldnodes.end(); ++it) {
 			// Get position and block of the changed node
 			v3s16 p = it->first;
@@ -639,7 +832,7 @@ void update_lighting_nodes(Map *map,
 			}
 		}
 		// Spread lights.
-		spread_light(map, ndef, bank, light_sources, modified_blocks);
+		spread_light_auto(map, ndef, bank, light_sources, modified_blocks);
 	}
 }
 
@@ -1042,7 +1235,7 @@ void finish_bulk_light_update(Map *map, mapblock_v3 minblock,
 			}
 		}
 		// Spread lights.
-		spread_light(map, ndef, bank, relight[b], *modified_blocks);
+		spread_light_auto(map, ndef, bank, relight[b], *modified_blocks);
 	}
 }
 
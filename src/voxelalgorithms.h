@@ -38,6 +38,11 @@ namespace voxalgo
  * Before calling this procedure make sure that all new nodes on
  * the map have zero light level!
  *
+ * Any number of changes can be passed at once and they are processed
+ * together, which is much cheaper than one call per node. If a position
+ * occurs more than once, its first entry must be the node that was there
+ * before all the changes; the others are ignored.
+ *
  * \param oldnodes contains the MapNodes that were replaced by the new
  * MapNodes and their positions
  * \param modified_blocks output, contains all map blocks that